@@ -8,6 +8,7 @@
 #include "astree.h"
 #include "string_set.h"
 #include "lyutils.h"
+#include "symbol_table.h"
 
 string get_attributes(astree* node) ;
 
@@ -20,9 +21,10 @@ astree::astree (int symbol_, const location& lloc_, const char* info) {
        lexinfo = new string("");
    }
    parent_struct = new string();
-   parent_lloc = new string();
+   declaration = nullptr;
    attributes = 0;
    blocknr = 0;
+   label = 0;
 }
 
 astree::~astree() {
@@ -72,17 +74,19 @@ void astree::dump (FILE* outfile, astree* tree) {
                    else tree->dump_node (outfile);
 }
 
+// The indentation goes out in one write, not one per level, since
+// it is most of the file for deeply nested code.
 void astree::print (FILE* outfile, astree* tree, int depth) {
-   char* attr_str = strdup(get_attributes(tree).c_str());
-   for(int i = 0; i < depth; i++) {
-       fprintf (outfile, "|%s", "   ");
-   }
+   static string indent;
+   size_t width = 4 * static_cast<size_t>(depth);
+   while (indent.size() < width) indent += "|   ";
+   fwrite (indent.data(), 1, width, outfile);
    const char* tname = parser::get_tname(tree->symbol);
    if (strstr (tname, "TOK_") == tname) tname += 4;
    fprintf (outfile, "%s \"%s\" (%zd.%zd.%zd) {%zd} %s\n",
             tname, tree->lexinfo->c_str(),
             tree->lloc.filenr, tree->lloc.linenr, tree->lloc.offset,
-            tree->blocknr, attr_str);
+            tree->blocknr, get_attributes(tree).c_str());
    for (astree* child: tree->children) {
       astree::print (outfile, child, depth + 1);
    }
@@ -104,6 +108,11 @@ void errllocprintf (const location& lloc, const char* format,
               buffer);
 }
 
+string location_key (const location& lloc) {
+   return to_string (lloc.filenr) + "." + to_string (lloc.linenr)
+          + "." + to_string (lloc.offset);
+}
+
 string get_attributes(astree* node) {
     string attributes;
     if(node->attributes[ATTR_void]){
@@ -153,8 +162,16 @@ string get_attributes(astree* node) {
     if(node->attributes[ATTR_vaddr]){
         attributes += "vaddr ";
     }
-    if(!node->parent_lloc->empty()) {
-        attributes += *node->parent_lloc;
+    // A declaration points at its own symbol; only uses say where
+    // they were declared.
+    if(node->declaration != nullptr && node->symbol != TOK_DECLID) {
+        attributes += "(";
+        attributes += to_string(node->declaration->filenr);
+        attributes += ".";
+        attributes += to_string(node->declaration->linenr);
+        attributes += ".";
+        attributes += to_string(node->declaration->offset);
+        attributes += ")";
     }
     return attributes;
 }
@@ -39,7 +39,8 @@ struct astree {
    attr_bitset attributes;
    size_t blocknr;
    string *parent_struct;
-   string *parent_lloc;
+   struct symbol *declaration;
+   size_t label;           // number shared by a statement's labels
 
    // Functions.
    astree (int symbol, const location&, const char* lexinfo);
@@ -56,5 +57,8 @@ void destroy (astree* tree1, astree* tree2 = nullptr);
 
 void errllocprintf (const location&, const char* format, const char*);
 
+// "filenr.linenr.offset", as the tree dumps print a location.
+string location_key (const location&);
+
 #endif
 
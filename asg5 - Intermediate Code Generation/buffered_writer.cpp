@@ -0,0 +1,65 @@
+#include <cstring>
+
+#include "buffered_writer.h"
+
+buffered_writer::buffered_writer(FILE *out_) : out(out_), length(0) {
+}
+
+buffered_writer::~buffered_writer() {
+    flush();
+}
+
+void buffered_writer::open(FILE *out_) {
+    flush();
+    out = out_;
+}
+
+void buffered_writer::put(char c) {
+    if (length == sizeof buffer) flush();
+    buffer[length++] = c;
+}
+
+void buffered_writer::put(const char *str, size_t len) {
+    while (len > 0) {
+        if (length == sizeof buffer) flush();
+        size_t room = sizeof buffer - length;
+        size_t chunk = len < room ? len : room;
+        memcpy(buffer + length, str, chunk);
+        length += chunk;
+        str += chunk;
+        len -= chunk;
+    }
+}
+
+void buffered_writer::put(const char *str) {
+    put(str, strlen(str));
+}
+
+void buffered_writer::put(const string &str) {
+    put(str.data(), str.size());
+}
+
+void buffered_writer::put_size(size_t value) {
+    char digits[24];
+    char *end = digits + sizeof digits;
+    char *begin = end;
+    do {
+        *--begin = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    put(begin, static_cast<size_t>(end - begin));
+}
+
+void buffered_writer::put_repeat(const char *str, int count) {
+    size_t len = strlen(str);
+    for (int i = 0; i < count; i++) {
+        put(str, len);
+    }
+}
+
+void buffered_writer::flush() {
+    if (out != nullptr && length > 0) {
+        fwrite(buffer, 1, length, out);
+    }
+    length = 0;
+}
@@ -0,0 +1,31 @@
+#ifndef __BUFFERED_WRITER_H__
+#define __BUFFERED_WRITER_H__
+
+#include <cstdio>
+#include <string>
+
+using namespace std;
+
+// Output sink that copies text into a fixed-size buffer and hands it
+// to stdio only when the buffer fills or flush() is called, so that
+// emitting a line never touches the heap.
+struct buffered_writer {
+    explicit buffered_writer(FILE *out = nullptr);
+    ~buffered_writer();
+
+    void open(FILE *out);
+    void put(char c);
+    void put(const char *str);
+    void put(const char *str, size_t len);
+    void put(const string &str);
+    void put_size(size_t value);
+    void put_repeat(const char *str, int count);
+    void flush();
+
+private:
+    FILE *out;
+    size_t length;
+    char buffer[0x2000];
+};
+
+#endif
@@ -0,0 +1,426 @@
+#include <cstdio>
+#include <set>
+#include <unordered_map>
+
+#include "c_writer.h"
+
+// The oclib.c function for each vm_builtin, with the casts its
+// arguments need.
+const struct {
+    const char *name;
+    size_t params;
+    const char *casts[3];
+} C_BUILTINS[] = {
+    {"__putb", 1, {"char"}},
+    {"__putc", 1, {"char"}},
+    {"__puti", 1, {"int"}},
+    {"__puts", 1, {"char*"}},
+    {"__endl", 0, {}},
+    {"__getc", 0, {}},
+    {"__getw", 0, {}},
+    {"__getln", 0, {}},
+    {"__getargv", 0, {}},
+    {"__exit", 1, {"int"}},
+    {"____assert_fail", 3, {"char*", "char*", "int"}},
+};
+static_assert(sizeof C_BUILTINS / sizeof *C_BUILTINS == VM_BUILTINS,
+              "one entry per builtin");
+
+// oclib.oh declares the builtins for C when __OCLIB_C__ is defined,
+// and oclib.h the rest of the runtime, as for oclib.c itself.
+const char *const C_PRELUDE =
+    "#define __OCLIB_C__\n"
+    "#include \"oclib.oh\"\n"
+    "#include \"oclib.h\"\n";
+
+const char *const C_HELPERS =
+    "\n"
+    "static inline intptr_t oc_div (intptr_t a, intptr_t b) {\n"
+    "    return b == -1 ? (int32_t) (0u - (uint32_t) a) : a / b;\n"
+    "}\n"
+    "\n"
+    "static inline intptr_t oc_rem (intptr_t a, intptr_t b) {\n"
+    "    return b == -1 ? 0 : a % b;\n"
+    "}\n";
+
+string function_name(const vm_program &program, size_t index) {
+    if (index == 0) return program.functions[0].name;
+    return "__" + program.functions[index].name;
+}
+
+void append_literal(string &out, const string &text) {
+    out += '"';
+    for (char c: text) {
+        unsigned char byte = static_cast<unsigned char>(c);
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (c == '\t') {
+            out += "\\t";
+        } else if (byte < ' ' || byte >= 0x7F) {
+            char octal[8];
+            snprintf(octal, sizeof octal, "\\%03o", byte);
+            out += octal;
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+string int32(const string &expr) {
+    return "(int32_t) (" + expr + ")";
+}
+
+// With --profile-generate, the counters a program keeps, one for each
+// line of its profile, and the text that line gives after the count.
+struct c_counters {
+    string path;
+    vector<string> keys;
+    unordered_map<string, size_t> index;
+
+    string bump(const string &key);
+};
+
+string c_counters::bump(const string &key) {
+    auto found = index.insert({key, keys.size()});
+    if (found.second) keys.push_back(key);
+    return "oc_counts[" + to_string(found.first->second) + "]++";
+}
+
+// A function as C.  With the collector, registers that may hold
+// pointers become slots of a roots array, which the function pushes on
+// gc_frames while it runs; parameters among them are copied in.
+struct c_function {
+    const vm_program &program;
+    size_t index;
+    const vm_function &function;
+    const char *allocator;
+    bool collect;
+    vector<string> names;           // C lvalue of each register
+    vector<bool> rooted;
+    size_t roots = 0;
+    set<size_t> targets;            // offsets jumped to
+    set<size_t> leaders;            // offsets that start a block
+
+    c_function(const vm_program &program_, size_t index_,
+               const char *allocator_, bool collect_);
+
+    const string &reg(size_t number) const { return names[number]; }
+    string param(size_t number) const;
+    string signature() const;
+    string builtin_call(const vm_instr &instr) const;
+    string statement(const vm_instr &instr) const;
+    string count(size_t at, c_counters &counters) const;
+    void emit(string &out, c_counters *counters) const;
+};
+
+c_function::c_function(const vm_program &program_, size_t index_,
+                       const char *allocator_, bool collect_)
+        : program(program_), index(index_),
+          function(program_.functions[index_]), allocator(allocator_),
+          collect(collect_) {
+    for (size_t i = 0; i < function.registers; i++) {
+        rooted.push_back(collect && i < function.pointers.size()
+                         && function.pointers[i]);
+        if (rooted[i]) {
+            names.push_back("roots[" + to_string(roots++) + "]");
+        } else {
+            names.push_back("r" + to_string(i));
+        }
+    }
+    leaders.insert(0);
+    for (size_t at = 0; at < function.code.size(); at++) {
+        switch (function.code[at].opcode) {
+            case VM_JUMP:
+            case VM_JUMPF:
+                targets.insert(static_cast<size_t>(
+                        function.code[at].wide()));
+                leaders.insert(static_cast<size_t>(
+                        function.code[at].wide()));
+                leaders.insert(at + 1);
+                break;
+            case VM_RETURN:
+            case VM_RETURNV:
+                leaders.insert(at + 1);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+string c_function::param(size_t number) const {
+    return rooted[number] ? "a" + to_string(number) : names[number];
+}
+
+string c_function::signature() const {
+    if (index == 0) return "void " + function_name(program, 0) + " (void)";
+    string text = "static intptr_t " + function_name(program, index) + " (";
+    for (size_t i = 0; i < function.params; i++) {
+        if (i > 0) text += ", ";
+        text += "intptr_t " + param(i);
+    }
+    if (function.params == 0) text += "void";
+    return text + ")";
+}
+
+string c_function::builtin_call(const vm_instr &instr) const {
+    const auto &builtin = C_BUILTINS[instr.b];
+    string text = builtin.name;
+    text += " (";
+    for (size_t i = 0; i < builtin.params; i++) {
+        if (i > 0) text += ", ";
+        text += "(";
+        text += builtin.casts[i];
+        text += ") " + reg(instr.c + i);
+    }
+    text += ")";
+    switch (instr.b) {
+        case VM_GETCHAR:
+            return reg(instr.a) + " = " + text;
+        case VM_GETW:
+        case VM_GETLN:
+        case VM_GETARGV:
+            return reg(instr.a) + " = (intptr_t) " + text;
+        default:
+            return text;
+    }
+}
+
+string c_function::statement(const vm_instr &instr) const {
+    string a = instr.a < names.size() ? reg(instr.a) : "";
+    string b = instr.b < names.size() ? reg(instr.b) : "";
+    string c = instr.c < names.size() ? reg(instr.c) : "";
+    string wide = to_string(instr.wide());
+    switch (instr.opcode) {
+        case VM_LOADI:    return a + " = " + wide;
+        case VM_LOADS:    return a + " = (intptr_t) oc_string_" + wide;
+        case VM_MOVE:     return a + " = " + b;
+        case VM_GETG:     return a + " = " + "_0_" + program.globals[
+                                         instr.wide()];
+        case VM_SETG:     return "_0_" + program.globals[instr.wide()]
+                                 + " = " + a;
+        case VM_ADD:
+            return a + " = " + int32("(uint32_t) " + b
+                                     + " + (uint32_t) " + c);
+        case VM_ADDI:
+            return a + " = " + int32("(uint32_t) " + b + " + (uint32_t) "
+                    + to_string(static_cast<int16_t>(instr.c)));
+        case VM_SUB:
+            return a + " = " + int32("(uint32_t) " + b
+                                     + " - (uint32_t) " + c);
+        case VM_MUL:
+            return a + " = " + int32("(uint32_t) " + b
+                                     + " * (uint32_t) " + c);
+        case VM_DIV:      return a + " = oc_div (" + b + ", " + c + ")";
+        case VM_REM:      return a + " = oc_rem (" + b + ", " + c + ")";
+        case VM_NEG:      return a + " = " + int32("0u - (uint32_t) " + b);
+        case VM_NOT:      return a + " = !" + b;
+        case VM_EQ:       return a + " = " + b + " == " + c;
+        case VM_NE:       return a + " = " + b + " != " + c;
+        case VM_LT:       return a + " = " + b + " < " + c;
+        case VM_LE:       return a + " = " + b + " <= " + c;
+        case VM_GT:       return a + " = " + b + " > " + c;
+        case VM_GE:       return a + " = " + b + " >= " + c;
+        case VM_JUMP:     return "goto L" + wide;
+        case VM_JUMPF:    return "if (!" + a + ") goto L" + wide;
+        case VM_CALL: {
+            const vm_function &callee = program.functions[instr.b];
+            string text = a + " = " + function_name(program, instr.b)
+                          + " (";
+            for (size_t i = 0; i < callee.params; i++) {
+                if (i > 0) text += ", ";
+                text += reg(instr.c + i);
+            }
+            return text + ")";
+        }
+        case VM_BUILTIN:  return builtin_call(instr);
+        case VM_RETURN:   return "return " + a;
+        case VM_RETURNV:  return "return 0";
+        case VM_NEWSTRUCT:
+            if (collect) {
+                return a + " = (intptr_t) gc_alloc (GC_STRUCT, "
+                       + to_string(instr.b) + ", oc_map_"
+                       + program.structs[instr.c].name + ")";
+            }
+            return a + " = (intptr_t) " + allocator + " (1, "
+                   + to_string(instr.b == 0 ? 1 : instr.b)
+                   + " * sizeof (intptr_t))";
+        case VM_NEWARRAY:
+            if (collect) {
+                return a + " = (intptr_t) gc_alloc ("
+                       + (instr.c ? "GC_POINTERS" : "GC_WORDS")
+                       + ", (int) " + b + ", 0)";
+            }
+            return a + " = (intptr_t) " + allocator + " ((int) " + b
+                   + ", sizeof (intptr_t))";
+        case VM_NEWSTRING:
+            if (collect) {
+                return a + " = (intptr_t) gc_alloc (GC_BYTES, (int) " + b
+                       + " + 1, 0)";
+            }
+            return a + " = (intptr_t) " + allocator + " ((int) " + b
+                   + " + 1, 1)";
+        case VM_GETF:
+            return a + " = ((intptr_t*) " + b + ")[" + to_string(instr.c)
+                   + "]";
+        case VM_SETF:
+            return "((intptr_t*) " + b + ")[" + to_string(instr.c)
+                   + "] = " + a;
+        case VM_GETX:     return a + " = ((intptr_t*) " + b + ")[" + c + "]";
+        case VM_SETX:     return "((intptr_t*) " + b + ")[" + c + "] = " + a;
+        case VM_GETC:
+            return a + " = ((signed char*) " + b + ")[" + c + "]";
+        case VM_SETC:
+            return "((char*) " + b + ")[" + c + "] = (char) " + a;
+        default:
+            return "";
+    }
+}
+
+// Bumps the counters for the instruction at offset at: its block's if
+// it starts one, a call's edge, a field's accesses.  A branch counts
+// how often it is tested here and how often taken where it jumps, by
+// the location of its if or while.
+string c_function::count(size_t at, c_counters &counters) const {
+    const vm_instr &instr = function.code[at];
+    string name = function_name(program, index);
+    string line = to_string(function.lines[at]);
+    string text;
+    if (leaders.count(at) != 0) {
+        text += "    " + counters.bump("block " + name + " "
+                                       + to_string(at) + " " + line)
+                + ";\n";
+    }
+    auto selected = function.selects.find(at);
+    if (instr.opcode == VM_CALL) {
+        text += "    " + counters.bump("call " + name + " "
+                                       + function_name(program, instr.b))
+                + ";\n";
+    } else if (selected != function.selects.end()) {
+        const vm_struct_map &map = program.structs[selected->second];
+        text += "    " + counters.bump("field s_" + map.name + ".__"
+                                       + map.fields[instr.c])
+                + ";\n";
+    } else if (instr.opcode == VM_JUMPF) {
+        text += "    " + counters.bump("branch "
+                                       + function.sites.at(at))
+                + ";\n";
+    }
+    return text;
+}
+
+void c_function::emit(string &out, c_counters *counters) const {
+    out += "\n" + signature() + " {\n";
+    for (size_t i = function.params; i < function.registers; i++) {
+        if (!rooted[i]) out += "    intptr_t " + reg(i) + " = 0;\n";
+    }
+    if (roots > 0) {
+        string count = to_string(roots);
+        out += "    intptr_t roots[" + count + "] = {0};\n";
+        out += "    struct gc_frame frame = {gc_frames, " + count
+               + ", roots};\n";
+        out += "    gc_frames = &frame;\n";
+        for (size_t i = 0; i < function.params; i++) {
+            if (rooted[i]) {
+                out += "    " + reg(i) + " = " + param(i) + ";\n";
+            }
+        }
+    }
+    if (index == 0 && collect) {
+        out += "    gc_start ();\n";
+        for (size_t i = 0; i < program.globals.size(); i++) {
+            if (!program.global_pointers[i]) continue;
+            out += "    gc_global (&_0_" + program.globals[i] + ");\n";
+        }
+    }
+    if (index == 0 && counters != nullptr) {
+        string path;
+        append_literal(path, counters->path);
+        out += "    prof_start (oc_counts, oc_keys, (int) (sizeof oc_counts"
+               " / sizeof *oc_counts),\n                " + path + ");\n";
+    }
+    for (size_t at = 0; at < function.code.size(); at++) {
+        if (targets.count(at) != 0) out += "L" + to_string(at) + ":;\n";
+        const vm_instr &instr = function.code[at];
+        if (counters != nullptr) out += count(at, *counters);
+        bool leaves = instr.opcode == VM_RETURN
+                      || instr.opcode == VM_RETURNV;
+        if (leaves && roots > 0) out += "    gc_frames = frame.prev;\n";
+        if (leaves && index == 0) {
+            out += "    return;\n";
+        } else if (counters != nullptr && instr.opcode == VM_JUMPF) {
+            out += "    if (!" + reg(instr.a) + ") {"
+                   + counters->bump("taken " + function.sites.at(at))
+                   + "; goto L" + to_string(instr.wide()) + ";}\n";
+        } else {
+            out += "    " + statement(instr) + ";\n";
+        }
+    }
+    out += "}\n";
+}
+
+string emit_c(const vm_program &program, const char *allocator,
+              bool collect, const char *profile) {
+    string out = C_PRELUDE;
+    out += C_HELPERS;
+
+    if (!program.strings.empty() || !program.globals.empty()) out += "\n";
+    for (size_t i = 0; i < program.strings.size(); i++) {
+        out += "static char oc_string_" + to_string(i) + "[] = ";
+        append_literal(out, program.strings[i]);
+        out += ";\n";
+    }
+    for (const string &global: program.globals) {
+        out += "static intptr_t _0_" + global + ";\n";
+    }
+    if (collect) {
+        for (const vm_struct_map &map: program.structs) {
+            out += "static const unsigned char oc_map_" + map.name
+                   + "[] = {";
+            for (size_t i = 0; i < map.pointers.size(); i++) {
+                out += i == 0 ? "" : ", ";
+                out += map.pointers[i] ? "1" : "0";
+            }
+            out += map.pointers.empty() ? "0};\n" : "};\n";
+        }
+    }
+
+    vector<c_function> functions;
+    for (size_t i = 0; i < program.functions.size(); i++) {
+        functions.emplace_back(program, i, allocator, collect);
+    }
+    // The counters are declared ahead of the code, once it has used
+    // them all.
+    c_counters counters;
+    c_counters *counted = nullptr;
+    if (profile != nullptr) {
+        counters.path = profile;
+        counted = &counters;
+    }
+    string code;
+    for (size_t i = 1; i < functions.size(); i++) {
+        functions[i].emit(code, counted);
+    }
+    functions[0].emit(code, counted);
+
+    if (counted != nullptr) {
+        out += "\nstatic unsigned long long oc_counts["
+               + to_string(counters.keys.size()) + "];\n";
+        out += "static const char* const oc_keys[] = {\n";
+        for (const string &key: counters.keys) {
+            out += "    ";
+            append_literal(out, key);
+            out += ",\n";
+        }
+        out += "};\n";
+    }
+    out += "\n";
+    for (const c_function &function: functions) {
+        out += function.signature() + ";\n";
+    }
+    return out + code;
+}
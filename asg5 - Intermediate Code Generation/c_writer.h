@@ -0,0 +1,29 @@
+#ifndef __C_WRITER_H__
+#define __C_WRITER_H__
+
+#include <string>
+
+using namespace std;
+
+#include "vm_code.h"
+
+// C11 text for a compiled program, to be linked against oclib.c.
+// Each bytecode function becomes a C function whose window registers
+// are intptr_t locals r0, r1, ..., the first of them its parameters;
+// jumps become gotos and the top-level statements become __ocmain.
+// Builtins call the oclib.c functions of the same name, declared by
+// including oclib.oh with __OCLIB_C__ defined, as oclib.c does.
+// Ints wrap at 32 bits as in the interpreter, but there are no
+// runtime checks: like any C program, the result does whatever the
+// machine does on a null pointer or a bad index.  Memory comes from
+// allocator, xcalloc or arena_calloc, which oclib.c both provide, or
+// with collect from the collector in oclib.c, given a map of the
+// pointers in each struct and a frame for the registers of each call
+// that may hold pointers.  Given a profile path, the program also
+// counts how often each block runs, each branch is taken, each
+// function calls each other and each struct field is used, and
+// oclib.c writes the counts there at exit, named as in the .oil code.
+string emit_c(const vm_program &program, const char *allocator,
+              bool collect, const char *profile);
+
+#endif
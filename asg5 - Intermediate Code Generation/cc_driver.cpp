@@ -0,0 +1,176 @@
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <libgen.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "auxlib.h"
+#include "cc_driver.h"
+
+constexpr uint64_t FNV_OFFSET = 0xCBF29CE484222325;
+constexpr uint64_t FNV_PRIME = 0x100000001B3;
+
+// FNV-1a over text and a terminating zero byte, so that consecutive
+// strings hash differently from their concatenation.
+uint64_t hash_text(uint64_t hash, const string &text) {
+    for (unsigned char byte: text) {
+        hash ^= byte;
+        hash *= FNV_PRIME;
+    }
+    return hash * FNV_PRIME;
+}
+
+string shell_quote(const string &text) {
+    string quoted = "'";
+    for (char c: text) {
+        if (c == '\'') quoted += "'\\''";
+        else quoted += c;
+    }
+    return quoted + "'";
+}
+
+bool read_file(const string &path, string &contents) {
+    ifstream in(path);
+    if (!in) return false;
+    ostringstream text;
+    text << in.rdbuf();
+    contents = text.str();
+    return true;
+}
+
+string directory_of(const string &path) {
+    vector<char> copy(path.begin(), path.end());
+    copy.push_back('\0');
+    return dirname(copy.data());
+}
+
+bool make_directories(const string &path) {
+    for (size_t slash = path.find('/', 1); slash != string::npos;
+         slash = path.find('/', slash + 1)) {
+        mkdir(path.substr(0, slash).c_str(), 0777);
+    }
+    if (mkdir(path.c_str(), 0777) == 0 || errno == EEXIST) return true;
+    syserrprintf(path.c_str());
+    return false;
+}
+
+string cache_directory() {
+    if (const char *cache = getenv("OC_CACHE")) return cache;
+    if (const char *cache = getenv("XDG_CACHE_HOME")) {
+        return string(cache) + "/oc";
+    }
+    if (const char *home = getenv("HOME")) {
+        return string(home) + "/.cache/oc";
+    }
+    return ".oc-cache";
+}
+
+string find_oclib(const char *program) {
+    if (const char *oclib = getenv("OCLIB")) return oclib;
+    vector<string> candidates {directory_of(program) + "/oclib.c"};
+    char self[4096];
+    ssize_t length = readlink("/proc/self/exe", self, sizeof self - 1);
+    if (length > 0) {
+        self[length] = '\0';
+        candidates.push_back(directory_of(self) + "/oclib.c");
+    }
+    for (const string &candidate: candidates) {
+        if (access(candidate.c_str(), R_OK) == 0) return candidate;
+    }
+    return candidates.front();
+}
+
+// Compiles source with the compile command into the cache unless an
+// object for the same command, source and extra text is already there,
+// and returns its path, or "" if the compiler failed.
+string cached_object(const string &cache, const string &compile,
+                     const string &source, const string &extra) {
+    uint64_t hash = hash_text(hash_text(hash_text(FNV_OFFSET, compile),
+                                        source), extra);
+    char name[32];
+    snprintf(name, sizeof name, "%016" PRIx64 ".o", hash);
+    string object = cache + "/" + name;
+    if (access(object.c_str(), R_OK) == 0) return object;
+
+    string temporary = object + "." + to_string(getpid());
+    string command = compile + " -c -o " + shell_quote(temporary)
+                     + " -x c -";
+    FILE *pipe = popen(command.c_str(), "w");
+    if (pipe == nullptr) {
+        syserrprintf(command.c_str());
+        return "";
+    }
+    fwrite(source.data(), 1, source.size(), pipe);
+    int status = pclose(pipe);
+    if (status != 0) {
+        eprint_status(command.c_str(), status);
+        exec::exit_status = EXIT_FAILURE;
+        unlink(temporary.c_str());
+        return "";
+    }
+    if (rename(temporary.c_str(), object.c_str()) != 0) {
+        syserrprintf(object.c_str());
+        unlink(temporary.c_str());
+        return "";
+    }
+    return object;
+}
+
+bool build_executable(const string &source, const char *program,
+                      const char *executable, int opt_level) {
+    const char *cc = getenv("CC");
+    string compiler = cc != nullptr && *cc != '\0' ? cc : "cc";
+    string optimize = " -O" + to_string(opt_level);
+    string cache = cache_directory();
+    if (!make_directories(cache)) return false;
+
+    string oclib = find_oclib(program);
+    string oclib_source;
+    if (!read_file(oclib, oclib_source)) {
+        errprintf("%s: cannot read %s\n", program, oclib.c_str());
+        return false;
+    }
+    // Both oclib.c and the generated code include oclib.oh, which is
+    // found beside either file, and oclib.h from beside oclib.c, so
+    // both are part of both cache keys.
+    vector<string> includes {directory_of(oclib), directory_of(program)};
+    string oclib_header;
+    for (const string &include: includes) {
+        if (read_file(include + "/oclib.oh", oclib_header)) break;
+    }
+    string runtime_header;
+    read_file(directory_of(oclib) + "/oclib.h", runtime_header);
+    oclib_header += runtime_header;
+    string include_flags;
+    for (const string &include: includes) {
+        include_flags += " -I" + shell_quote(include);
+    }
+    string oclib_compile = compiler + " -std=gnu11" + optimize
+                           + include_flags;
+
+    // oclib.c uses POSIX functions; the generated code is plain C11.
+    string object = cached_object(cache, compiler + " -std=c11" + optimize
+                                         + include_flags,
+                                  source, oclib_header);
+    if (object.empty()) return false;
+    string runtime = cached_object(cache, oclib_compile, oclib_source,
+                                   oclib_header);
+    if (runtime.empty()) return false;
+
+    string command = compiler + " -o " + shell_quote(executable) + " "
+                     + shell_quote(object) + " " + shell_quote(runtime);
+    int status = system(command.c_str());
+    if (status != 0) {
+        eprint_status(command.c_str(), status);
+        exec::exit_status = EXIT_FAILURE;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,19 @@
+#ifndef __CC_DRIVER_H__
+#define __CC_DRIVER_H__
+
+#include <string>
+
+using namespace std;
+
+// Compiles C source from emit_c() with the system C compiler ($CC, or
+// cc) at -O level, together with oclib.c, and links the two into
+// executable.  oclib.c is looked for at $OCLIB, then beside program,
+// then beside oc itself; oclib.oh, which both include, beside it or
+// beside program, and oclib.h beside it.  Objects are cached under
+// $OC_CACHE (or ~/.cache/oc) by a hash of the compiler, its flags,
+// the source and both headers, so that rebuilding an unchanged
+// program only links.  Returns false after reporting any failure.
+bool build_executable(const string &source, const char *program,
+                      const char *executable, int opt_level);
+
+#endif
@@ -48,6 +48,7 @@ struct parser {
 };
 
 #define YYSTYPE_IS_DECLARED
+#define YYSTYPE_IS_TRIVIAL 1
 typedef astree* YYSTYPE;
 #include "yyparse.h"
 
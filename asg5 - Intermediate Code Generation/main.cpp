@@ -9,10 +9,19 @@ using namespace std;
 #include "lyutils.h"
 #include "symbol_table.h"
 #include "oil_writer.h"
+#include "oil_cfg.h"
+#include "oil_opt.h"
+#include "c_writer.h"
+#include "cc_driver.h"
+#include "vm_asm.h"
+#include "vm_compile.h"
+#include "vm_jit.h"
+#include "vm_run.h"
 
 #include <libgen.h>
 #include <cstring>
 #include <getopt.h>
+#include <unistd.h>
 
 const string CPP = "/usr/bin/cpp -nostdinc";
 constexpr size_t LINESIZE = 1024;
@@ -21,6 +30,17 @@ extern FILE* yyout;
 extern int yy_flex_debug;
 extern int yydebug;
 
+const struct option LONG_OPTIONS[] = {
+    {"run", no_argument, nullptr, 'r'},
+    {"jit", no_argument, nullptr, 'j'},
+    {"build", no_argument, nullptr, 'b'},
+    {"arena", no_argument, nullptr, 'a'},
+    {"gc", no_argument, nullptr, 'c'},
+    {"profile-generate", no_argument, nullptr, 'p'},
+    {"profile-use", optional_argument, nullptr, 'u'},
+    {nullptr, 0, nullptr, 0},
+};
+
 // Chomp the last character from a buffer if it is delim.
 void chomp (char* string, char delim) {
     size_t len = strlen (string);
@@ -47,30 +67,78 @@ int main (int argc, char** argv) {
     char cpp_options[255];
     cpp_options[0] = '\0';
     vector<astree*> trees;
-    //char* debug_options;
+    bool incremental = false;
+    bool dump_graph = false;
+    bool write_asm = false;
+    bool run = false;
+    bool jit = false;
+    bool build = false;
+    const char* allocator = "xcalloc";
+    bool collect = false;
+    bool profile_generate = false;
+    bool profile_use = false;
+    const char* profile_name = nullptr;
+    int opt_level = 0;
 
     yy_flex_debug = 0;
     yydebug = 0;
 
     int opt;
-    while((opt = getopt(argc, argv, "ly@:D:")) != -1) {
+    while((opt = getopt_long(argc, argv, "+gilSyO:@:D:",
+                             LONG_OPTIONS, nullptr)) != -1) {
         switch (opt) {
+            case 'g':
+                dump_graph = true;
+                break;
+            case 'i':
+                incremental = true;
+                break;
             case 'l':
                 yy_flex_debug = 1;
                 break;
+            case 'S':
+                write_asm = true;
+                break;
+            case 'r':
+                run = true;
+                break;
+            case 'j':
+                run = jit = true;
+                break;
+            case 'b':
+                build = true;
+                break;
+            case 'a':
+                allocator = "arena_calloc";
+                break;
+            case 'c':
+                collect = true;
+                break;
+            case 'p':
+                build = profile_generate = true;
+                break;
+            case 'u':
+                profile_use = true;
+                profile_name = optarg;
+                break;
             case 'y':
                 yydebug = 1;
                 break;
+            case 'O':
+                opt_level = atoi(optarg);
+                break;
             case 'D':
                 strcpy(cpp_options, "-D");
                 strcat(cpp_options, optarg);
                 break;
             case '@':
-                //debug_options = optarg;
+                set_debugflags(optarg);
                 break;
             default:
                 fprintf(stderr, "Usage: oc %s program.oc",
-                        "[-ly] [-@ flag ...] [-D string]\n");
+                        "[-gilSy] [--run|--jit] [--build] [--arena|--gc]"
+                        " [--profile-generate|--profile-use[=file]]"
+                        " [-O level] [-@ flag ...] [-D string]\n");
                 exit(EXIT_FAILURE);
         }
     }
@@ -125,11 +193,26 @@ int main (int argc, char** argv) {
     strcpy(sym_name, base);
     strcat(sym_name, ".sym");
 
+    char cache_name[255];
+    strcpy(cache_name, base);
+    strcat(cache_name, ".tcc");
+
     FILE* out_sym = fopen(sym_name, "w");
-    typecheck(out_sym, parser::root);
+    typecheck(out_sym, parser::root,
+              incremental ? cache_name : nullptr);
     fflush(out_sym);
     fclose(out_sym);
 
+    vm_program program;
+    if (run || build || write_asm) {
+        bool compiled = exec::exit_status == EXIT_SUCCESS
+                        && compile_vm(program, parser::root);
+        run = run && compiled;
+        build = build && compiled;
+        write_asm = write_asm && compiled;
+        DEBUGSTMT('v', dump_vm(stderr, program););
+    }
+
     char ast_name[255];
     strcpy(ast_name, base);
     strcat(ast_name, ".ast");
@@ -143,10 +226,91 @@ int main (int argc, char** argv) {
     strcpy(oil_name, base);
     strcat(oil_name, ".oil");
 
+    oil_module module;
+    lower_oil(&module, parser::root, 0);
+
+    string profile_path = string(base) + ".prof";
+    if (profile_name != nullptr) profile_path = profile_name;
+
+    if (opt_level > 0) {
+        oil_profile profile;
+        bool profiled = profile_use
+                        && read_profile(profile_path.c_str(), profile);
+
+        char opt_name[255];
+        strcpy(opt_name, base);
+        strcat(opt_name, ".opt");
+
+        FILE* out_opt = fopen(opt_name, "w");
+        optimize_oil(&module, opt_level, out_opt,
+                     profiled ? &profile : nullptr);
+        fflush(out_opt);
+        fclose(out_opt);
+    }
+
     FILE* out_oil = fopen(oil_name, "w");
-    generate_oil(parser::root, out_oil, 0);
+    emit_oil(out_oil, module);
     fflush(out_oil);
     fclose(out_oil);
 
+    if (write_asm) {
+        char asm_name[255];
+        strcpy(asm_name, base);
+        strcat(asm_name, ".s");
+
+        FILE* out_asm = fopen(asm_name, "w");
+        bool written = emit_asm(out_asm, program, allocator);
+        fflush(out_asm);
+        fclose(out_asm);
+        if (!written) {
+            remove(asm_name);
+            exec::exit_status = EXIT_FAILURE;
+        }
+    }
+
+    if (dump_graph) {
+        char dot_name[255];
+        strcpy(dot_name, base);
+        strcat(dot_name, ".dot");
+
+        FILE* out_dot = fopen(dot_name, "w");
+        dump_cfg(out_dot, module);
+        fflush(out_dot);
+        fclose(out_dot);
+    }
+
+    typecheck_release();
+
+    if (build) {
+        char c_name[255];
+        strcpy(c_name, base);
+        strcat(c_name, ".c");
+
+        string source = emit_c(program, allocator, collect,
+                               profile_generate ? profile_path.c_str()
+                                                : nullptr);
+        FILE* out_c = fopen(c_name, "w");
+        fputs(source.c_str(), out_c);
+        fflush(out_c);
+        fclose(out_c);
+
+        if (!build_executable(source, filename, base, opt_level)) {
+            return EXIT_FAILURE;
+        }
+        if (run) {
+            string path = string("./") + base;
+            argv[optind] = &path[0];
+            execv(path.c_str(), argv + optind);
+            syserrprintf(path.c_str());
+            return EXIT_FAILURE;
+        }
+        return exec::exit_status;
+    }
+
+    if (run && jit) {
+        return run_jit(program, argc - optind, argv + optind);
+    } else if (run) {
+        return run_vm(program, argc - optind, argv + optind);
+    }
     return exec::exit_status;
 }
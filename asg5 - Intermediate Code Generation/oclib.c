@@ -2,17 +2,56 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
 #include <libgen.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #define __OCLIB_C__
 #include "oclib.oh"
+#include "oclib.h"
 
 char** oc_argv;
 
+// Output goes through a buffer of our own, written out when it fills
+// and at exit.  If stdout is a terminal, or $OC_LINE_BUFFERED is set,
+// it is also written at each endl and before reading input.
+static char out_buffer[1 << 16];
+static size_t out_used;
+static int out_lines;
+
+static void out_write (const char* bytes, size_t length) {
+   while (length > 0) {
+      ssize_t written = write (STDOUT_FILENO, bytes, length);
+      if (written <= 0) return;
+      bytes += written;
+      length -= written;
+   }
+}
+
+static void out_flush (void) {
+   out_write (out_buffer, out_used);
+   out_used = 0;
+}
+
+static void out_bytes (const char* bytes, size_t length) {
+   if (length > sizeof out_buffer - out_used) {
+      out_flush();
+      if (length > sizeof out_buffer) {
+         out_write (bytes, length);
+         return;
+      }
+   }
+   memcpy (out_buffer + out_used, bytes, length);
+   out_used += length;
+}
+
 void ____assert_fail (char* expr, char* file, int line) {
+   out_flush();
    fflush (NULL);
    fprintf (stderr, "%s: %s:%d: assert (%s) failed.\n",
             basename ((char*) oc_argv[0]), file, line, expr);
@@ -26,42 +65,431 @@ void* xcalloc (int nelem, int size) {
    return result;
 }
 
+// Bump allocator that oc --arena calls instead of xcalloc.  Each
+// thread carves blocks out of pages of its own, which come zeroed
+// from mmap, so a fresh block needs no clearing.  Sizes are rounded
+// up to a multiple of ARENA_GRAIN; a block given back by arena_free
+// goes on the free list of its size class and is zeroed when reused.
+// Blocks above ARENA_LARGE bytes are left to calloc.
+#define ARENA_PAGE    (1 << 20)
+#define ARENA_GRAIN   16
+#define ARENA_LARGE   4096
+#define ARENA_CLASSES (ARENA_LARGE / ARENA_GRAIN + 1)
+
+static _Thread_local struct {
+   char* next;
+   char* limit;
+   void* free[ARENA_CLASSES];
+} arena;
+
+static size_t arena_class (int nelem, int size) {
+   size_t bytes = (size_t) nelem * (size_t) size;
+   if (nelem < 0 || size < 0 || bytes > ARENA_LARGE) return 0;
+   return bytes == 0 ? 1 : (bytes + ARENA_GRAIN - 1) / ARENA_GRAIN;
+}
+
+void* arena_calloc (int nelem, int size) {
+   size_t class = arena_class (nelem, size);
+   if (class == 0) return xcalloc (nelem, size);
+   size_t bytes = class * ARENA_GRAIN;
+   void* block = arena.free[class];
+   if (block != NULL) {
+      arena.free[class] = *(void**) block;
+      return memset (block, 0, bytes);
+   }
+   if ((size_t) (arena.limit - arena.next) < bytes) {
+      char* page = mmap (NULL, ARENA_PAGE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      assert (page != MAP_FAILED);
+      arena.next = page;
+      arena.limit = page + ARENA_PAGE;
+   }
+   block = arena.next;
+   arena.next += bytes;
+   return block;
+}
+
+void arena_free (void* block, int nelem, int size) {
+   size_t class = arena_class (nelem, size);
+   if (class == 0) {
+      free (block);
+   }else {
+      *(void**) block = arena.free[class];
+      arena.free[class] = block;
+   }
+}
+
+// Mark-sweep collector for oc --gc, on top of the arena.  Each object
+// has a header saying where its pointers are: nowhere in strings and
+// int arrays, in every word of other arrays, and in the fields of a
+// struct its map marks.  The roots are the globals passed to
+// gc_global and the frames generated code pushes on gc_frames, with
+// the registers that may hold pointers.  A word is only followed if
+// it is the address of an object, as the table of objects says, so
+// string literals are left alone.  Once generated code has called
+// gc_start, the strings getw and getln return are objects too.  A
+// collection runs when the heap has doubled since the last one, or
+// grown by GC_MINIMUM; $OC_HEAP_LIMIT, in bytes or with a k, m or g
+// suffix, is as large as it may get.
+#define GC_MINIMUM (1 << 22)
+
+typedef struct gc_object {
+   struct gc_object* next;
+   const unsigned char* map;
+   int words;
+   int count;
+   unsigned char kind;
+   unsigned char marked;
+} gc_object;
+
+#define GC_HEADER ((int) (sizeof (gc_object) / sizeof (intptr_t)))
+
+struct gc_frame* gc_frames;
+static gc_object* gc_objects;
+static gc_object** gc_table;
+static size_t gc_table_size;
+static size_t gc_table_count;
+static intptr_t** gc_globals;
+static size_t gc_global_count;
+static size_t gc_global_space;
+static gc_object** gc_stack;
+static size_t gc_stack_size;
+static size_t gc_stack_space;
+static size_t gc_heap;
+static size_t gc_next = GC_MINIMUM;
+static size_t gc_limit;
+
+static void* gc_grow (void* array, size_t* size, size_t element) {
+   *size = *size == 0 ? 64 : *size * 2;
+   array = realloc (array, *size * element);
+   assert (array != NULL);
+   return array;
+}
+
+static size_t gc_slot (intptr_t word) {
+   return ((uintptr_t) word >> 4) * 0x9E3779B97F4A7C15u
+          & (gc_table_size - 1);
+}
+
+static void gc_insert (gc_object* object) {
+   size_t slot = gc_slot ((intptr_t) (object + 1));
+   while (gc_table[slot] != NULL) slot = (slot + 1) & (gc_table_size - 1);
+   gc_table[slot] = object;
+   ++gc_table_count;
+}
+
+// Rebuilds the table at a size that leaves it at most half full.
+static void gc_rehash (size_t objects) {
+   size_t size = 1024;
+   while (size < objects * 2) size *= 2;
+   free (gc_table);
+   gc_table = calloc (size, sizeof *gc_table);
+   assert (gc_table != NULL);
+   gc_table_size = size;
+   gc_table_count = 0;
+   for (gc_object* object = gc_objects; object != NULL;
+        object = object->next) {
+      gc_insert (object);
+   }
+}
+
+static gc_object* gc_find (intptr_t word) {
+   if (word == 0 || gc_table_size == 0) return NULL;
+   for (size_t slot = gc_slot (word); gc_table[slot] != NULL;
+        slot = (slot + 1) & (gc_table_size - 1)) {
+      if ((intptr_t) (gc_table[slot] + 1) == word) return gc_table[slot];
+   }
+   return NULL;
+}
+
+static void gc_mark (intptr_t word) {
+   gc_object* object = gc_find (word);
+   if (object == NULL || object->marked) return;
+   object->marked = 1;
+   if (gc_stack_size == gc_stack_space) {
+      gc_stack = gc_grow (gc_stack, &gc_stack_space, sizeof *gc_stack);
+   }
+   gc_stack[gc_stack_size++] = object;
+}
+
+static void gc_collect (void) {
+   for (struct gc_frame* frame = gc_frames; frame != NULL;
+        frame = frame->prev) {
+      for (intptr_t i = 0; i < frame->count; ++i) {
+         gc_mark (frame->slots[i]);
+      }
+   }
+   for (size_t i = 0; i < gc_global_count; ++i) gc_mark (*gc_globals[i]);
+   while (gc_stack_size > 0) {
+      gc_object* object = gc_stack[--gc_stack_size];
+      intptr_t* words = (intptr_t*) (object + 1);
+      if (object->kind == GC_POINTERS || object->kind == GC_STRUCT) {
+         for (int i = 0; i < object->count; ++i) {
+            if (object->map == NULL || object->map[i]) gc_mark (words[i]);
+         }
+      }
+   }
+
+   size_t objects = 0;
+   gc_heap = 0;
+   for (gc_object** link = &gc_objects; *link != NULL;) {
+      gc_object* object = *link;
+      if (object->marked) {
+         object->marked = 0;
+         gc_heap += object->words * sizeof (intptr_t);
+         ++objects;
+         link = &object->next;
+      }else {
+         *link = object->next;
+         arena_free (object, object->words, sizeof (intptr_t));
+      }
+   }
+   gc_rehash (objects);
+   gc_next = gc_heap * 2 > GC_MINIMUM ? gc_heap * 2
+                                      : gc_heap + GC_MINIMUM;
+   if (gc_next > gc_limit) gc_next = gc_limit;
+}
+
+void gc_start (void) {
+   if (gc_limit != 0) return;
+   gc_limit = SIZE_MAX;
+   char* limit = getenv ("OC_HEAP_LIMIT");
+   if (limit == NULL) return;
+   char* suffix;
+   unsigned long long bytes = strtoull (limit, &suffix, 10);
+   switch (tolower ((unsigned char) *suffix)) {
+      case 'g': bytes <<= 10; // fall through
+      case 'm': bytes <<= 10; // fall through
+      case 'k': bytes <<= 10;
+   }
+   if (bytes > 0 && bytes < SIZE_MAX) gc_limit = bytes;
+   if (gc_next > gc_limit) gc_next = gc_limit;
+}
+
+void* gc_alloc (int kind, int count, const unsigned char* map) {
+   gc_start();
+   assert (count >= 0);
+   int words = kind == GC_BYTES ? count / (int) sizeof (intptr_t) + 1
+                                : count;
+   assert (words <= INT_MAX - GC_HEADER);
+   words += GC_HEADER;
+   size_t bytes = words * sizeof (intptr_t);
+   if (gc_heap + bytes > gc_next) gc_collect();
+   if (gc_heap + bytes > gc_limit) {
+      out_flush();
+      fprintf (stderr, "%s: heap limit of %zu bytes exceeded\n",
+               basename ((char*) oc_argv[0]), gc_limit);
+      exit (EXIT_FAILURE);
+   }
+   gc_object* object = arena_calloc (words, sizeof (intptr_t));
+   object->next = gc_objects;
+   object->map = kind == GC_STRUCT ? map : NULL;
+   object->words = words;
+   object->count = count;
+   object->kind = kind;
+   gc_objects = object;
+   gc_heap += bytes;
+   if (gc_table_count * 2 >= gc_table_size) {
+      gc_rehash (gc_table_count + 1);
+   }else {
+      gc_insert (object);
+   }
+   return object + 1;
+}
+
+void gc_global (intptr_t* slot) {
+   if (gc_global_count == gc_global_space) {
+      gc_globals = gc_grow (gc_globals, &gc_global_space,
+                            sizeof *gc_globals);
+   }
+   gc_globals[gc_global_count++] = slot;
+}
+
+// A program built with oc --profile-generate hands its counters over
+// as it starts, with a key for each, and they are written at exit to
+// $OC_PROFILE or the path oc gave, one "count key" line apiece.  If
+// the file there came from the same program, its counts are added in
+// first, so that a profile can sum several runs.
+static unsigned long long* prof_counts;
+static const char* const* prof_keys;
+static int prof_count;
+static const char* prof_path;
+
+static void prof_merge (FILE* file) {
+   unsigned long long* saved = xcalloc (prof_count, sizeof *saved);
+   char* line = NULL;
+   size_t space = 0;
+   int index = 0;
+   int same = 1;
+   while (same && getline (&line, &space, file) > 0) {
+      line[strcspn (line, "\n")] = '\0';
+      int skip = 0;
+      same = index < prof_count
+          && sscanf (line, "%llu %n", &saved[index], &skip) == 1
+          && strcmp (line + skip, prof_keys[index]) == 0;
+      ++index;
+   }
+   if (same && index == prof_count) {
+      for (index = 0; index < prof_count; ++index) {
+         prof_counts[index] += saved[index];
+      }
+   }
+   free (line);
+   free (saved);
+}
+
+static void prof_write (void) {
+   const char* path = getenv ("OC_PROFILE");
+   if (path == NULL) path = prof_path;
+   FILE* file = fopen (path, "r");
+   if (file != NULL) {
+      prof_merge (file);
+      fclose (file);
+   }
+   file = fopen (path, "w");
+   if (file == NULL) {
+      fprintf (stderr, "%s: %s: %s\n", basename ((char*) oc_argv[0]),
+               path, strerror (errno));
+      return;
+   }
+   for (int index = 0; index < prof_count; ++index) {
+      fprintf (file, "%llu %s\n", prof_counts[index], prof_keys[index]);
+   }
+   fclose (file);
+}
+
+void prof_start (unsigned long long* counts, const char* const* keys,
+                 int count, const char* path) {
+   prof_counts = counts;
+   prof_keys = keys;
+   prof_count = count;
+   prof_path = path;
+   atexit (prof_write);
+}
+
 void __ocmain (void);
 int main (int argc, char** argv) {
    (void) argc; // warning: unused parameter 'argc'
    oc_argv = argv;
+   out_lines = isatty (STDOUT_FILENO) || getenv ("OC_LINE_BUFFERED");
+   atexit (out_flush);
    __ocmain();
    return EXIT_SUCCESS;
 }
 
 
+// Input is read with read(2) into a buffer of our own, refilled as
+// it empties.  A word or line is copied straight out of the buffer
+// into the arena, unless it runs past the end of the buffer, when it
+// is gathered in in_token first; so it may be of any length.
+static char in_buffer[1 << 16];
+static size_t in_next;
+static size_t in_end;
+static char* in_token;
+static size_t in_token_space;
+
+static int in_fill (void) {
+   if (out_lines) out_flush();
+   ssize_t got;
+   do {
+      got = read (STDIN_FILENO, in_buffer, sizeof in_buffer);
+   }while (got < 0 && errno == EINTR);
+   in_next = 0;
+   in_end = got > 0 ? got : 0;
+   return got > 0;
+}
+
+static int in_byte (void) {
+   if (in_next == in_end && ! in_fill()) return EOF;
+   return (unsigned char) in_buffer[in_next++];
+}
+
+static void in_keep (size_t length, const char* bytes, size_t count) {
+   if (length + count > in_token_space) {
+      in_token_space = length + count > in_token_space * 2
+                     ? length + count : in_token_space * 2;
+      in_token = realloc (in_token, in_token_space);
+      assert (in_token != NULL);
+   }
+   memcpy (in_token + length, bytes, count);
+}
+
+static char* in_copy (const char* bytes, size_t length) {
+   assert (length < INT_MAX);
+   char* result = gc_limit != 0 ? gc_alloc (GC_BYTES, (int) length + 1, NULL)
+                                : arena_calloc (length + 1, 1);
+   memcpy (result, bytes, length);
+   return result;
+}
+
+// The first byte after those skipped over is always taken, and the
+// byte that stops the scan is consumed.
 char* scan (int (*skipover) (int), int (*stopat) (int)) {
    int byte;
    do {
-      byte = getchar();
+      byte = in_byte();
       if (byte == EOF) return NULL;
-   } while (skipover (byte));
-   char buffer[0x1000];
-   char* end = buffer;
-   do {
-      *end++ = byte;
-      assert (end < &buffer[sizeof buffer]);
-      *end = '\0';
-      byte = getchar();
-   }while (byte != EOF && ! stopat (byte));
-   char* result = (char*) strdup ((char*) buffer);
-   assert (result != NULL);
+   }while (skipover (byte));
+   size_t start = in_next - 1;
+   size_t length = 0;
+   for (;;) {
+      while (in_next < in_end
+             && ! stopat ((unsigned char) in_buffer[in_next])) {
+         ++in_next;
+      }
+      if (in_next < in_end) break;
+      in_keep (length, in_buffer + start, in_next - start);
+      length += in_next - start;
+      start = 0;
+      if (! in_fill()) break;
+   }
+   char* result;
+   if (length == 0) {
+      result = in_copy (in_buffer + start, in_next - start);
+   }else {
+      in_keep (length, in_buffer + start, in_next - start);
+      result = in_copy (in_token, length + in_next - start);
+   }
+   if (in_next < in_end) ++in_next;
    return result;
 }
 
 int isfalse (int byte)   { return 0 & byte; } 
 int isnl (int byte)      { return byte == '\n'; }
-void __putb (char byte)  { printf ("%s", byte ? "true" : "false"); } 
-void __putc (char byte)  { printf ("%c", byte); } 
-void __puti (int val)    { printf ("%d", val); }
-void __puts (char* str)  { printf ("%s", str); }
-void __endl (void)       { printf ("\n"); fflush (NULL); }
-int __getc (void)        { return getchar(); } 
+
+void __putb (char byte) {
+   out_bytes (byte ? "true" : "false", byte ? 4 : 5);
+}
+
+void __putc (char byte) {
+   if (out_used == sizeof out_buffer) out_flush();
+   out_buffer[out_used++] = byte;
+}
+
+void __puti (int val) {
+   char digits[16];
+   char* start = &digits[sizeof digits];
+   unsigned magnitude = val < 0 ? 0u - (unsigned) val : (unsigned) val;
+   do {
+      *--start = '0' + magnitude % 10;
+      magnitude /= 10;
+   }while (magnitude != 0);
+   if (val < 0) *--start = '-';
+   out_bytes (start, &digits[sizeof digits] - start);
+}
+
+void __puts (char* str) {
+   if (str == NULL) str = "(null)";
+   out_bytes (str, strlen (str));
+}
+
+void __endl (void) {
+   __putc ('\n');
+   if (out_lines) out_flush();
+}
+
+int __getc (void)        { return in_byte(); }
+
 char* __getw (void)      { return scan (isspace, isspace); }
 char* __getln (void)     { return scan (isfalse, isnl); } 
 char** __getargv (void)  { return oc_argv; }
@@ -0,0 +1,26 @@
+// Runtime internals shared by oclib.c and the C that oc --build
+// generates.  Programs written in oc see only oclib.oh.
+
+#ifndef __OCLIB_H__
+#define __OCLIB_H__
+
+#include <stdint.h>
+
+void* arena_calloc (int nelem, int size);
+void arena_free (void* block, int nelem, int size);
+
+enum {GC_BYTES, GC_WORDS, GC_POINTERS, GC_STRUCT};
+struct gc_frame {
+   struct gc_frame* prev;
+   intptr_t count;
+   intptr_t* slots;
+};
+extern struct gc_frame* gc_frames;
+void gc_start (void);
+void* gc_alloc (int kind, int count, const unsigned char* map);
+void gc_global (intptr_t* slot);
+
+void prof_start (unsigned long long* counts, const char* const* keys,
+                 int count, const char* path);
+
+#endif
@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
+#include "buffered_writer.h"
+#include "oil_cfg.h"
+
+oil_cfg::oil_cfg(const oil_function &function_)
+        : function(function_) {
+    link();
+    number();
+    find_dominators();
+    find_loops();
+}
+
+bool oil_cfg::reachable(size_t block) const {
+    return idom[block] != NO_BLOCK;
+}
+
+bool oil_cfg::dominates(size_t dominator, size_t block) const {
+    if (!reachable(block)) return false;
+    while (block != dominator && block != 0) {
+        block = idom[block];
+    }
+    return block == dominator;
+}
+
+void oil_cfg::link() {
+    const vector<oil_block> &blocks = function.blocks;
+    size_t count = blocks.size();
+    succs.assign(count, {});
+    preds.assign(count, {});
+
+    unordered_map<string, size_t> labels;
+    for (size_t i = 0; i < count; i++) {
+        const oil_instr &first = blocks[i].code.front();
+        if (first.opcode == OIL_LABEL) {
+            labels[first.op] = i;
+        }
+    }
+
+    jump_to.assign(count, NO_BLOCK);
+    fall_to.assign(count, NO_BLOCK);
+    for (size_t i = 0; i < count; i++) {
+        const oil_instr &last = blocks[i].code.back();
+        bool falls = last.opcode != OIL_GOTO
+                     && last.opcode != OIL_RETURN;
+        if (last.opcode == OIL_GOTO || last.opcode == OIL_BRANCH) {
+            auto target = labels.find(last.op);
+            if (target != labels.end()) {
+                jump_to[i] = target->second;
+                succs[i].push_back(target->second);
+            }
+        }
+        if (falls && i + 1 < count) {
+            fall_to[i] = i + 1;
+            succs[i].push_back(i + 1);
+        }
+        for (size_t succ: succs[i]) {
+            preds[succ].push_back(i);
+        }
+    }
+}
+
+// Depth-first from the entry; order ends up in reverse postorder.
+void oil_cfg::number() {
+    size_t count = function.blocks.size();
+    order.clear();
+    if (count == 0) return;
+
+    vector<bool> seen(count, false);
+    vector<pair<size_t, size_t>> stack;
+    stack.push_back({0, 0});
+    seen[0] = true;
+    while (!stack.empty()) {
+        size_t block = stack.back().first;
+        size_t &next = stack.back().second;
+        if (next < succs[block].size()) {
+            size_t succ = succs[block][next++];
+            if (!seen[succ]) {
+                seen[succ] = true;
+                stack.push_back({succ, 0});
+            }
+        } else {
+            order.push_back(block);
+            stack.pop_back();
+        }
+    }
+    reverse(order.begin(), order.end());
+}
+
+// Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm".
+void oil_cfg::find_dominators() {
+    size_t count = function.blocks.size();
+    idom.assign(count, NO_BLOCK);
+    dom_children.assign(count, {});
+    if (count == 0) return;
+
+    vector<size_t> rank(count, NO_BLOCK);
+    for (size_t i = 0; i < order.size(); i++) {
+        rank[order[i]] = i;
+    }
+
+    idom[0] = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 1; i < order.size(); i++) {
+            size_t block = order[i];
+            size_t dom = NO_BLOCK;
+            for (size_t pred: preds[block]) {
+                if (idom[pred] == NO_BLOCK) continue;
+                if (dom == NO_BLOCK) {
+                    dom = pred;
+                    continue;
+                }
+                size_t other = pred;
+                while (dom != other) {
+                    while (rank[dom] > rank[other]) dom = idom[dom];
+                    while (rank[other] > rank[dom]) other = idom[other];
+                }
+            }
+            if (idom[block] != dom) {
+                idom[block] = dom;
+                changed = true;
+            }
+        }
+    }
+
+    for (size_t block: order) {
+        if (block != 0) {
+            dom_children[idom[block]].push_back(block);
+        }
+    }
+}
+
+void oil_cfg::find_loops() {
+    size_t count = function.blocks.size();
+    loops.clear();
+    loop_of.assign(count, NO_BLOCK);
+
+    // Headers in reverse postorder put outer loops first.
+    for (size_t header: order) {
+        oil_loop loop;
+        loop.header = header;
+        for (size_t pred: preds[header]) {
+            if (dominates(header, pred)) {
+                loop.latches.push_back(pred);
+            }
+        }
+        if (loop.latches.empty()) continue;
+
+        vector<bool> inside(count, false);
+        inside[header] = true;
+        vector<size_t> work = loop.latches;
+        while (!work.empty()) {
+            size_t block = work.back();
+            work.pop_back();
+            if (inside[block]) continue;
+            inside[block] = true;
+            for (size_t pred: preds[block]) {
+                if (reachable(pred)) work.push_back(pred);
+            }
+        }
+        for (size_t block: order) {
+            if (inside[block]) loop.blocks.push_back(block);
+        }
+        loops.push_back(loop);
+    }
+
+    // An outer loop is seen first, so the last loop to claim a block
+    // is the innermost one around it.
+    for (size_t i = 0; i < loops.size(); i++) {
+        size_t outer = loop_of[loops[i].header];
+        if (outer != NO_BLOCK) {
+            loops[i].parent = outer;
+            loops[i].depth = loops[outer].depth + 1;
+        }
+        for (size_t block: loops[i].blocks) {
+            loop_of[block] = i;
+        }
+    }
+}
+
+// Graphviz
+void put_dot_text(buffered_writer &out, const string &text) {
+    for (char c: text) {
+        if (c == '"' || c == '\\' || c == '{' || c == '}'
+            || c == '<' || c == '>' || c == '|') {
+            out.put('\\');
+        }
+        out.put(c);
+    }
+}
+
+void put_dot_node(buffered_writer &out, size_t graph, size_t block) {
+    out.put("f");
+    out.put_size(graph);
+    out.put("b");
+    out.put_size(block);
+}
+
+void dump_function(buffered_writer &out, const oil_function &function,
+                   size_t graph) {
+    oil_cfg cfg(function);
+
+    out.put("   subgraph cluster_");
+    out.put_size(graph);
+    out.put(" {\n      label=\"");
+    put_dot_text(out, function.name);
+    out.put("\";\n");
+
+    for (size_t i = 0; i < function.blocks.size(); i++) {
+        out.put("      ");
+        put_dot_node(out, graph, i);
+        out.put(" [label=\"{b");
+        out.put_size(i);
+        if (cfg.loop_of[i] != NO_BLOCK) {
+            out.put(" loop ");
+            out.put_size(cfg.loop_of[i]);
+            out.put(" depth ");
+            out.put_size(cfg.loops[cfg.loop_of[i]].depth);
+        }
+        out.put('|');
+        for (const oil_instr &instr: function.blocks[i].code) {
+            string text = oil_text(instr);
+            size_t start = text.find_first_not_of(' ');
+            put_dot_text(out, text.substr(start == string::npos
+                                          ? text.size() : start));
+            out.put("\\l");
+        }
+        out.put("}\"");
+        if (!cfg.reachable(i)) out.put(" style=dashed");
+        out.put("];\n");
+    }
+
+    for (size_t i = 0; i < function.blocks.size(); i++) {
+        for (size_t succ: cfg.succs[i]) {
+            out.put("      ");
+            put_dot_node(out, graph, i);
+            out.put(" -> ");
+            put_dot_node(out, graph, succ);
+            if (cfg.dominates(succ, i)) out.put(" [color=red]");
+            out.put(";\n");
+        }
+        for (size_t child: cfg.dom_children[i]) {
+            out.put("      ");
+            put_dot_node(out, graph, i);
+            out.put(" -> ");
+            put_dot_node(out, graph, child);
+            out.put(" [style=dotted color=blue constraint=false];\n");
+        }
+    }
+    out.put("   }\n");
+}
+
+// One cluster per function.  Solid edges are control flow, red ones
+// are loop back edges and dotted blue ones form the dominator tree.
+void dump_cfg(FILE *file, const oil_module &module) {
+    buffered_writer out(file);
+    out.put("digraph oil {\n");
+    out.put("   node [shape=record fontname=monospace];\n");
+    size_t graph = 0;
+    for (const oil_function &function: module.functions) {
+        dump_function(out, function, graph++);
+    }
+    dump_function(out, module.main, graph);
+    out.put("}\n");
+}
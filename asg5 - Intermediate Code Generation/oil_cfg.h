@@ -0,0 +1,55 @@
+#ifndef __OIL_CFG_H__
+#define __OIL_CFG_H__
+
+#include <cstdio>
+#include <vector>
+
+using namespace std;
+
+#include "oil_ir.h"
+
+// Control flow graph over the basic blocks of one oil_function.
+// Block 0 is the entry.  Edges come from the last instruction of a
+// block: a goto, a branch (target and fall through), a return (none)
+// or anything else (fall through).  Blocks that cannot be reached
+// from the entry have no dominator and belong to no loop.
+
+constexpr size_t NO_BLOCK = static_cast<size_t>(-1);
+
+// Natural loop: every block that reaches one of the latches without
+// passing through the header.  Loops sharing a header are merged.
+struct oil_loop {
+    size_t header;
+    vector<size_t> latches;
+    vector<size_t> blocks;
+    size_t parent = NO_BLOCK;   // enclosing loop, index into loops
+    size_t depth = 1;
+};
+
+struct oil_cfg {
+    explicit oil_cfg(const oil_function &function);
+
+    bool reachable(size_t block) const;
+    bool dominates(size_t dominator, size_t block) const;
+
+    const oil_function &function;
+    vector<vector<size_t>> succs;
+    vector<vector<size_t>> preds;
+    vector<size_t> jump_to;         // target of a final goto or branch
+    vector<size_t> fall_to;         // next block if control falls in
+    vector<size_t> order;           // reachable blocks, reverse postorder
+    vector<size_t> idom;            // entry is its own idom
+    vector<vector<size_t>> dom_children;
+    vector<oil_loop> loops;         // outer loops before inner ones
+    vector<size_t> loop_of;         // innermost loop of each block
+
+private:
+    void link();
+    void number();
+    void find_dominators();
+    void find_loops();
+};
+
+void dump_cfg(FILE *out, const oil_module &module);
+
+#endif
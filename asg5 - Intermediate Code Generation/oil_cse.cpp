@@ -0,0 +1,177 @@
+#include <unordered_map>
+
+#include "oil_cfg.h"
+#include "oil_cse.h"
+
+// Value numbers are strings: "c:" constants, "r:" registers assigned
+// once, "v:" one version of anything else, and "e:" the result of an
+// operation on other value numbers.
+struct cse_state {
+    oil_function &function;
+    const oil_cfg &cfg;
+    bool global;
+    unordered_map<string, size_t> defs;
+    unordered_map<string, oil_operand> available;
+    size_t fresh = 0;
+    size_t replaced = 0;
+
+    // Per block.
+    unordered_map<string, string> current;
+    unordered_map<string, oil_operand> local;
+
+    cse_state(oil_function &function_, const oil_cfg &cfg_, bool global_)
+            : function(function_), cfg(cfg_), global(global_) {
+    }
+
+    bool single_def(const oil_operand &operand) {
+        return operand.kind == OIL_REG && defs[oil_key(operand)] == 1;
+    }
+
+    string value_of(const oil_operand &operand) {
+        if (operand.kind == OIL_CONST) return "c:" + operand.name;
+        string key = oil_key(operand);
+        auto found = current.find(key);
+        if (found != current.end()) return found->second;
+        if (single_def(operand)) return "r:" + key;
+        string value = "v:" + key + "#" + to_string(fresh++);
+        current[key] = value;
+        return value;
+    }
+
+    // dest now holds something not seen before.
+    void redefine(const oil_operand &dest) {
+        current.erase(oil_key(dest));
+        value_of(dest);
+    }
+
+    void forget_variables() {
+        for (auto it = current.begin(); it != current.end();) {
+            if (it->first[0] != '%') {
+                it = current.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void visit(size_t block);
+    void number(oil_instr &instr, vector<string> &added);
+};
+
+bool is_commutative(const string &op) {
+    return op == "+" || op == "*" || op == "==" || op == "!=";
+}
+
+// Comparisons yield 0 or 1, which a char holds unchanged; other
+// results may not fit one.  An assignment without a declared type may
+// be to a char.
+bool keeps_value(const oil_instr &instr) {
+    if (instr.type.empty()) return false;
+    if (instr.type != "char") return true;
+    const string &op = instr.op;
+    return op == "==" || op == "!=" || op == "<" || op == "<="
+           || op == ">" || op == ">=" || op == "!";
+}
+
+void cse_state::number(oil_instr &instr, vector<string> &added) {
+    string dest = oil_key(instr.dest);
+    switch (instr.opcode) {
+        case OIL_UNARY:
+        case OIL_BINARY: {
+            string left = value_of(instr.srcs[0]);
+            string value;
+            if (instr.opcode == OIL_UNARY) {
+                value = "e:" + instr.op + "(" + left + ")";
+            } else {
+                string right = value_of(instr.srcs[1]);
+                if (is_commutative(instr.op) && right < left) {
+                    swap(left, right);
+                }
+                value = "e:" + instr.op + "(" + left + "," + right + ")";
+            }
+
+            auto held = local.find(value);
+            bool found = held != local.end()
+                         && value_of(held->second) == value;
+            if (!found && global) {
+                held = available.find(value);
+                found = held != available.end();
+            }
+            bool keeps = keeps_value(instr);
+            if (keeps) {
+                current[dest] = value;
+            } else {
+                redefine(instr.dest);
+            }
+            if (found && !(held->second == instr.dest)) {
+                instr.opcode = OIL_MOVE;
+                instr.op.clear();
+                instr.srcs = {held->second};
+                instr.tight = false;
+                instr.trailing = false;
+                replaced++;
+                return;
+            }
+
+            if (instr.dest.kind != OIL_REG || !keeps) return;
+            local[value] = instr.dest;
+            if (global && single_def(instr.dest)
+                && value.find("v:") == string::npos
+                && available.count(value) == 0) {
+                available[value] = instr.dest;
+                added.push_back(value);
+            }
+            return;
+        }
+        case OIL_MOVE:
+            if (keeps_value(instr)) {
+                current[dest] = value_of(instr.srcs[0]);
+            } else {
+                redefine(instr.dest);
+            }
+            return;
+        case OIL_CALL:
+            forget_variables();
+            if (instr.dest.kind != OIL_NONE) redefine(instr.dest);
+            return;
+        case OIL_ALLOC:
+            redefine(instr.dest);
+            return;
+        case OIL_UNKNOWN:
+            forget_variables();
+            return;
+        default:
+            return;
+    }
+}
+
+void cse_state::visit(size_t block) {
+    current.clear();
+    local.clear();
+    vector<string> added;
+    for (oil_instr &instr: function.blocks[block].code) {
+        number(instr, added);
+    }
+    for (size_t child: cfg.dom_children[block]) {
+        visit(child);
+    }
+    for (const string &value: added) {
+        available.erase(value);
+    }
+}
+
+size_t eliminate_common_subexpressions(oil_function &function,
+                                       bool global) {
+    if (function.blocks.empty()) return 0;
+    oil_cfg cfg(function);
+    cse_state state(function, cfg, global);
+    for (const oil_block &block: function.blocks) {
+        for (const oil_instr &instr: block.code) {
+            if (instr.dest.kind == OIL_REG) {
+                state.defs[oil_key(instr.dest)]++;
+            }
+        }
+    }
+    state.visit(0);
+    return state.replaced;
+}
@@ -0,0 +1,18 @@
+#ifndef __OIL_CSE_H__
+#define __OIL_CSE_H__
+
+#include "oil_ir.h"
+
+// Value numbering.  Within each block, arithmetic whose value is
+// already held by an earlier register becomes a move from that
+// register.  Calls and unlowered statements may write any variable,
+// so they end what is known about variables.
+//
+// With global set, values held in registers assigned only once in
+// the function are also shared with every block the defining block
+// dominates, provided their operands are constants or such registers
+// as well.  Returns the number of instructions replaced.
+size_t eliminate_common_subexpressions(oil_function &function,
+                                       bool global);
+
+#endif
@@ -0,0 +1,189 @@
+#include <unordered_map>
+#include <unordered_set>
+
+#include "oil_dce.h"
+#include "oil_live.h"
+
+size_t remove_unreachable(oil_function &function) {
+    oil_cfg cfg(function);
+    size_t removed = 0;
+    vector<oil_block> blocks;
+    for (size_t i = 0; i < function.blocks.size(); i++) {
+        if (cfg.reachable(i)) {
+            blocks.push_back(move(function.blocks[i]));
+        } else {
+            removed += function.blocks[i].code.size();
+        }
+    }
+    function.blocks = move(blocks);
+    return removed;
+}
+
+bool is_pure(const oil_instr &instr) {
+    return instr.opcode == OIL_MOVE || instr.opcode == OIL_UNARY
+           || instr.opcode == OIL_BINARY;
+}
+
+// How many instructions name each variable or register.
+unordered_map<string, size_t> count_mentions(
+        const oil_function &function) {
+    unordered_map<string, size_t> mentions;
+    for (const oil_block &block: function.blocks) {
+        for (const oil_instr &instr: block.code) {
+            if (instr.dest.kind != OIL_NONE) {
+                mentions[oil_key(instr.dest)]++;
+            }
+            for (const oil_operand &src: instr.srcs) {
+                if (src.kind != OIL_CONST) mentions[oil_key(src)]++;
+            }
+        }
+    }
+    return mentions;
+}
+
+size_t sweep_dead_stores(oil_function &function) {
+    oil_cfg cfg(function);
+    oil_liveness liveness(function, cfg);
+    unordered_map<string, size_t> mentions = count_mentions(function);
+    size_t removed = 0;
+
+    for (size_t block: cfg.order) {
+        vector<oil_instr> &code = function.blocks[block].code;
+        oil_live_set live = liveness.live_out[block];
+        vector<bool> dead(code.size(), false);
+        for (size_t i = code.size(); i-- > 0;) {
+            const oil_instr &instr = code[i];
+            string key = oil_key(instr.dest);
+            if (is_pure(instr) && liveness.is_local(instr.dest)
+                && live.count(key) == 0
+                && (instr.type.empty() || instr.dest.kind == OIL_REG
+                    || mentions[key] == 1)) {
+                dead[i] = true;
+                removed++;
+                continue;
+            }
+            liveness.step(instr, live);
+        }
+
+        vector<oil_instr> kept;
+        for (size_t i = 0; i < code.size(); i++) {
+            if (!dead[i]) kept.push_back(move(code[i]));
+        }
+        code = move(kept);
+    }
+
+    vector<oil_block> blocks;
+    for (oil_block &block: function.blocks) {
+        if (!block.code.empty()) blocks.push_back(move(block));
+    }
+    function.blocks = move(blocks);
+    return removed;
+}
+
+// Locals whose value can reach a call, a branch, a return or a
+// global, and those a call or an allocation writes, which stay.  A
+// local read only to compute itself again, like a counter a loop
+// keeps stepping after its last use, is not among them.
+unordered_set<string> needed_locals(const oil_function &function,
+                                    const oil_liveness &liveness) {
+    unordered_set<string> needed;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const oil_block &block: function.blocks) {
+            for (const oil_instr &instr: block.code) {
+                if (is_pure(instr) && liveness.is_local(instr.dest)
+                    && needed.count(oil_key(instr.dest)) == 0) {
+                    continue;
+                }
+                if (!is_pure(instr) && liveness.is_local(instr.dest)
+                    && needed.insert(oil_key(instr.dest)).second) {
+                    changed = true;
+                }
+                for (const oil_operand &src: instr.srcs) {
+                    if (liveness.is_local(src)
+                        && needed.insert(oil_key(src)).second) {
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+    return needed;
+}
+
+// Drops every store to a local that is never needed.  Each read of
+// such a local is itself one of the stores dropped, so nothing is
+// left that names it.
+size_t sweep_faint_stores(oil_function &function) {
+    if (!oil_fully_lowered(function)) return 0;
+    oil_cfg cfg(function);
+    oil_liveness liveness(function, cfg);
+    unordered_set<string> needed = needed_locals(function, liveness);
+    size_t removed = 0;
+    for (oil_block &block: function.blocks) {
+        vector<oil_instr> kept;
+        for (oil_instr &instr: block.code) {
+            if (is_pure(instr) && liveness.is_local(instr.dest)
+                && needed.count(oil_key(instr.dest)) == 0) {
+                removed++;
+                continue;
+            }
+            kept.push_back(move(instr));
+        }
+        block.code = move(kept);
+    }
+
+    vector<oil_block> blocks;
+    for (oil_block &block: function.blocks) {
+        if (!block.code.empty()) blocks.push_back(move(block));
+    }
+    function.blocks = move(blocks);
+    return removed;
+}
+
+size_t remove_dead_stores(oil_function &function) {
+    size_t removed = sweep_faint_stores(function);
+    for (;;) {
+        size_t swept = sweep_dead_stores(function);
+        if (swept == 0) break;
+        removed += swept;
+    }
+    return removed;
+}
+
+size_t remove_dead_labels(oil_function &function) {
+    vector<oil_instr> code;
+    for (oil_block &block: function.blocks) {
+        for (oil_instr &instr: block.code) {
+            code.push_back(move(instr));
+        }
+    }
+
+    size_t removed = 0;
+    for (size_t i = 0; i + 1 < code.size(); i++) {
+        if ((code[i].opcode == OIL_GOTO || code[i].opcode == OIL_BRANCH)
+            && code[i + 1].opcode == OIL_LABEL
+            && code[i].op == code[i + 1].op) {
+            code.erase(code.begin() + i);
+            removed++;
+        }
+    }
+
+    unordered_set<string> targets;
+    for (const oil_instr &instr: code) {
+        if (instr.opcode == OIL_GOTO || instr.opcode == OIL_BRANCH) {
+            targets.insert(instr.op);
+        }
+    }
+
+    function.blocks.clear();
+    for (oil_instr &instr: code) {
+        if (instr.opcode == OIL_LABEL && targets.count(instr.op) == 0) {
+            removed++;
+            continue;
+        }
+        function.append(instr);
+    }
+    return removed;
+}
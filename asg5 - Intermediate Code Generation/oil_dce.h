@@ -0,0 +1,21 @@
+#ifndef __OIL_DCE_H__
+#define __OIL_DCE_H__
+
+#include "oil_ir.h"
+
+// Each pass returns the number of instructions it removed.
+
+// Drops blocks that cannot be reached from the entry.
+size_t remove_unreachable(oil_function &function);
+
+// Drops moves and arithmetic whose result is never read, and every
+// store to a local that is only ever read to compute itself again.
+// A variable declaration otherwise goes only once nothing else names
+// the variable, so the C output still declares everything it uses.
+size_t remove_dead_stores(oil_function &function);
+
+// Drops jumps to the very next instruction and labels nothing jumps
+// to, then merges the blocks that are left.
+size_t remove_dead_labels(oil_function &function);
+
+#endif
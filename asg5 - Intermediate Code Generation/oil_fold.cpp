@@ -0,0 +1,311 @@
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <deque>
+#include <set>
+#include <unordered_map>
+
+#include "oil_cfg.h"
+#include "oil_fold.h"
+
+struct fold_value {
+    long value;
+    string text;
+};
+
+using fold_env = unordered_map<string, fold_value>;
+
+bool parse_char(const string &text, long &value) {
+    if (text.size() == 3 && text[2] == '\'') {
+        value = static_cast<unsigned char>(text[1]);
+        return true;
+    }
+    if (text.size() != 4 || text[1] != '\\' || text[3] != '\'') {
+        return false;
+    }
+    switch (text[2]) {
+        case '0':  value = '\0'; return true;
+        case 'n':  value = '\n'; return true;
+        case 't':  value = '\t'; return true;
+        case '\\': value = '\\'; return true;
+        case '\'': value = '\''; return true;
+        case '"':  value = '"';  return true;
+        default:   return false;
+    }
+}
+
+// Decimal ints and char literals.  A leading zero would make C read
+// the digits as octal, so those are left alone.
+bool parse_constant(const string &text, long &value) {
+    if (text.empty()) return false;
+    if (text[0] == '\'') return parse_char(text, value);
+
+    size_t digits = text[0] == '-' ? 1 : 0;
+    if (digits == text.size()) return false;
+    if (text[digits] == '0' && text.size() > digits + 1) return false;
+    for (size_t i = digits; i < text.size(); i++) {
+        if (text[i] < '0' || text[i] > '9') return false;
+    }
+    errno = 0;
+    value = strtol(text.c_str(), nullptr, 10);
+    return errno == 0 && value >= INT_MIN && value <= INT_MAX;
+}
+
+bool lookup(const fold_env &env, const oil_operand &operand,
+            long &value) {
+    if (operand.kind == OIL_CONST) {
+        return parse_constant(operand.name, value);
+    }
+    if (operand.kind == OIL_VAR || operand.kind == OIL_REG) {
+        auto found = env.find(oil_key(operand));
+        if (found != env.end()) {
+            value = found->second.value;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool fits_int(long value) {
+    return value >= INT_MIN && value <= INT_MAX;
+}
+
+bool fold_unary(const string &op, long operand, long &result) {
+    if (op == "-") result = -operand;
+    else if (op == "+") result = operand;
+    else if (op == "!") result = !operand;
+    else return false;
+    return fits_int(result);
+}
+
+bool fold_binary(const string &op, long left, long right,
+                 long &result) {
+    if (op == "+") result = left + right;
+    else if (op == "-") result = left - right;
+    else if (op == "*") result = left * right;
+    else if (op == "/" || op == "%") {
+        if (right == 0 || (left == INT_MIN && right == -1)) {
+            return false;
+        }
+        result = op == "/" ? left / right : left % right;
+    }
+    else if (op == "==") result = left == right;
+    else if (op == "!=") result = left != right;
+    else if (op == "<") result = left < right;
+    else if (op == "<=") result = left <= right;
+    else if (op == ">") result = left > right;
+    else if (op == ">=") result = left >= right;
+    else return false;
+    return fits_int(result);
+}
+
+bool evaluate(const oil_instr &instr, const fold_env &env,
+              long &value) {
+    long left, right;
+    switch (instr.opcode) {
+        case OIL_MOVE:
+            return lookup(env, instr.srcs[0], value);
+        case OIL_UNARY:
+            return lookup(env, instr.srcs[0], left)
+                   && fold_unary(instr.op, left, value);
+        case OIL_BINARY:
+            return lookup(env, instr.srcs[0], left)
+                   && lookup(env, instr.srcs[1], right)
+                   && fold_binary(instr.op, left, right, value);
+        default:
+            return false;
+    }
+}
+
+void forget_variables(fold_env &env) {
+    for (auto it = env.begin(); it != env.end();) {
+        if (it->first[0] != '%') {
+            it = env.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void transfer(const oil_instr &instr, fold_env &env) {
+    long value;
+    switch (instr.opcode) {
+        case OIL_MOVE:
+        case OIL_UNARY:
+        case OIL_BINARY: {
+            string key = oil_key(instr.dest);
+            if (evaluate(instr, env, value)
+                && (instr.type != "char"
+                    || (value >= CHAR_MIN && value <= CHAR_MAX))) {
+                string text = to_string(value);
+                if (instr.opcode == OIL_MOVE
+                    && instr.srcs[0].kind == OIL_CONST) {
+                    text = instr.srcs[0].name;
+                }
+                env[key] = {value, text};
+            } else {
+                env.erase(key);
+            }
+            break;
+        }
+        case OIL_CALL:
+            env.erase(oil_key(instr.dest));
+            forget_variables(env);
+            break;
+        case OIL_ALLOC:
+            env.erase(oil_key(instr.dest));
+            break;
+        case OIL_UNKNOWN:
+            forget_variables(env);
+            break;
+        default:
+            break;
+    }
+}
+
+// Keeps only the facts both sides agree on.
+void meet(fold_env &into, const fold_env &other) {
+    for (auto it = into.begin(); it != into.end();) {
+        auto found = other.find(it->first);
+        if (found == other.end()
+            || found->second.value != it->second.value) {
+            it = into.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool same(const fold_env &left, const fold_env &right) {
+    if (left.size() != right.size()) return false;
+    for (const auto &entry: left) {
+        auto found = right.find(entry.first);
+        if (found == right.end()
+            || found->second.value != entry.second.value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct fold_state {
+    const oil_cfg &cfg;
+    vector<fold_env> out;
+    vector<bool> visited;
+    set<pair<size_t, size_t>> edges;
+
+    explicit fold_state(const oil_cfg &cfg_)
+            : cfg(cfg_), out(cfg_.succs.size()),
+              visited(cfg_.succs.size(), false) {
+    }
+
+    // Nothing is known on entry to the function.
+    fold_env entry(size_t block) {
+        fold_env env;
+        if (block == 0) return env;
+        bool first = true;
+        for (size_t pred: cfg.preds[block]) {
+            if (edges.count({pred, block}) == 0) continue;
+            if (first) {
+                env = out[pred];
+                first = false;
+            } else {
+                meet(env, out[pred]);
+            }
+        }
+        return env;
+    }
+};
+
+void propagate(fold_state &state, const oil_function &function) {
+    const oil_cfg &cfg = state.cfg;
+    deque<size_t> work {0};
+    while (!work.empty()) {
+        size_t block = work.front();
+        work.pop_front();
+
+        fold_env env = state.entry(block);
+        for (const oil_instr &instr: function.blocks[block].code) {
+            transfer(instr, env);
+        }
+        bool changed = !state.visited[block]
+                       || !same(env, state.out[block]);
+        state.visited[block] = true;
+        state.out[block] = env;
+
+        vector<size_t> next;
+        const oil_instr &last = function.blocks[block].code.back();
+        long cond;
+        if (last.opcode == OIL_BRANCH
+            && lookup(env, last.srcs[0], cond)) {
+            size_t taken = cond == 0 ? cfg.jump_to[block]
+                                     : cfg.fall_to[block];
+            if (taken != NO_BLOCK) next.push_back(taken);
+        } else {
+            next = cfg.succs[block];
+        }
+        for (size_t succ: next) {
+            bool fresh = state.edges.insert({block, succ}).second;
+            if (fresh || changed) work.push_back(succ);
+        }
+    }
+}
+
+size_t rewrite(fold_state &state, oil_function &function) {
+    size_t changes = 0;
+    for (size_t block = 0; block < function.blocks.size(); block++) {
+        if (!state.visited[block]) continue;
+        fold_env env = state.entry(block);
+        vector<oil_instr> code;
+        for (oil_instr instr: function.blocks[block].code) {
+            bool changed = false;
+            for (oil_operand &src: instr.srcs) {
+                if (src.kind == OIL_CONST) continue;
+                auto found = env.find(oil_key(src));
+                if (found != env.end()) {
+                    src = oil_const(found->second.text);
+                    changed = true;
+                }
+            }
+
+            long value;
+            if ((instr.opcode == OIL_UNARY || instr.opcode == OIL_BINARY)
+                && evaluate(instr, env, value)) {
+                instr.opcode = OIL_MOVE;
+                instr.op.clear();
+                instr.srcs = {oil_const(to_string(value))};
+                instr.tight = false;
+                instr.trailing = false;
+                changed = true;
+            } else if (instr.opcode == OIL_BRANCH
+                       && lookup(env, instr.srcs[0], value)) {
+                changes++;
+                if (value != 0) continue;
+                instr.opcode = OIL_GOTO;
+                instr.srcs.clear();
+                instr.trailing = false;
+                changed = false;
+            }
+
+            transfer(instr, env);
+            if (changed) changes++;
+            code.push_back(instr);
+        }
+        function.blocks[block].code = code;
+    }
+
+    vector<oil_block> blocks;
+    for (oil_block &block: function.blocks) {
+        if (!block.code.empty()) blocks.push_back(move(block));
+    }
+    function.blocks = move(blocks);
+    return changes;
+}
+
+size_t fold_constants(oil_function &function) {
+    if (function.blocks.empty()) return 0;
+    oil_cfg cfg(function);
+    fold_state state(cfg);
+    propagate(state, function);
+    return rewrite(state, function);
+}
@@ -0,0 +1,21 @@
+#ifndef __OIL_FOLD_H__
+#define __OIL_FOLD_H__
+
+#include "oil_ir.h"
+
+// Conditional constant propagation.  Walks the control flow graph
+// from the entry, following only the edges a branch can take given
+// the constants known so far, and tracks which variables and
+// registers hold a known int or char value at each block.  Then:
+//   - operands known to be constant are replaced by the constant,
+//   - arithmetic and comparisons on constants become moves,
+//   - branches on a constant become a goto or disappear.
+// Calls and unlowered statements may write any variable, so they
+// forget everything known about variables; registers survive them.
+// Returns the number of instructions changed.
+size_t fold_constants(oil_function &function);
+
+// Value of a decimal int or char literal that fits in an int.
+bool parse_constant(const string &text, long &value);
+
+#endif
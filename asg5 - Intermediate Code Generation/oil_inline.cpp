@@ -0,0 +1,276 @@
+#include <unordered_set>
+
+#include "oil_inline.h"
+
+// Largest body, not counting labels, worth copying into a caller, or
+// into a caller the profile says calls it often.
+constexpr size_t INLINE_LIMIT = 12;
+constexpr size_t HOT_INLINE_LIMIT = 48;
+
+constexpr size_t NO_FUNCTION = static_cast<size_t>(-1);
+
+oil_call_graph::oil_call_graph(oil_module &module) {
+    for (oil_function &function: module.functions) {
+        index[function.name] = functions.size();
+        functions.push_back(&function);
+    }
+    index[module.main.name] = functions.size();
+    functions.push_back(&module.main);
+
+    size_t count = functions.size();
+    callees.assign(count, {});
+    recursive.assign(count, false);
+    for (size_t caller = 0; caller < count; caller++) {
+        unordered_set<size_t> seen;
+        for (const oil_block &block: functions[caller]->blocks) {
+            for (const oil_instr &instr: block.code) {
+                if (instr.opcode != OIL_CALL) continue;
+                size_t callee = find(instr.op);
+                if (callee == NO_FUNCTION) continue;
+                if (callee == caller) recursive[caller] = true;
+                if (seen.insert(callee).second) {
+                    callees[caller].push_back(callee);
+                }
+            }
+        }
+    }
+
+    rank.assign(count, NO_FUNCTION);
+    low.assign(count, 0);
+    on_stack.assign(count, false);
+    for (size_t function = 0; function < count; function++) {
+        if (rank[function] == NO_FUNCTION) connect(function);
+    }
+}
+
+size_t oil_call_graph::find(const string &name) const {
+    auto found = index.find(name);
+    return found == index.end() ? NO_FUNCTION : found->second;
+}
+
+// Tarjan's strongly connected components, which come out with every
+// component after the ones it calls into.
+void oil_call_graph::connect(size_t function) {
+    rank[function] = low[function] = bottom_up.size() + stack.size();
+    stack.push_back(function);
+    on_stack[function] = true;
+    for (size_t callee: callees[function]) {
+        if (rank[callee] == NO_FUNCTION) {
+            connect(callee);
+            low[function] = min(low[function], low[callee]);
+        } else if (on_stack[callee]) {
+            low[function] = min(low[function], rank[callee]);
+        }
+    }
+    if (low[function] != rank[function]) return;
+
+    size_t first = stack.size();
+    while (stack[first - 1] != function) first--;
+    first--;
+    bool cycle = stack.size() - first > 1;
+    for (size_t i = first; i < stack.size(); i++) {
+        on_stack[stack[i]] = false;
+        if (cycle) recursive[stack[i]] = true;
+        bottom_up.push_back(stack[i]);
+    }
+    stack.resize(first);
+}
+
+size_t body_size(const oil_function &function) {
+    size_t size = 0;
+    for (const oil_block &block: function.blocks) {
+        for (const oil_instr &instr: block.code) {
+            if (instr.opcode != OIL_LABEL) size++;
+        }
+    }
+    return size;
+}
+
+// Why a call should stay a call, or empty to inline it.
+string keep_reason(const oil_call_graph &graph, size_t callee,
+                   const oil_instr &call, size_t calls,
+                   const oil_profile *profile) {
+    const oil_function &function = *graph.functions[callee];
+    if (graph.recursive[callee]) return "recursive";
+    if (!oil_fully_lowered(function)) return "not fully lowered";
+    if (function.params.size() != call.srcs.size()) {
+        return "argument count differs";
+    }
+    if (profile != nullptr && calls == 0) return "never called";
+    bool hot = profile != nullptr
+               && calls * HOT_FRACTION >= profile->hottest_call;
+    size_t size = body_size(function);
+    if (size > (hot ? HOT_INLINE_LIMIT : INLINE_LIMIT)) {
+        return to_string(size) + " instructions";
+    }
+    return "";
+}
+
+struct inline_site {
+    const oil_function &callee;
+    const oil_instr &call;
+    string suffix;
+    size_t &fresh;
+    unordered_set<string> locals;
+    unordered_map<string, size_t> registers;
+
+    inline_site(const oil_function &callee_, const oil_instr &call_,
+                size_t site, size_t &fresh_)
+            : callee(callee_), call(call_),
+              suffix("_" + to_string(site)), fresh(fresh_) {
+        for (const oil_decl &param: callee.params) {
+            locals.insert(param.name);
+        }
+        for (const oil_block &block: callee.blocks) {
+            for (const oil_instr &instr: block.code) {
+                if (instr.dest.kind == OIL_VAR && !instr.type.empty()) {
+                    locals.insert(instr.dest.name);
+                }
+            }
+        }
+    }
+
+    void rename(oil_operand &operand) {
+        if (operand.kind == OIL_VAR && locals.count(operand.name) != 0) {
+            operand.name += suffix;
+        } else if (operand.kind == OIL_REG) {
+            string key = oil_key(operand);
+            auto found = registers.find(key);
+            if (found == registers.end()) {
+                found = registers.insert({key, ++fresh}).first;
+            }
+            operand.number = found->second;
+        }
+    }
+
+    void expand(vector<oil_instr> &code, vector<oil_decl> &decls);
+};
+
+void inline_site::expand(vector<oil_instr> &code,
+                         vector<oil_decl> &decls) {
+    // Registers the callee declares up front, such as the results of
+    // calls inlined into it, are declared with the caller's.
+    for (const oil_decl &local: callee.locals) {
+        size_t digits = local.name.find_first_of("0123456789");
+        oil_operand reg = oil_reg(local.name.substr(0, digits),
+                                  stoul(local.name.substr(digits)));
+        rename(reg);
+        decls.push_back({local.type, oil_key(reg).substr(1)});
+    }
+
+    for (size_t i = 0; i < callee.params.size(); i++) {
+        oil_instr param(OIL_MOVE, call.indent);
+        param.type = callee.params[i].type;
+        param.dest = oil_var(callee.params[i].name + suffix);
+        param.srcs.push_back(call.srcs[i]);
+        code.push_back(param);
+    }
+
+    // A register result is declared with the caller's registers; a
+    // variable is declared by the first move into it.
+    string done = callee.name + "_return" + suffix;
+    bool declared = call.dest.kind != OIL_VAR || call.type.empty();
+    for (const oil_block &block: callee.blocks) {
+        for (oil_instr instr: block.code) {
+            for (oil_operand &src: instr.srcs) rename(src);
+            rename(instr.dest);
+            switch (instr.opcode) {
+                case OIL_LABEL:
+                case OIL_GOTO:
+                case OIL_BRANCH:
+                    instr.op += suffix;
+                    break;
+                case OIL_RETURN: {
+                    if (call.dest.kind != OIL_NONE && !instr.srcs.empty()) {
+                        oil_instr result(OIL_MOVE, instr.indent);
+                        if (!declared) result.type = call.type;
+                        declared = true;
+                        result.dest = call.dest;
+                        result.srcs.push_back(instr.srcs[0]);
+                        code.push_back(result);
+                    }
+                    instr = oil_instr(OIL_GOTO, instr.indent);
+                    instr.op = done;
+                    break;
+                }
+                default:
+                    break;
+            }
+            code.push_back(instr);
+        }
+    }
+
+    oil_instr exit(OIL_LABEL);
+    exit.op = done;
+    code.push_back(exit);
+}
+
+size_t inline_into(oil_function &caller, const oil_call_graph &graph,
+                   size_t &sites, FILE *report,
+                   const oil_profile *profile) {
+    if (!oil_fully_lowered(caller)) return 0;
+    size_t fresh = oil_highest_register(caller);
+    size_t inlined = 0;
+    vector<oil_instr> code;
+    for (const oil_block &block: caller.blocks) {
+        for (const oil_instr &instr: block.code) {
+            size_t callee = instr.opcode == OIL_CALL
+                            ? graph.find(instr.op) : NO_FUNCTION;
+            if (callee == NO_FUNCTION) {
+                code.push_back(instr);
+                continue;
+            }
+
+            size_t calls = profile == nullptr ? 0
+                           : profile->call_count(caller.name, instr.op);
+            string reason = keep_reason(graph, callee, instr, calls,
+                                        profile);
+            const oil_function &function = *graph.functions[callee];
+            if (!reason.empty()) {
+                if (report != nullptr) {
+                    fprintf(report, "%s: kept call to %s (%s)\n",
+                            caller.name.c_str(), instr.op.c_str(),
+                            reason.c_str());
+                }
+                code.push_back(instr);
+                continue;
+            }
+            if (report != nullptr && profile != nullptr) {
+                fprintf(report, "%s: inlined %s (%zu instructions, "
+                                "%zu calls)\n",
+                        caller.name.c_str(), instr.op.c_str(),
+                        body_size(function), calls);
+            } else if (report != nullptr) {
+                fprintf(report, "%s: inlined %s (%zu instructions)\n",
+                        caller.name.c_str(), instr.op.c_str(),
+                        body_size(function));
+            }
+            if (instr.dest.kind == OIL_REG && !instr.type.empty()) {
+                caller.locals.push_back(
+                        {instr.type, oil_key(instr.dest).substr(1)});
+            }
+            inline_site site(function, instr, ++sites, fresh);
+            site.expand(code, caller.locals);
+            inlined++;
+        }
+    }
+    if (inlined == 0) return 0;
+
+    caller.blocks.clear();
+    for (const oil_instr &instr: code) {
+        caller.append(instr);
+    }
+    return inlined;
+}
+
+size_t inline_calls(oil_module *module, FILE *report,
+                    const oil_profile *profile) {
+    oil_call_graph graph(*module);
+    size_t sites = 0;
+    size_t inlined = 0;
+    for (size_t function: graph.bottom_up) {
+        inlined += inline_into(*graph.functions[function], graph, sites,
+                               report, profile);
+    }
+    return inlined;
+}
@@ -0,0 +1,51 @@
+#ifndef __OIL_INLINE_H__
+#define __OIL_INLINE_H__
+
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+#include "oil_ir.h"
+#include "oil_profile.h"
+
+// Which functions of the module call which, from the calls lowered
+// from TOK_CALL nodes.  Main is the last function.  Calls to anything
+// the module does not define, such as the oclib builtins, are left
+// out.
+struct oil_call_graph {
+    explicit oil_call_graph(oil_module &module);
+
+    size_t find(const string &name) const;
+
+    vector<oil_function *> functions;
+    unordered_map<string, size_t> index;
+    vector<vector<size_t>> callees;
+    vector<bool> recursive;         // calls itself, perhaps indirectly
+    vector<size_t> bottom_up;       // callees before their callers
+
+private:
+    vector<size_t> rank;
+    vector<size_t> low;
+    vector<size_t> stack;
+    vector<bool> on_stack;
+
+    void connect(size_t function);
+};
+
+// Replaces calls to small functions that are not recursive with a
+// copy of their body.  The copy gets its own names for the callee's
+// variables, registers and labels, assigns the arguments to the
+// parameters, and turns each return into a move to the call's result
+// and a jump past the copy.  Callees are expanded before their
+// callers, so a caller takes in an already expanded body.  Given a
+// profile, a call it never counted stays a call, and a hot one is
+// inlined even when the body is a few times larger.  Writes one line
+// per call to a function of the module to report, if it is not null,
+// and returns the number of calls replaced.
+size_t inline_calls(oil_module *module, FILE *report,
+                    const oil_profile *profile);
+
+#endif
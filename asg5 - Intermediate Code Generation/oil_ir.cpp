@@ -0,0 +1,315 @@
+#include <algorithm>
+
+#include "buffered_writer.h"
+#include "oil_ir.h"
+
+oil_operand oil_var(const string &name) {
+    oil_operand operand;
+    operand.kind = OIL_VAR;
+    operand.name = name;
+    return operand;
+}
+
+oil_operand oil_const(const string &text) {
+    oil_operand operand;
+    operand.kind = OIL_CONST;
+    operand.name = text;
+    return operand;
+}
+
+oil_operand oil_reg(const string &family, size_t number) {
+    oil_operand operand;
+    operand.kind = OIL_REG;
+    operand.name = family;
+    operand.number = number;
+    return operand;
+}
+
+bool operator==(const oil_operand &left, const oil_operand &right) {
+    return left.kind == right.kind && left.name == right.name
+           && left.number == right.number;
+}
+
+string oil_key(const oil_operand &operand) {
+    if (operand.kind == OIL_REG) {
+        return "%" + operand.name + to_string(operand.number);
+    }
+    return operand.name;
+}
+
+size_t oil_type_size(const string &type) {
+    if (type == "char") return 1;
+    if (type == "int") return 4;
+    return 8;
+}
+
+size_t oil_struct_size(const oil_struct &structure) {
+    size_t size = 0;
+    size_t align = 1;
+    for (const oil_decl &field: structure.fields) {
+        size_t field_size = oil_type_size(field.type);
+        size = (size + field_size - 1) / field_size * field_size;
+        size += field_size;
+        align = max(align, field_size);
+    }
+    size = (size + align - 1) / align * align;
+    return max(size, size_t(1));
+}
+
+size_t oil_highest_register(const oil_function &function) {
+    size_t highest = 0;
+    for (const oil_block &block: function.blocks) {
+        for (const oil_instr &instr: block.code) {
+            if (instr.dest.kind == OIL_REG) {
+                highest = max(highest, instr.dest.number);
+            }
+            for (const oil_operand &src: instr.srcs) {
+                if (src.kind == OIL_REG) {
+                    highest = max(highest, src.number);
+                }
+            }
+        }
+    }
+    return highest;
+}
+
+bool oil_fully_lowered(const oil_function &function) {
+    for (const oil_block &block: function.blocks) {
+        for (const oil_instr &instr: block.code) {
+            if (instr.opcode == OIL_UNKNOWN) return false;
+        }
+    }
+    return true;
+}
+
+oil_instr::oil_instr(oil_opcode opcode_, int indent_)
+        : opcode(opcode_), indent(indent_) {
+}
+
+bool ends_block(const oil_block &block) {
+    switch (block.code.back().opcode) {
+        case OIL_GOTO:
+        case OIL_BRANCH:
+        case OIL_RETURN:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void oil_function::append(const oil_instr &instr) {
+    if (blocks.empty() || instr.opcode == OIL_LABEL
+        || ends_block(blocks.back())) {
+        blocks.emplace_back();
+    }
+    blocks.back().code.push_back(instr);
+}
+
+// Emitter
+// The instruction printers are shared by the .oil writer and by
+// oil_text(), which collects the same text into a string.
+struct text_writer {
+    string text;
+
+    void put(char c) { text += c; }
+    void put(const char *str) { text += str; }
+    void put(const string &str) { text += str; }
+    void put_size(size_t value) { text += to_string(value); }
+    void put_repeat(const char *str, int count) {
+        for (int i = 0; i < count; i++) text += str;
+    }
+};
+
+template <typename writer>
+void put_indent(writer &out, int levels) {
+    if (levels > 0) {
+        out.put_repeat("   ", levels);
+    }
+}
+
+template <typename writer>
+void put_operand(writer &out, const oil_operand &operand) {
+    out.put(operand.name);
+    if (operand.kind == OIL_REG) {
+        out.put_size(operand.number);
+    }
+}
+
+template <typename writer>
+void put_label(writer &out, const oil_instr &instr) {
+    out.put(instr.op);
+    out.put(instr.bare ? ":" : ":;");
+}
+
+template <typename writer>
+void put_dest(writer &out, const oil_instr &instr) {
+    if (!instr.type.empty()) {
+        out.put(instr.type);
+        out.put(' ');
+    }
+    put_operand(out, instr.dest);
+    out.put(instr.tight ? " =" : " = ");
+}
+
+template <typename writer>
+void put_call(writer &out, const oil_instr &instr) {
+    put_indent(out, instr.inner);
+    out.put(instr.op);
+    out.put(" (");
+    for (size_t i = 0; i < instr.srcs.size(); i++) {
+        if (i != 0) out.put(", ");
+        put_operand(out, instr.srcs[i]);
+    }
+    out.put(')');
+}
+
+template <typename writer>
+void emit_instr(writer &out, const oil_instr &instr) {
+    if (instr.opcode != OIL_LABEL) {
+        put_indent(out, instr.indent);
+    }
+    switch (instr.opcode) {
+        case OIL_LABEL:
+            put_label(out, instr);
+            break;
+        case OIL_GOTO:
+            out.put("goto ");
+            out.put(instr.op);
+            out.put(instr.trailing ? ":;" : ";");
+            break;
+        case OIL_BRANCH:
+            out.put("if (!");
+            put_operand(out, instr.srcs[0]);
+            out.put(") goto ");
+            out.put(instr.op);
+            out.put(';');
+            break;
+        case OIL_MOVE:
+            put_dest(out, instr);
+            put_operand(out, instr.srcs[0]);
+            out.put(';');
+            break;
+        case OIL_UNARY:
+            put_dest(out, instr);
+            out.put(instr.op);
+            put_operand(out, instr.srcs[0]);
+            out.put(';');
+            break;
+        case OIL_BINARY:
+            put_dest(out, instr);
+            put_operand(out, instr.srcs[0]);
+            out.put(' ');
+            out.put(instr.op);
+            out.put(' ');
+            put_operand(out, instr.srcs[1]);
+            if (instr.trailing) out.put(' ');
+            out.put(';');
+            break;
+        case OIL_CALL:
+            if (instr.dest.kind != OIL_NONE) {
+                put_dest(out, instr);
+            }
+            put_call(out, instr);
+            out.put(';');
+            break;
+        case OIL_ALLOC:
+            put_dest(out, instr);
+            out.put("xcalloc (");
+            put_operand(out, instr.srcs[0]);
+            out.put(", sizeof (");
+            out.put(instr.op);
+            out.put("));");
+            break;
+        case OIL_RETURN:
+            out.put("return");
+            if (!instr.srcs.empty()) {
+                out.put(' ');
+                put_operand(out, instr.srcs[0]);
+            }
+            out.put(';');
+            break;
+        case OIL_UNKNOWN:
+            out.put(instr.op);
+            break;
+    }
+}
+
+string oil_text(const oil_instr &instr) {
+    text_writer out;
+    emit_instr(out, instr);
+    return out.text;
+}
+
+void emit_body(buffered_writer &out, const oil_function &function) {
+    for (const oil_decl &local: function.locals) {
+        put_indent(out, 1);
+        out.put(local.type);
+        out.put(' ');
+        out.put(local.name);
+        out.put(";\n");
+    }
+    for (const oil_block &block: function.blocks) {
+        for (const oil_instr &instr: block.code) {
+            emit_instr(out, instr);
+            out.put('\n');
+        }
+    }
+}
+
+void emit_function(buffered_writer &out, const oil_function &function) {
+    out.put(function.type);
+    out.put(' ');
+    out.put(function.name);
+    out.put(" (\n");
+    for (size_t i = 0; i < function.params.size(); i++) {
+        if (i != 0) out.put(",\n");
+        put_indent(out, function.indent);
+        out.put(function.params[i].type);
+        out.put(' ');
+        out.put(function.params[i].name);
+    }
+    out.put(")\n{\n");
+    emit_body(out, function);
+    out.put("}\n");
+}
+
+void emit_oil(FILE *file, const oil_module &module) {
+    buffered_writer out(file);
+
+    for (const oil_struct &structure: module.structs) {
+        out.put("struct ");
+        out.put(structure.name);
+        out.put(" {\n");
+        for (const oil_decl &field: structure.fields) {
+            put_indent(out, structure.indent);
+            out.put(field.type);
+            out.put(' ');
+            out.put(field.name);
+            out.put(";\n");
+        }
+        out.put("};\n");
+    }
+
+    for (const oil_string &str: module.strings) {
+        out.put("char* ");
+        out.put(str.name);
+        out.put(" = ");
+        out.put(str.literal);
+        out.put(";\n");
+    }
+
+    for (const oil_decl &global: module.globals) {
+        out.put(global.type);
+        out.put(' ');
+        out.put(global.name);
+        out.put(";\n");
+    }
+
+    for (const oil_function &function: module.functions) {
+        emit_function(out, function);
+    }
+
+    out.put("void __ocmain (void)\n{\n");
+    emit_body(out, module.main);
+    out.put("}\n");
+}
@@ -0,0 +1,129 @@
+#ifndef __OIL_IR_H__
+#define __OIL_IR_H__
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Three-address code for one program.  oil_writer lowers the AST into
+// an oil_module and emit_oil() prints it as C, which compiles once
+// oclib.oh is included with __OCLIB_C__ defined.  Operands keep the
+// text they are printed with (mangled names, C literals), and each
+// instruction keeps its own layout.
+
+enum oil_opcode {
+    OIL_LABEL,      // op:
+    OIL_GOTO,       // goto op
+    OIL_BRANCH,     // if (!srcs[0]) goto op
+    OIL_MOVE,       // dest = srcs[0]
+    OIL_UNARY,      // dest = op srcs[0]
+    OIL_BINARY,     // dest = srcs[0] op srcs[1]
+    OIL_CALL,       // dest = op (srcs...), dest optional
+    OIL_ALLOC,      // dest = xcalloc (srcs[0], sizeof (op))
+    OIL_RETURN,     // return srcs[0], srcs optional
+    OIL_UNKNOWN,    // statement that was not lowered, op is its token
+};
+
+enum oil_kind { OIL_NONE, OIL_VAR, OIL_CONST, OIL_REG };
+
+// A variable, a literal, or a virtual register.  Registers are named
+// by family ("b" conditions, "c" chars, "i" ints, "p" pointers)
+// followed by their number.
+struct oil_operand {
+    oil_kind kind = OIL_NONE;
+    string name;
+    size_t number = 0;
+};
+
+oil_operand oil_var(const string &name);
+oil_operand oil_const(const string &text);
+oil_operand oil_reg(const string &family, size_t number);
+bool operator==(const oil_operand &left, const oil_operand &right);
+
+// Name identifying a variable or register, for use as a map key.
+// Registers start with '%', which no variable name can.
+string oil_key(const oil_operand &operand);
+
+struct oil_instr {
+    explicit oil_instr(oil_opcode opcode = OIL_UNKNOWN, int indent = 0);
+
+    oil_opcode opcode;
+    string type;        // declared type of dest, empty if assigned
+    oil_operand dest;
+    string op;
+    vector<oil_operand> srcs;
+    string site;        // location of the if or while a branch was
+                        // lowered from, as location_key() gives it
+
+    // Layout, read only by the emitter.
+    int indent;         // leading indentation, in levels
+    int inner = 0;      // indentation again before a callee
+    bool tight = false;     // no space after '='
+    bool trailing = false;  // space after the last operand, or
+                            // label punctuation after a goto target
+    bool bare = false;      // label printed without ';'
+};
+
+// Straight-line run of instructions; only the first may be a label
+// and only the last may jump or return.
+struct oil_block {
+    vector<oil_instr> code;
+};
+
+struct oil_decl {
+    string type;
+    string name;
+};
+
+struct oil_string {
+    string name;
+    string literal;
+};
+
+struct oil_function {
+    void append(const oil_instr &instr);
+
+    string type;
+    string name;
+    int indent = 0;
+    vector<oil_decl> params;
+    vector<oil_decl> locals;    // declared before the first instruction
+    vector<oil_block> blocks;
+};
+
+// Highest number of any register the function uses, so that numbers
+// above it are free in every family.
+size_t oil_highest_register(const oil_function &function);
+
+// False if the writer left any statement of the function unlowered.
+// The optimizer cannot see what such a statement reads or writes, so
+// it leaves the whole function as it was written.
+bool oil_fully_lowered(const oil_function &function);
+
+struct oil_struct {
+    string name;
+    int indent = 0;
+    vector<oil_decl> fields;
+};
+
+// Size and alignment of a field or element as the C compiler would
+// lay it out; anything unrecognised is taken to be a pointer.
+size_t oil_type_size(const string &type);
+
+// Size of a struct with its fields in their present order, at least 1.
+size_t oil_struct_size(const oil_struct &structure);
+
+struct oil_module {
+    vector<oil_struct> structs;
+    vector<oil_string> strings;
+    vector<oil_decl> globals;
+    vector<oil_function> functions;
+    oil_function main;
+};
+
+void emit_oil(FILE *out, const oil_module &module);
+string oil_text(const oil_instr &instr);
+
+#endif
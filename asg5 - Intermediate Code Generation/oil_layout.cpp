@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <unordered_map>
+
+#include "oil_layout.h"
+
+size_t field_count(const oil_field_counts *counts, const string &name) {
+    if (counts == nullptr) return 0;
+    auto found = counts->find(name);
+    return found == counts->end() ? 0 : found->second;
+}
+
+// Returns the number of hot fields, which are now the first ones.
+size_t layout_struct(oil_struct &structure, const oil_field_counts *counts) {
+    auto count = [&](const oil_decl &field) {
+        return field_count(counts, structure.name + "." + field.name);
+    };
+    size_t hottest = 0;
+    for (const oil_decl &field: structure.fields) {
+        hottest = max(hottest, count(field));
+    }
+    auto hot = [&](const oil_decl &field) {
+        return hottest > 0 && count(field) * HOT_FRACTION >= hottest;
+    };
+    stable_sort(structure.fields.begin(), structure.fields.end(),
+                [&](const oil_decl &left, const oil_decl &right) {
+                    if (hot(left) != hot(right)) return hot(left);
+                    return oil_type_size(left.type)
+                           > oil_type_size(right.type);
+                });
+    return count_if(structure.fields.begin(), structure.fields.end(), hot);
+}
+
+void layout_structs(oil_module *module, const oil_field_counts *counts,
+                    FILE *report) {
+    for (oil_struct &structure: module->structs) {
+        size_t before = oil_struct_size(structure);
+        size_t hot = layout_struct(structure, counts);
+        if (report == nullptr) continue;
+        fprintf(report, "struct %s: %zu -> %zu bytes",
+                structure.name.c_str(), before,
+                oil_struct_size(structure));
+        for (size_t i = 0; i < hot; i++) {
+            fprintf(report, "%s%s", i == 0 ? ", hot fields " : " ",
+                    structure.fields[i].name.c_str());
+        }
+        fprintf(report, "\n");
+    }
+}
+
+bool falls_through(const oil_block &block) {
+    oil_opcode last = block.code.back().opcode;
+    return last != OIL_GOTO && last != OIL_RETURN;
+}
+
+bool cold_fall_through(const oil_instr &branch,
+                       const oil_profile &profile) {
+    if (branch.opcode != OIL_BRANCH) return false;
+    auto found = profile.branches.find(branch.site);
+    if (found == profile.branches.end()) return false;
+    const oil_branch_counts &counts = found->second;
+    size_t fell = counts.tested - min(counts.taken, counts.tested);
+    return counts.tested > 0 && fell * HOT_FRACTION < counts.tested;
+}
+
+const unordered_map<string, string> OPPOSITES = {
+    {"<", ">="}, {"<=", ">"}, {">", "<="}, {">=", "<"},
+    {"==", "!="}, {"!=", "=="},
+};
+
+// Makes the branch ending code jump when it used to fall through.  A
+// condition computed just before and read nowhere else is computed
+// the other way round instead: a negation becomes a copy, and a
+// comparison its opposite.  Any other is negated into a new register.
+void turn_around(vector<oil_instr> &code,
+                 const unordered_map<string, size_t> &reads,
+                 size_t &fresh) {
+    oil_instr &branch = code.back();
+    auto read = reads.find(oil_key(branch.srcs[0]));
+    if (code.size() >= 2 && read != reads.end() && read->second == 1
+        && code[code.size() - 2].dest == branch.srcs[0]) {
+        oil_instr &test = code[code.size() - 2];
+        auto opposite = OPPOSITES.find(test.op);
+        if (test.opcode == OIL_UNARY && test.op == "!") {
+            test.opcode = OIL_MOVE;
+            test.op.clear();
+            return;
+        }
+        if (test.opcode == OIL_BINARY && opposite != OPPOSITES.end()) {
+            test.op = opposite->second;
+            return;
+        }
+    }
+    oil_instr flip(OIL_UNARY, branch.indent);
+    flip.type = "char";
+    flip.dest = oil_reg("b", ++fresh);
+    flip.op = "!";
+    flip.srcs.push_back(branch.srcs[0]);
+    branch.srcs[0] = flip.dest;
+    code.insert(code.end() - 1, flip);
+}
+
+size_t layout_blocks(oil_function &function, const oil_profile &profile) {
+    unordered_map<string, size_t> labels;
+    unordered_map<string, size_t> reads;
+    for (size_t i = 0; i < function.blocks.size(); i++) {
+        const oil_block &block = function.blocks[i];
+        if (block.code.front().opcode == OIL_LABEL) {
+            labels[block.code.front().op] = i;
+        }
+        for (const oil_instr &instr: block.code) {
+            for (const oil_operand &src: instr.srcs) {
+                if (src.kind != OIL_CONST) reads[oil_key(src)]++;
+            }
+        }
+    }
+
+    size_t fresh = oil_highest_register(function);
+    size_t turned = 0;
+    vector<oil_block> hot;
+    vector<oil_block> cold;
+    for (size_t i = 0; i < function.blocks.size(); i++) {
+        hot.push_back(move(function.blocks[i]));
+        oil_instr &branch = hot.back().code.back();
+        if (!cold_fall_through(branch, profile)) continue;
+        auto target = labels.find(branch.op);
+        if (target == labels.end() || target->second <= i + 1) continue;
+
+        oil_instr start(OIL_LABEL);
+        start.op = "cold_" + branch.op;
+        oil_instr back(OIL_GOTO, branch.indent);
+        back.op = branch.op;
+        branch.op = start.op;
+        turn_around(hot.back().code, reads, fresh);
+
+        cold.emplace_back();
+        cold.back().code.push_back(start);
+        for (i++; i < target->second; i++) {
+            cold.push_back(move(function.blocks[i]));
+        }
+        if (falls_through(cold.back())) cold.back().code.push_back(back);
+        i--;
+        turned++;
+    }
+
+    if (!cold.empty() && falls_through(hot.back())) {
+        hot.back().code.push_back(oil_instr(OIL_RETURN, 1));
+    }
+    for (oil_block &block: cold) {
+        hot.push_back(move(block));
+    }
+    function.blocks = move(hot);
+    return turned;
+}
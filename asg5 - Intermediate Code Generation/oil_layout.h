@@ -0,0 +1,30 @@
+#ifndef __OIL_LAYOUT_H__
+#define __OIL_LAYOUT_H__
+
+#include <cstdio>
+
+using namespace std;
+
+#include "oil_ir.h"
+#include "oil_profile.h"
+
+// Reorders the fields of each struct, largest alignment first, which
+// for fields of 1, 4 and 8 bytes leaves no padding but at the end.
+// Given the field counts of a --profile-generate run, the hot fields
+// of each struct go first, so that they share cache lines, and the
+// rest after them, each group ordered the same way.  Fields otherwise
+// keep their order, and their names.  Writes one line per struct to
+// report, if it is not null, with its size before and after and its
+// hot fields.
+void layout_structs(oil_module *module, const oil_field_counts *counts,
+                    FILE *report);
+
+// Moves code the profile says is cold out of the way of the code
+// around it.  Where a branch falls through into code that runs for
+// fewer than 1 / HOT_FRACTION of its tests, that code goes to the end
+// of the function, under a label of its own, and jumps back when it
+// is done; the branch is turned around to jump there, so that the
+// usual path falls through.  Returns the number of branches turned.
+size_t layout_blocks(oil_function &function, const oil_profile &profile);
+
+#endif
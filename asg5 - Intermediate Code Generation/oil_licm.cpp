@@ -0,0 +1,318 @@
+#include <algorithm>
+#include <climits>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "oil_cfg.h"
+#include "oil_fold.h"
+#include "oil_licm.h"
+
+bool writes_dest(const oil_instr &instr) {
+    switch (instr.opcode) {
+        case OIL_MOVE:
+        case OIL_UNARY:
+        case OIL_BINARY:
+        case OIL_ALLOC:
+            return true;
+        case OIL_CALL:
+            return instr.dest.kind != OIL_NONE;
+        default:
+            return false;
+    }
+}
+
+struct loop_state {
+    oil_function &function;
+    const oil_cfg &cfg;
+    const oil_loop &loop;
+    unordered_map<string, size_t> &defs;    // writes in the function
+    unordered_map<string, string> &types;
+    const unordered_set<string> &locals;
+
+    unordered_map<string, size_t> writes;   // writes in the loop
+    unordered_set<string> hoisted;
+    bool calls = false;
+    bool unknown = false;
+    vector<oil_instr> preheader;
+
+    loop_state(oil_function &function_, const oil_cfg &cfg_,
+               const oil_loop &loop_,
+               unordered_map<string, size_t> &defs_,
+               unordered_map<string, string> &types_,
+               const unordered_set<string> &locals_)
+            : function(function_), cfg(cfg_), loop(loop_), defs(defs_),
+              types(types_), locals(locals_) {
+        for (size_t block: loop.blocks) {
+            for (const oil_instr &instr: function.blocks[block].code) {
+                if (writes_dest(instr)) writes[oil_key(instr.dest)]++;
+                if (instr.opcode == OIL_CALL) calls = true;
+                if (instr.opcode == OIL_UNKNOWN) unknown = true;
+            }
+        }
+    }
+
+    bool invariant(const oil_operand &operand) {
+        string key = oil_key(operand);
+        switch (operand.kind) {
+            case OIL_CONST:
+                return true;
+            case OIL_REG:
+                return writes[key] == 0 || hoisted.count(key) != 0;
+            case OIL_VAR:
+                if (hoisted.count(key) != 0) return true;
+                return writes[key] == 0 && !unknown
+                       && (!calls || locals.count(key) != 0);
+            default:
+                return false;
+        }
+    }
+
+    bool changes_only_by_steps(const oil_operand &operand) {
+        if (operand.kind == OIL_REG) return true;
+        return operand.kind == OIL_VAR && !unknown
+               && (!calls || locals.count(operand.name) != 0);
+    }
+
+    bool can_hoist(const oil_instr &instr);
+    size_t hoist();
+    size_t reduce();
+};
+
+// A variable written only where it is declared can move with its
+// declaration.
+bool loop_state::can_hoist(const oil_instr &instr) {
+    bool declared = instr.dest.kind == OIL_REG
+                    || (instr.dest.kind == OIL_VAR && !instr.type.empty());
+    if (!declared || defs[oil_key(instr.dest)] != 1) return false;
+    long divisor;
+    switch (instr.opcode) {
+        case OIL_MOVE:
+        case OIL_UNARY:
+            return invariant(instr.srcs[0]);
+        case OIL_BINARY:
+            if ((instr.op == "/" || instr.op == "%")
+                && (instr.srcs[1].kind != OIL_CONST
+                    || !parse_constant(instr.srcs[1].name, divisor)
+                    || divisor == 0)) {
+                return false;
+            }
+            return invariant(instr.srcs[0]) && invariant(instr.srcs[1]);
+        default:
+            return false;
+    }
+}
+
+// Blocks are visited in reverse postorder, so an instruction moves
+// only after the ones computing its operands.
+size_t loop_state::hoist() {
+    size_t moved = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t block: loop.blocks) {
+            vector<oil_instr> &code = function.blocks[block].code;
+            for (size_t i = 0; i < code.size();) {
+                if (!can_hoist(code[i])) {
+                    i++;
+                    continue;
+                }
+                hoisted.insert(oil_key(code[i].dest));
+                preheader.push_back(code[i]);
+                code.erase(code.begin() + i);
+                moved++;
+                changed = true;
+            }
+        }
+    }
+    return moved;
+}
+
+struct induction {
+    oil_operand var;
+    size_t block;
+    size_t index;
+    long step;
+};
+
+bool fits(long value) {
+    return value >= INT_MIN && value <= INT_MAX;
+}
+
+size_t loop_state::reduce() {
+    // Basic induction variables: written once in the loop, by adding
+    // or subtracting a constant.
+    unordered_map<string, induction> steps;
+    for (size_t block: loop.blocks) {
+        const vector<oil_instr> &code = function.blocks[block].code;
+        for (size_t i = 0; i < code.size(); i++) {
+            const oil_instr &instr = code[i];
+            long step;
+            if (instr.opcode != OIL_BINARY
+                || (instr.op != "+" && instr.op != "-")
+                || !(instr.srcs[0] == instr.dest)
+                || instr.srcs[1].kind != OIL_CONST
+                || !parse_constant(instr.srcs[1].name, step)) {
+                continue;
+            }
+            // oc only does arithmetic on ints, so a variable this
+            // declares nowhere is one too.
+            string key = oil_key(instr.dest);
+            auto type = types.find(key);
+            if (writes[key] != 1
+                || (type != types.end() && type->second != "int")
+                || !changes_only_by_steps(instr.dest)) {
+                continue;
+            }
+            steps[key] = {instr.dest, block, i,
+                          instr.op == "+" ? step : -step};
+        }
+    }
+    if (steps.empty()) return 0;
+
+    size_t fresh = 0;
+    for (const oil_block &block: function.blocks) {
+        for (const oil_instr &instr: block.code) {
+            if (instr.dest.kind == OIL_REG) {
+                fresh = max(fresh, instr.dest.number);
+            }
+        }
+    }
+
+    // Updates go in right after the step, once all the
+    // multiplications are found.
+    unordered_map<string, vector<oil_instr>> updates;
+    size_t reduced = 0;
+    for (size_t block: loop.blocks) {
+        for (oil_instr &instr: function.blocks[block].code) {
+            string dest = oil_key(instr.dest);
+            if (instr.opcode != OIL_BINARY || instr.op != "*"
+                || defs[dest] != 1 || types[dest] != "int") {
+                continue;
+            }
+            size_t var = steps.count(oil_key(instr.srcs[0])) ? 0 : 1;
+            const oil_operand &factor = instr.srcs[1 - var];
+            auto found = steps.find(oil_key(instr.srcs[var]));
+            long scale;
+            if (found == steps.end() || factor.kind != OIL_CONST
+                || !parse_constant(factor.name, scale)
+                || !fits(scale * found->second.step)) {
+                continue;
+            }
+
+            oil_operand scaled = oil_reg("i", ++fresh);
+            function.locals.push_back({"int", oil_key(scaled).substr(1)});
+            types[oil_key(scaled)] = "int";
+
+            oil_instr init(OIL_BINARY, instr.indent);
+            init.dest = scaled;
+            init.op = "*";
+            init.srcs = {found->second.var, factor};
+            preheader.push_back(init);
+
+            oil_instr update(OIL_BINARY, instr.indent);
+            update.dest = scaled;
+            update.op = "+";
+            update.srcs = {scaled,
+                           oil_const(to_string(scale
+                                               * found->second.step))};
+            updates[found->first].push_back(update);
+
+            instr.opcode = OIL_MOVE;
+            instr.op.clear();
+            instr.srcs = {scaled};
+            instr.tight = false;
+            instr.trailing = false;
+            reduced++;
+        }
+    }
+
+    // From the back, so the positions of steps still to go stay put.
+    vector<const induction *> order;
+    for (const auto &entry: updates) {
+        order.push_back(&steps[entry.first]);
+    }
+    sort(order.begin(), order.end(),
+         [](const induction *left, const induction *right) {
+             return left->block != right->block
+                    ? left->block > right->block
+                    : left->index > right->index;
+         });
+    for (const induction *step: order) {
+        const vector<oil_instr> &added = updates[oil_key(step->var)];
+        vector<oil_instr> &code = function.blocks[step->block].code;
+        code.insert(code.begin() + step->index + 1, added.begin(),
+                    added.end());
+    }
+    return reduced;
+}
+
+// The header may only be entered from outside the loop by falling
+// into it from the block before it.
+bool has_preheader_slot(const oil_cfg &cfg, const oil_loop &loop) {
+    for (size_t pred: cfg.preds[loop.header]) {
+        bool latch = false;
+        for (size_t back: loop.latches) {
+            if (back == pred) latch = true;
+        }
+        if (latch) continue;
+        if (pred + 1 != loop.header || cfg.jump_to[pred] == loop.header) {
+            return false;
+        }
+    }
+    return true;
+}
+
+oil_loop_stats optimize_loops(oil_function &function) {
+    oil_loop_stats stats;
+    if (function.blocks.empty()) return stats;
+
+    unordered_map<string, size_t> defs;
+    unordered_map<string, string> types;
+    unordered_set<string> locals;
+    for (const oil_decl &param: function.params) {
+        locals.insert(param.name);
+        types[param.name] = param.type;
+    }
+    for (const oil_block &block: function.blocks) {
+        for (const oil_instr &instr: block.code) {
+            if (!writes_dest(instr)) continue;
+            string key = oil_key(instr.dest);
+            defs[key]++;
+            if (instr.type.empty()) continue;
+            if (instr.dest.kind == OIL_VAR) locals.insert(key);
+            auto found = types.find(key);
+            if (found == types.end()) {
+                types[key] = instr.type;
+            } else if (found->second != instr.type) {
+                found->second.clear();
+            }
+        }
+    }
+
+    // Adding a preheader leaves the loops, and their order, as they
+    // were, so the graph is rebuilt and the next loop out taken.
+    size_t count = oil_cfg(function).loops.size();
+    for (size_t n = count; n-- > 0;) {
+        oil_cfg cfg(function);
+        const oil_loop &loop = cfg.loops[n];
+        if (!has_preheader_slot(cfg, loop)) continue;
+
+        loop_state state(function, cfg, loop, defs, types, locals);
+        stats.hoisted += state.hoist();
+        stats.reduced += state.reduce();
+        if (state.preheader.empty()) continue;
+
+        oil_block preheader;
+        preheader.code = move(state.preheader);
+        function.blocks.insert(function.blocks.begin() + loop.header,
+                               move(preheader));
+
+        // A block may have been hoisted whole.
+        vector<oil_block> blocks;
+        for (oil_block &block: function.blocks) {
+            if (!block.code.empty()) blocks.push_back(move(block));
+        }
+        function.blocks = move(blocks);
+    }
+    return stats;
+}
@@ -0,0 +1,27 @@
+#ifndef __OIL_LICM_H__
+#define __OIL_LICM_H__
+
+#include "oil_ir.h"
+
+struct oil_loop_stats {
+    size_t hoisted = 0;     // instructions moved out of a loop
+    size_t reduced = 0;     // multiplications turned into additions
+};
+
+// Loop optimization, innermost loops first.  Each loop gets a
+// preheader, a block that falls into the header from outside, when
+// the header is only entered from outside by falling into it.
+//
+// Arithmetic into a register assigned once in the function, or into a
+// variable never assigned after its declaration, moves to the
+// preheader when its operands do not change in the loop.  It is then
+// computed even if the loop runs zero times, so division is hoisted
+// only by a nonzero constant.
+//
+// An int assigned only "v * k", where k is a constant and v an int that
+// the loop changes only by "v = v + c" or "v = v - c", is instead
+// copied from a new register set to v * k in the preheader and moved
+// by k * c right after v is.
+oil_loop_stats optimize_loops(oil_function &function);
+
+#endif
@@ -0,0 +1,78 @@
+#include "oil_live.h"
+
+oil_liveness::oil_liveness(const oil_function &function,
+                           const oil_cfg &cfg) {
+    for (const oil_decl &param: function.params) {
+        locals.insert(param.name);
+    }
+    for (const oil_block &block: function.blocks) {
+        for (const oil_instr &instr: block.code) {
+            if (instr.dest.kind == OIL_REG
+                || (instr.dest.kind == OIL_VAR && !instr.type.empty())) {
+                locals.insert(oil_key(instr.dest));
+            }
+        }
+    }
+
+    size_t count = function.blocks.size();
+    live_in.assign(count, {});
+    live_out.assign(count, {});
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = cfg.order.size(); i-- > 0;) {
+            size_t block = cfg.order[i];
+            oil_live_set live;
+            for (size_t succ: cfg.succs[block]) {
+                live.insert(live_in[succ].begin(), live_in[succ].end());
+            }
+            live_out[block] = live;
+            const vector<oil_instr> &code = function.blocks[block].code;
+            for (size_t j = code.size(); j-- > 0;) {
+                step(code[j], live);
+            }
+            if (live != live_in[block]) {
+                live_in[block] = move(live);
+                changed = true;
+            }
+        }
+    }
+}
+
+bool oil_liveness::is_local(const oil_operand &operand) const {
+    return operand.kind == OIL_REG
+           || (operand.kind == OIL_VAR
+               && locals.count(operand.name) != 0);
+}
+
+bool oil_liveness::defines(const oil_instr &instr) const {
+    switch (instr.opcode) {
+        case OIL_MOVE:
+        case OIL_UNARY:
+        case OIL_BINARY:
+        case OIL_CALL:
+        case OIL_ALLOC:
+            return is_local(instr.dest);
+        default:
+            return false;
+    }
+}
+
+// Moves live from after instr to before it.
+void oil_liveness::step(const oil_instr &instr,
+                        oil_live_set &live) const {
+    if (defines(instr)) {
+        live.erase(oil_key(instr.dest));
+    }
+    if (instr.opcode == OIL_UNKNOWN) {
+        for (const string &local: locals) {
+            if (local[0] != '%') live.insert(local);
+        }
+        return;
+    }
+    for (const oil_operand &src: instr.srcs) {
+        if (is_local(src)) {
+            live.insert(oil_key(src));
+        }
+    }
+}
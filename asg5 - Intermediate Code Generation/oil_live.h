@@ -0,0 +1,31 @@
+#ifndef __OIL_LIVE_H__
+#define __OIL_LIVE_H__
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+#include "oil_cfg.h"
+
+using oil_live_set = unordered_set<string>;
+
+// Liveness of the registers and local variables of one function,
+// keyed by oil_key().  Locals are the parameters and every variable
+// the function declares; anything else may be a global, so it is
+// never tracked.  Statements that were not lowered may read any
+// local variable, but never a register.
+struct oil_liveness {
+    oil_liveness(const oil_function &function, const oil_cfg &cfg);
+
+    bool is_local(const oil_operand &operand) const;
+    bool defines(const oil_instr &instr) const;
+    void step(const oil_instr &instr, oil_live_set &live) const;
+
+    oil_live_set locals;
+    vector<oil_live_set> live_in;
+    vector<oil_live_set> live_out;
+};
+
+#endif
@@ -0,0 +1,75 @@
+#include "oil_cse.h"
+#include "oil_dce.h"
+#include "oil_fold.h"
+#include "oil_inline.h"
+#include "oil_layout.h"
+#include "oil_licm.h"
+#include "oil_opt.h"
+#include "oil_regs.h"
+#include "oil_ssa.h"
+
+size_t count_instrs(const oil_function &function) {
+    size_t count = 0;
+    for (const oil_block &block: function.blocks) {
+        count += block.code.size();
+    }
+    return count;
+}
+
+void optimize_function(oil_function &function, int level,
+                       FILE *report, const oil_profile *profile) {
+    if (level < 1) return;
+    if (!oil_fully_lowered(function)) {
+        if (report != nullptr) {
+            fprintf(report, "%s: not optimized (not fully lowered)\n",
+                    function.name.c_str());
+        }
+        return;
+    }
+    if (profile != nullptr) {
+        size_t turned = layout_blocks(function, *profile);
+        if (report != nullptr && turned > 0) {
+            fprintf(report, "%s: moved the code after %zu branches "
+                            "out of line\n",
+                    function.name.c_str(), turned);
+        }
+    }
+    size_t before = count_instrs(function);
+    size_t folded = fold_constants(function);
+    size_t unreachable = remove_unreachable(function);
+    size_t shared = eliminate_common_subexpressions(function, level >= 2);
+    size_t propagated = propagate_copies(function);
+    size_t coalesced = coalesce_copies(function);
+    oil_loop_stats loops;
+    if (level >= 2) loops = optimize_loops(function);
+    size_t dead = remove_dead_stores(function);
+    size_t jumps = remove_dead_labels(function);
+    oil_reg_stats regs = allocate_registers(function);
+
+    if (report == nullptr) return;
+    fprintf(report, "%s: %zu folded, %zu shared, %zu propagated, "
+                    "%zu hoisted, %zu reduced, "
+                    "%zu removed (%zu unreachable, %zu coalesced, "
+                    "%zu dead, %zu jumps and labels)"
+                    ", %zu -> %zu instructions"
+                    ", %zu -> %zu registers (%zu live at most)\n",
+            function.name.c_str(), folded, shared, propagated,
+            loops.hoisted, loops.reduced,
+            before - count_instrs(function), unreachable,
+            coalesced + regs.moves, dead, jumps,
+            before, count_instrs(function),
+            regs.before, regs.after, regs.peak);
+}
+
+void optimize_oil(oil_module *module, int level, FILE *report,
+                  const oil_profile *profile) {
+    if (level >= 1) {
+        layout_structs(module, profile != nullptr ? &profile->fields : nullptr,
+                       report);
+    }
+    if (level >= 2) inline_calls(module, report, profile);
+    for (oil_function &function: module->functions) {
+        optimize_function(function, level, report, profile);
+    }
+    optimize_function(module->main, level, report, profile);
+}
@@ -0,0 +1,21 @@
+#ifndef __OIL_OPT_H__
+#define __OIL_OPT_H__
+
+#include <cstdio>
+
+#include "oil_ir.h"
+#include "oil_profile.h"
+
+// Runs the passes enabled at the given -O level over every function
+// in the module, and writes one line per function to report, if it
+// is not null, saying what each pass did.  Structs are laid out
+// first, with a line for each.  Level 2 then inlines small functions,
+// reporting each call it considered.  Level 0 leaves the lowered
+// code as it is, and so does every level for a function holding a
+// statement the writer could not lower.  Given a profile, structs put
+// their hot fields first, inlining follows the calls it counted, and
+// each function first moves its cold code out of line.
+void optimize_oil(oil_module *module, int level, FILE *report,
+                  const oil_profile *profile);
+
+#endif
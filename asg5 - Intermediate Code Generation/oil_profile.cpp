@@ -0,0 +1,45 @@
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "auxlib.h"
+#include "oil_profile.h"
+
+size_t oil_profile::call_count(const string &caller,
+                               const string &callee) const {
+    auto found = calls.find(caller + " " + callee);
+    return found == calls.end() ? 0 : found->second;
+}
+
+bool read_profile(const char *path, oil_profile &profile) {
+    ifstream in(path);
+    if (!in) {
+        syserrprintf(path);
+        return false;
+    }
+    string line;
+    while (getline(in, line)) {
+        istringstream fields(line);
+        size_t count;
+        string kind;
+        if (!(fields >> count >> kind)) continue;
+        if (kind == "call") {
+            string caller, callee;
+            fields >> caller >> callee;
+            profile.calls[caller + " " + callee] += count;
+        } else if (kind == "branch" || kind == "taken") {
+            string site;
+            if (!(fields >> site)) continue;
+            oil_branch_counts &branch = profile.branches[site];
+            (kind == "branch" ? branch.tested : branch.taken) += count;
+        } else if (kind == "field") {
+            string field;
+            fields >> field;
+            profile.fields[field] += count;
+        }
+    }
+    for (const auto &call: profile.calls) {
+        profile.hottest_call = max(profile.hottest_call, call.second);
+    }
+    return true;
+}
@@ -0,0 +1,43 @@
+#ifndef __OIL_PROFILE_H__
+#define __OIL_PROFILE_H__
+
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+// A call or field is hot if it is counted at least 1 / HOT_FRACTION
+// as often as the most counted of its kind, and code is cold if it
+// runs less often than that against the code around it.
+constexpr size_t HOT_FRACTION = 8;
+
+// Accesses to each field, by struct and field as the .oil code names
+// them: "s_node.__link".
+using oil_field_counts = unordered_map<string, size_t>;
+
+struct oil_branch_counts {
+    size_t tested = 0;
+    size_t taken = 0;
+};
+
+// Counts from the profile that a program built with
+// --profile-generate writes as it exits.  Functions are named as in
+// the .oil code.  Branches are known by the location of their if or
+// while, "filenr.linenr.offset", which the lowered branch keeps, even
+// once inlined.
+struct oil_profile {
+    unordered_map<string, size_t> calls;    // "caller callee"
+    size_t hottest_call = 0;
+    unordered_map<string, oil_branch_counts> branches;
+    oil_field_counts fields;
+
+    size_t call_count(const string &caller, const string &callee) const;
+};
+
+// Reads the profile at path into profile, adding up lines with the
+// same key.  Lines counting blocks are there for people to read and
+// are skipped.  Returns false, after reporting, if the file cannot be
+// read.
+bool read_profile(const char *path, oil_profile &profile);
+
+#endif
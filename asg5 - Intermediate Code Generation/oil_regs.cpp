@@ -0,0 +1,216 @@
+#include <unordered_map>
+#include <unordered_set>
+
+#include "oil_cfg.h"
+#include "oil_live.h"
+#include "oil_regs.h"
+
+constexpr size_t NO_COLOR = static_cast<size_t>(-1);
+
+struct reg_node {
+    oil_operand reg;
+    string type;
+    unordered_set<size_t> neighbors;
+    size_t partner = NO_COLOR;      // other side of a copy
+    size_t color = NO_COLOR;
+};
+
+struct reg_graph {
+    vector<reg_node> nodes;
+    unordered_map<string, size_t> index;
+
+    size_t find(const oil_operand &reg) {
+        string key = oil_key(reg);
+        auto found = index.find(key);
+        if (found != index.end()) return found->second;
+        index[key] = nodes.size();
+        nodes.emplace_back();
+        nodes.back().reg = reg;
+        return nodes.size() - 1;
+    }
+
+    void link(size_t left, size_t right) {
+        nodes[left].neighbors.insert(right);
+        nodes[right].neighbors.insert(left);
+    }
+
+    bool same_class(size_t left, size_t right) const {
+        return nodes[left].reg.name == nodes[right].reg.name
+               && nodes[left].type == nodes[right].type;
+    }
+};
+
+bool writes_register(const oil_instr &instr) {
+    switch (instr.opcode) {
+        case OIL_MOVE:
+        case OIL_UNARY:
+        case OIL_BINARY:
+        case OIL_CALL:
+        case OIL_ALLOC:
+            return instr.dest.kind == OIL_REG;
+        default:
+            return false;
+    }
+}
+
+bool is_copy(const oil_instr &instr) {
+    return instr.opcode == OIL_MOVE && instr.dest.kind == OIL_REG
+           && instr.srcs[0].kind == OIL_REG;
+}
+
+// Registers in order of first mention, with their declared types.
+// False if a register is never declared or declared twice differently.
+bool collect(const oil_function &function, reg_graph &graph) {
+    unordered_map<string, string> declared;
+    for (const oil_decl &local: function.locals) {
+        declared["%" + local.name] = local.type;
+    }
+    unordered_set<size_t> typed;
+    for (const oil_block &block: function.blocks) {
+        for (const oil_instr &instr: block.code) {
+            for (const oil_operand &src: instr.srcs) {
+                if (src.kind == OIL_REG) graph.find(src);
+            }
+            if (!writes_register(instr)) continue;
+            size_t id = graph.find(instr.dest);
+            const string &type = instr.type.empty()
+                                 ? declared[oil_key(instr.dest)]
+                                 : instr.type;
+            if (type.empty()) return false;
+            if (typed.insert(id).second) {
+                graph.nodes[id].type = type;
+            } else if (graph.nodes[id].type != type) {
+                return false;
+            }
+            if (is_copy(instr)) {
+                size_t src = graph.find(instr.srcs[0]);
+                if (graph.nodes[id].partner == NO_COLOR) {
+                    graph.nodes[id].partner = src;
+                }
+                if (graph.nodes[src].partner == NO_COLOR) {
+                    graph.nodes[src].partner = id;
+                }
+            }
+        }
+    }
+    return typed.size() == graph.nodes.size();
+}
+
+size_t count_registers(const oil_live_set &live) {
+    size_t count = 0;
+    for (const string &key: live) {
+        if (key[0] == '%') count++;
+    }
+    return count;
+}
+
+// Walks each block backwards from its live out set.  The source of a
+// copy does not interfere with its destination, so both may share a
+// name.
+bool interfere(const oil_function &function, reg_graph &graph,
+               size_t &peak) {
+    oil_cfg cfg(function);
+    oil_liveness liveness(function, cfg);
+    if (count_registers(liveness.live_in[0]) != 0) return false;
+
+    for (size_t block: cfg.order) {
+        oil_live_set live = liveness.live_out[block];
+        peak = max(peak, count_registers(live));
+        const vector<oil_instr> &code = function.blocks[block].code;
+        for (size_t i = code.size(); i-- > 0;) {
+            const oil_instr &instr = code[i];
+            if (writes_register(instr)) {
+                string dest = oil_key(instr.dest);
+                string copied = is_copy(instr) ? oil_key(instr.srcs[0])
+                                               : "";
+                size_t id = graph.index[dest];
+                for (const string &key: live) {
+                    if (key[0] == '%' && key != dest && key != copied) {
+                        graph.link(id, graph.index[key]);
+                    }
+                }
+            }
+            liveness.step(instr, live);
+            peak = max(peak, count_registers(live));
+        }
+    }
+    return true;
+}
+
+void color(reg_graph &graph) {
+    for (size_t id = 0; id < graph.nodes.size(); id++) {
+        reg_node &node = graph.nodes[id];
+        unordered_set<size_t> taken;
+        for (size_t other: node.neighbors) {
+            if (graph.same_class(id, other)) {
+                taken.insert(graph.nodes[other].color);
+            }
+        }
+        size_t partner = node.partner;
+        if (partner != NO_COLOR && graph.same_class(id, partner)
+            && graph.nodes[partner].color != NO_COLOR
+            && taken.count(graph.nodes[partner].color) == 0) {
+            node.color = graph.nodes[partner].color;
+            continue;
+        }
+        node.color = 0;
+        while (taken.count(node.color) != 0) node.color++;
+    }
+}
+
+oil_reg_stats allocate_registers(oil_function &function) {
+    oil_reg_stats stats;
+    reg_graph graph;
+    bool usable = collect(function, graph);
+    stats.before = stats.after = graph.nodes.size();
+    if (graph.nodes.empty() || !usable
+        || !interfere(function, graph, stats.peak)) {
+        return stats;
+    }
+    color(graph);
+
+    // Names are handed out per family in order of first mention.
+    unordered_map<string, size_t> names;
+    unordered_map<string, size_t> next;
+    vector<size_t> numbers(graph.nodes.size());
+    function.locals.clear();
+    for (size_t id = 0; id < graph.nodes.size(); id++) {
+        const reg_node &node = graph.nodes[id];
+        string name = node.reg.name + " " + node.type + " "
+                      + to_string(node.color);
+        auto found = names.find(name);
+        if (found != names.end()) {
+            numbers[id] = found->second;
+            continue;
+        }
+        numbers[id] = names[name] = ++next[node.reg.name];
+        function.locals.push_back(
+                {node.type, node.reg.name + to_string(numbers[id])});
+    }
+    stats.after = names.size();
+
+    auto rename = [&graph, &numbers](oil_operand &operand) {
+        if (operand.kind == OIL_REG) {
+            operand.number = numbers[graph.index[oil_key(operand)]];
+        }
+    };
+    vector<oil_block> blocks;
+    for (oil_block &block: function.blocks) {
+        vector<oil_instr> code;
+        for (oil_instr &instr: block.code) {
+            for (oil_operand &src: instr.srcs) rename(src);
+            if (writes_register(instr)) {
+                rename(instr.dest);
+                instr.type.clear();
+            }
+            if (is_copy(instr) && instr.dest == instr.srcs[0]) {
+                stats.moves++;
+                continue;
+            }
+            code.push_back(move(instr));
+        }
+        if (!code.empty()) blocks.push_back({move(code)});
+    }
+    function.blocks = move(blocks);
+    return stats;
+}
@@ -0,0 +1,24 @@
+#ifndef __OIL_REGS_H__
+#define __OIL_REGS_H__
+
+#include "oil_ir.h"
+
+struct oil_reg_stats {
+    size_t before = 0;      // registers as lowered
+    size_t after = 0;       // registers once allocated
+    size_t peak = 0;        // most registers live at any one point
+    size_t moves = 0;       // copies of a register to itself removed
+};
+
+// Register allocation by graph coloring.  Two registers interfere if
+// one is written while the other is live.  Registers of the same
+// family and type that do not interfere share one name, numbered from
+// 1 in each function, and a copy between two registers gets one name
+// for both when it can.  Since a name may now be written more than
+// once, the registers are declared at the top of the function rather
+// than where they are written.  Functions that read a register before
+// writing it, or declare one with two types, are left alone.
+// Registers already in function.locals need no type where written.
+oil_reg_stats allocate_registers(oil_function &function);
+
+#endif
@@ -0,0 +1,279 @@
+#include <tuple>
+
+#include "oil_ssa.h"
+
+oil_ssa::oil_ssa(const oil_function &function_, const oil_cfg &cfg_)
+        : function(function_), cfg(cfg_) {
+    oil_liveness liveness(function, cfg);
+    bool unlowered = false;
+    size_t count = function.blocks.size();
+    phis.assign(count, {});
+    uses.assign(count, {});
+    results.assign(count, {});
+    for (size_t block = 0; block < count; block++) {
+        const vector<oil_instr> &code = function.blocks[block].code;
+        results[block].assign(code.size(), NO_DEF);
+        for (const oil_instr &instr: code) {
+            uses[block].push_back(vector<size_t>(instr.srcs.size(),
+                                                 NO_DEF));
+            if (instr.opcode == OIL_UNKNOWN) unlowered = true;
+        }
+    }
+
+    for (const string &key: liveness.locals) {
+        if (key[0] == '%' || !unlowered) {
+            names.insert(key);
+            stacks[key].push_back(defs.size());
+            defs.push_back({key, 0, NO_DEF, false, {}});
+        }
+    }
+
+    if (count == 0) return;
+    place_phis(liveness);
+    rename(0);
+}
+
+bool oil_ssa::tracks(const oil_operand &operand) const {
+    return (operand.kind == OIL_VAR || operand.kind == OIL_REG)
+           && names.count(oil_key(operand)) != 0;
+}
+
+size_t oil_ssa::versions(const string &key) const {
+    auto found = counts.find(key);
+    return found == counts.end() ? 0 : found->second;
+}
+
+bool oil_ssa::defines(const oil_instr &instr) const {
+    switch (instr.opcode) {
+        case OIL_MOVE:
+        case OIL_UNARY:
+        case OIL_BINARY:
+        case OIL_CALL:
+        case OIL_ALLOC:
+            return tracks(instr.dest);
+        default:
+            return false;
+    }
+}
+
+void oil_ssa::place_phis(const oil_liveness &liveness) {
+    size_t count = function.blocks.size();
+    vector<unordered_set<size_t>> frontier(count);
+    for (size_t block: cfg.order) {
+        if (cfg.preds[block].size() < 2) continue;
+        for (size_t pred: cfg.preds[block]) {
+            if (!cfg.reachable(pred)) continue;
+            for (size_t runner = pred; runner != cfg.idom[block];
+                 runner = cfg.idom[runner]) {
+                frontier[runner].insert(block);
+            }
+        }
+    }
+
+    unordered_map<string, vector<size_t>> def_blocks;
+    for (size_t block: cfg.order) {
+        for (const oil_instr &instr: function.blocks[block].code) {
+            if (defines(instr)) {
+                def_blocks[oil_key(instr.dest)].push_back(block);
+            }
+        }
+    }
+
+    for (auto &entry: def_blocks) {
+        const string &key = entry.first;
+        vector<size_t> work = entry.second;
+        unordered_set<size_t> queued(work.begin(), work.end());
+        unordered_set<size_t> placed;
+        while (!work.empty()) {
+            size_t block = work.back();
+            work.pop_back();
+            for (size_t join: frontier[block]) {
+                if (placed.count(join) != 0
+                    || liveness.live_in[join].count(key) == 0) {
+                    continue;
+                }
+                placed.insert(join);
+                phis[join].push_back(defs.size());
+                defs.push_back({key, join, NO_DEF, true,
+                                vector<size_t>(cfg.preds[join].size(),
+                                               NO_DEF)});
+                counts[key]++;
+                if (queued.insert(join).second) work.push_back(join);
+            }
+        }
+    }
+}
+
+void oil_ssa::rename(size_t block) {
+    vector<string> pushed;
+    for (size_t phi: phis[block]) {
+        stacks[defs[phi].key].push_back(phi);
+        pushed.push_back(defs[phi].key);
+    }
+
+    const vector<oil_instr> &code = function.blocks[block].code;
+    for (size_t i = 0; i < code.size(); i++) {
+        const oil_instr &instr = code[i];
+        for (size_t j = 0; j < instr.srcs.size(); j++) {
+            if (tracks(instr.srcs[j])) {
+                uses[block][i][j] = stacks[oil_key(instr.srcs[j])].back();
+            }
+        }
+        if (defines(instr)) {
+            string key = oil_key(instr.dest);
+            results[block][i] = defs.size();
+            stacks[key].push_back(defs.size());
+            defs.push_back({key, block, i, false, {}});
+            counts[key]++;
+            pushed.push_back(key);
+        }
+    }
+
+    for (size_t succ: cfg.succs[block]) {
+        for (size_t phi: phis[succ]) {
+            for (size_t k = 0; k < cfg.preds[succ].size(); k++) {
+                if (cfg.preds[succ][k] == block) {
+                    defs[phi].args[k] = stacks[defs[phi].key].back();
+                }
+            }
+        }
+    }
+
+    for (size_t child: cfg.dom_children[block]) {
+        rename(child);
+    }
+    for (const string &key: pushed) {
+        stacks[key].pop_back();
+    }
+}
+
+// Declared type of every register and local, empty when declarations
+// disagree.
+unordered_map<string, string> declared_types(
+        const oil_function &function) {
+    unordered_map<string, string> types;
+    auto declare = [&types](const string &key, const string &type) {
+        auto found = types.find(key);
+        if (found == types.end()) {
+            types[key] = type;
+        } else if (found->second != type) {
+            found->second.clear();
+        }
+    };
+    for (const oil_decl &param: function.params) {
+        declare(param.name, param.type);
+    }
+    for (const oil_block &block: function.blocks) {
+        for (const oil_instr &instr: block.code) {
+            if (instr.dest.kind != OIL_NONE && !instr.type.empty()) {
+                declare(oil_key(instr.dest), instr.type);
+            }
+        }
+    }
+    return types;
+}
+
+// A copy "d = s" lets every read of that version of d read s instead,
+// provided s has a single version, which therefore reaches all of
+// those reads too, and both are declared with the same type.  Only
+// s's range grows, and s has no other version to collide with, so
+// leaving SSA form stays trivial.  Reads through phis are left alone.
+size_t propagate_copies(oil_function &function) {
+    if (function.blocks.empty()) return 0;
+    oil_cfg cfg(function);
+    oil_ssa ssa(function, cfg);
+    unordered_map<string, string> types = declared_types(function);
+    unordered_set<string> params;
+    for (const oil_decl &param: function.params) {
+        params.insert(param.name);
+    }
+
+    vector<vector<tuple<size_t, size_t, size_t>>> sites(ssa.defs.size());
+    for (size_t block = 0; block < ssa.uses.size(); block++) {
+        for (size_t i = 0; i < ssa.uses[block].size(); i++) {
+            for (size_t j = 0; j < ssa.uses[block][i].size(); j++) {
+                size_t def = ssa.uses[block][i][j];
+                if (def != NO_DEF) sites[def].push_back({block, i, j});
+            }
+        }
+    }
+
+    size_t replaced = 0;
+    for (size_t id = 0; id < ssa.defs.size(); id++) {
+        const ssa_def &def = ssa.defs[id];
+        if (def.phi || def.index == NO_DEF) continue;
+        const oil_instr &copy = function.blocks[def.block].code[def.index];
+        if (copy.opcode != OIL_MOVE || !ssa.tracks(copy.srcs[0])) {
+            continue;
+        }
+
+        oil_operand src = copy.srcs[0];
+        string key = oil_key(src);
+        size_t from = ssa.uses[def.block][def.index][0];
+        const ssa_def &origin = ssa.defs[from];
+        bool defined = origin.phi || origin.index != NO_DEF
+                       || params.count(key) != 0;
+        const string &type = types[key];
+        if (ssa.versions(key) > 1 || !defined || type.empty()
+            || types[def.key] != type) {
+            continue;
+        }
+
+        for (const auto &site: sites[id]) {
+            size_t block, i, j;
+            tie(block, i, j) = site;
+            function.blocks[block].code[i].srcs[j] = src;
+            ssa.uses[block][i][j] = from;
+            sites[from].push_back(site);
+            replaced++;
+        }
+        sites[id].clear();
+    }
+    return replaced;
+}
+
+bool has_result(const oil_instr &instr) {
+    switch (instr.opcode) {
+        case OIL_MOVE:
+        case OIL_UNARY:
+        case OIL_BINARY:
+        case OIL_CALL:
+        case OIL_ALLOC:
+            return instr.dest.kind == OIL_REG;
+        default:
+            return false;
+    }
+}
+
+// Walks each block backwards, so live holds what is live after the
+// copy when the pair is looked at.
+size_t coalesce_copies(oil_function &function) {
+    if (function.blocks.empty()) return 0;
+    oil_cfg cfg(function);
+    oil_liveness liveness(function, cfg);
+
+    size_t removed = 0;
+    for (size_t block: cfg.order) {
+        vector<oil_instr> &code = function.blocks[block].code;
+        oil_live_set live = liveness.live_out[block];
+        for (size_t i = code.size(); i-- > 0;) {
+            const oil_instr &copy = code[i];
+            if (i > 0 && has_result(code[i - 1])
+                && copy.opcode == OIL_MOVE
+                && copy.srcs[0] == code[i - 1].dest
+                && live.count(oil_key(copy.srcs[0])) == 0) {
+                oil_instr &def = code[i - 1];
+                def.dest = copy.dest;
+                def.type = copy.type;
+                def.inner = 0;
+                def.tight = false;
+                def.trailing = false;
+                code.erase(code.begin() + i);
+                removed++;
+                continue;
+            }
+            liveness.step(copy, live);
+        }
+    }
+    return removed;
+}
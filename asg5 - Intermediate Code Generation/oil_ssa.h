@@ -0,0 +1,69 @@
+#ifndef __OIL_SSA_H__
+#define __OIL_SSA_H__
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+#include "oil_cfg.h"
+#include "oil_live.h"
+
+constexpr size_t NO_DEF = static_cast<size_t>(-1);
+
+// A version of a register or local variable: its value on entry to
+// the function, the result of one instruction, or a phi at the top
+// of a block.
+struct ssa_def {
+    string key;
+    size_t block;
+    size_t index;           // instruction, NO_DEF for entry and phis
+    bool phi;
+    vector<size_t> args;    // phi arguments, one per cfg.preds entry
+};
+
+// Static single assignment form of one function, kept beside the code
+// rather than written into it: every operand that reads a register or
+// local variable is linked to the one version that reaches it, with
+// phis placed on the iterated dominance frontier of each name's
+// definitions wherever the name is live.  Variables take part only
+// if the function has no unlowered statements, which may write any
+// of them.  Since names are never rewritten, leaving SSA form means
+// only dropping the links, as long as the code is changed in a way
+// that never makes two versions of one name live at once.
+struct oil_ssa {
+    oil_ssa(const oil_function &function, const oil_cfg &cfg);
+
+    bool tracks(const oil_operand &operand) const;
+    size_t versions(const string &key) const;
+
+    vector<ssa_def> defs;
+    vector<vector<size_t>> phis;    // phi defs at the top of each block
+    vector<vector<vector<size_t>>> uses;    // [block][instr][src]
+    vector<vector<size_t>> results;         // [block][instr]
+
+private:
+    const oil_function &function;
+    const oil_cfg &cfg;
+    unordered_set<string> names;
+    unordered_map<string, size_t> counts;
+    unordered_map<string, vector<size_t>> stacks;
+
+    bool defines(const oil_instr &instr) const;
+    void place_phis(const oil_liveness &liveness);
+    void rename(size_t block);
+};
+
+// Replaces reads of a register or variable that was copied from
+// another one, which never changes, by reads of the original.
+// Returns the number of operands replaced.
+size_t propagate_copies(oil_function &function);
+
+// Folds "r = expr; x = r;" into "x = expr;" when the register is not
+// read again before it is next written.  Returns the number of moves
+// removed.
+size_t coalesce_copies(oil_function &function);
+
+#endif
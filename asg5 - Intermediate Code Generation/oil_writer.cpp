@@ -1,520 +1,391 @@
 #include <iostream>
+#include <unordered_map>
 #include <vector>
 
+#include "oil_ir.h"
 #include "symbol_table.h"
 
 using namespace std;
 
 // Pre-Declarations
-void generate_oil_rec(FILE *out,
+void generate_oil_rec(oil_function *fn,
                       astree *node, int depth, astree *extra);
 string update_type(astree *node, const string *structure) ;
 string mangle(astree *node, const string &original) ;
-string get_register_prefix(const string &type) ;
+string mangled_name(astree *node) ;
+oil_operand mangled(astree *node) ;
+oil_operand literal(astree *node) ;
+string label_name(const string &prefix, astree *node) ;
 
 size_t register_counter = 1;
+size_t label_counter = 0;
+unordered_map<string, string> return_types;     // by mangled name
 
 // Oil Generation
-void generate_string(FILE *out, astree *node, int depth) {
-    if (node->symbol == '=' || node->symbol == TOK_VARDECL) {
-        if (node->children[1]->symbol == TOK_STRINGCON) {
-            fprintf(out, "char* %s = %s\n",
-                    mangle(node, *node->children[0]->
-                            children[0]->lexinfo).c_str(),
-                    (*node->children[1]->lexinfo).c_str());
-        }
-    } else {
-        for (astree *child: node->children) {
-            generate_string(out, child, depth);
-        }
+// A global string initialised with a literal starts out holding it.
+void generate_string(oil_module *module, astree *node) {
+    if (node->symbol != TOK_VARDECL) return;
+    astree *type = node->children[0];
+    if (type->symbol == TOK_STRING
+        && node->children[1]->symbol == TOK_STRINGCON) {
+        module->strings.push_back({
+                mangled_name(type->children.back()),
+                *node->children[1]->lexinfo});
     }
 }
 
-void generate_structure(FILE *out, astree *child, int depth) {
+void generate_structure(oil_module *module, astree *child, int depth) {
     astree *structure = child->children[0];
     depth++;
-    fprintf(out, "struct %s {\n",
-            mangle(child, *structure->lexinfo).c_str());
+    oil_struct def;
+    def.name = mangle(child, *structure->lexinfo);
+    def.indent = depth;
 
     for (size_t i = 1; i < child->children.size(); ++i) {
         astree *field = child->children[i]->children[0];
         string original_name = *field->lexinfo;
         field->lexinfo = structure->lexinfo;
-        fprintf(out, "%s%s %s;\n",
-                string(depth * 3, ' ').c_str(),
-                update_type(child->children[i],
-                            structure->lexinfo).c_str(),
-                mangle(field, original_name).c_str());
+        def.fields.push_back({
+                update_type(child->children[i], structure->lexinfo),
+                mangle(field, original_name)});
     }
 
-    fprintf(out, "};\n");
+    module->structs.push_back(def);
 }
 
-void generate_function(FILE *out, astree *node, int depth) {
-    astree *name = node->children[0]->children[0];
+void generate_function(oil_module *module, astree *node, int depth) {
+    astree *name = node->children[0]->children.back();
     name->symbol = TOK_FUNCTION;
-    fprintf(out, "%s %s (\n",
-            update_type(node->children[0],
-                        node->children[0]->lexinfo).c_str(),
-            mangle(name, *name->lexinfo).c_str());
+    oil_function fn;
+    fn.type = update_type(node->children[0],
+                          node->children[0]->lexinfo);
+    fn.name = mangled_name(name);
 
     depth++;
+    fn.indent = depth;
     int next = 2;
     astree *params = node->children[1];
     if (params->symbol == TOK_PARAMLIST) {
         for (size_t i = 0; i < params->children.size(); i++) {
-            astree *param = params->children[i]->children[0];
-            fprintf(out, "%s%s %s",
-                    string(depth * 3, ' ').c_str(),
+            astree *param = params->children[i]->children.back();
+            fn.params.push_back({
                     update_type(params->children[i],
-                                params->children[i]->lexinfo).c_str(),
-                    mangle(param, *param->lexinfo).c_str());
-            if (i + 1 != params->children.size())
-                fprintf(out, ",\n");
+                                params->children[i]->lexinfo),
+                    mangled_name(param)});
         }
     } else {
         next = 1;
     }
-    fprintf(out, ")\n{\n");
-    generate_oil_rec(out, node->children[next], depth, nullptr);
-    fprintf(out, "}\n");
+    generate_oil_rec(&fn, node->children[next], depth, nullptr);
+    module->functions.push_back(move(fn));
 }
 
-void generate_new(FILE *out, astree *node) {
-    if (node->children[0]->symbol == TOK_TYPEID) {
-        fprintf(out, "struct %s* p%zu = %s%s));\n",
-                (*node->children[0]->lexinfo).c_str(),
-                register_counter++,
-                "xcalloc (1, sizeof (struct ",
-                mangle(node->children[0],
-                       *node->children[0]->lexinfo).c_str());
-    } else if (node->symbol == TOK_NEWARRAY) {
-        fprintf(out, "%s* p%zu = xcalloc (%s, sizeof (%s));\n",
-                update_type(node->children[0],
-                            node->children[0]->lexinfo).c_str(),
-                register_counter++,
-                (*node->children[1]->lexinfo).c_str(),
-                mangle(node->children[0],
-                       *node->children[0]->lexinfo).c_str());
-    } else if (node->symbol == TOK_NEWSTRING) {
-        fprintf(out, "char* p%zu = xcalloc (%lu, sizeof (char));\n",
-                register_counter++,
-                node->children[0]->lexinfo->length() - 2);
-    } else {
-        fprintf(out, "Error: %s;\n", (*node->lexinfo).c_str());
-    }
+// Register family for values of a C type.
+string register_family(const string &type) {
+    if (type == "int") return "i";
+    if (type == "char") return "c";
+    return "p";
 }
 
-void generate_call(FILE *out, astree *node, int depth) {
-    node->children[0]->symbol = TOK_FUNCTION;
-    fprintf(out, "%s%s (",
-            string(depth * 3, ' ').c_str(),
-            mangle(node->children[0],
-                   *node->children[0]->lexinfo).c_str());
+// Stands in for a statement or expression the writer cannot lower.
+// The optimizer leaves a function holding one alone.
+oil_operand generate_unknown(oil_function *fn, astree *node, int depth) {
+    oil_instr unknown(OIL_UNKNOWN, depth);
+    unknown.op = parser::get_tname(node->symbol);
+    fn->append(unknown);
+    return literal(node);
+}
 
-    for (size_t i = 1; i < node->children.size(); i++) {
-        astree *arguement = node->children[i];
-        fprintf(out, "%s",
-                mangle(arguement, *arguement->lexinfo).c_str());
-        if (i + 1 != node->children.size()) {
-            fprintf(out, ", ");
-        }
+oil_operand generate_operand(oil_function *fn, astree *node, int depth) ;
+
+oil_operand generate_new(oil_function *fn, astree *node, int depth) {
+    oil_instr alloc(OIL_ALLOC, depth);
+    astree *type = node->children[0];
+    switch (node->symbol) {
+        case TOK_NEW:
+            alloc.type = update_type(type, type->lexinfo);
+            alloc.op = "struct s_" + *type->lexinfo;
+            alloc.srcs.push_back(oil_const("1"));
+            break;
+        case TOK_NEWSTRING:
+            alloc.type = "char*";
+            alloc.op = "char";
+            alloc.srcs.push_back(generate_operand(fn, type, depth));
+            break;
+        default:
+            alloc.op = update_type(type, type->lexinfo);
+            alloc.type = alloc.op + "*";
+            alloc.srcs.push_back(
+                    generate_operand(fn, node->children[1], depth));
+            break;
     }
-    fprintf(out, ")");
+    alloc.dest = oil_reg("p", register_counter++);
+    fn->append(alloc);
+    return alloc.dest;
 }
 
-void generate_return(FILE *out, astree *node, int depth) {
-    astree *returned = node->children[0];
-    fprintf(out, "%s", string((depth - 1) * 3, ' ').c_str());
-    if (returned != nullptr) {
-        if (returned->symbol == TOK_IDENT) {
-            fprintf(out, "return %s;\n",
-                    mangle(returned, *returned->lexinfo).c_str());
-        } else {
-            fprintf(out, "return %s;\n",
-                    (*returned->lexinfo).c_str());
-        }
-    } else {
-        fprintf(out, "return;\n");
+// Arguments are computed in order before the call.
+oil_instr generate_call(oil_function *fn, astree *node, int depth) {
+    node->children[0]->symbol = TOK_FUNCTION;
+    vector<oil_operand> args;
+    for (size_t i = 1; i < node->children.size(); i++) {
+        args.push_back(generate_operand(fn, node->children[i], depth));
     }
+    oil_instr call(OIL_CALL, depth);
+    call.op = mangled_name(node->children[0]);
+    call.srcs = move(args);
+    return call;
 }
 
-void generate_unary_op(FILE *out, astree *node, int depth) {
-    astree *operand = node->children[0];
-    fprintf(out, "%schar b%zu = %s%s;\n",
-            string((depth + 1) * 3, ' ').c_str(),
-            register_counter++,
-            (*node->lexinfo).c_str(),
-            mangle(operand, *operand->lexinfo).c_str());
+oil_operand generate_unary(oil_function *fn, astree *node, int depth) {
+    oil_operand operand = generate_operand(fn, node->children[0], depth);
+    bool logical = node->symbol == '!';
+    oil_instr unary(OIL_UNARY, depth);
+    unary.type = logical ? "char" : "int";
+    unary.dest = oil_reg(logical ? "b" : "i", register_counter++);
+    unary.op = *node->lexinfo;
+    unary.srcs.push_back(operand);
+    fn->append(unary);
+    return unary.dest;
 }
 
-void generate_binary_op(FILE *out, astree *node, int depth) {
-    astree *right_operand = node->children[1];
-    astree *left_operand = node->children[0];
-    fprintf(out, "%schar b%zu = %s %s %s;\n",
-            string((depth + 1) * 3, ' ').c_str(),
-            register_counter++,
-            mangle(left_operand, *left_operand->lexinfo).c_str(),
-            (*node->lexinfo).c_str(),
-            mangle(right_operand, *right_operand->lexinfo).c_str());
+// Comparisons give a "b" register and arithmetic an "i" register.
+oil_operand generate_binary(oil_function *fn, astree *node, int depth,
+                            bool comparison) {
+    oil_operand left = generate_operand(fn, node->children[0], depth);
+    oil_operand right = generate_operand(fn, node->children[1], depth);
+    oil_instr binary(OIL_BINARY, depth);
+    binary.type = comparison ? "char" : "int";
+    binary.dest = oil_reg(comparison ? "b" : "i", register_counter++);
+    binary.op = *node->lexinfo;
+    binary.srcs.push_back(left);
+    binary.srcs.push_back(right);
+    fn->append(binary);
+    return binary.dest;
 }
 
-void generate_expression(FILE *out, astree *node, int depth) {
-    astree *child1 = node->children[0];
-    switch (child1->symbol) {
-        case TOK_CALL:
-            generate_call(out, child1, depth);
-            break;
+// Operand holding the value of an expression.  Anything but a name
+// or a constant is computed into a register of its own first.
+oil_operand generate_operand(oil_function *fn, astree *node, int depth) {
+    switch (node->symbol) {
         case TOK_IDENT:
-            fprintf(out, "%s %s ",
-                    mangle(child1, *child1->lexinfo).c_str(),
-                    (*node->lexinfo).c_str());
-            break;
         case TOK_INTCON:
         case TOK_CHARCON:
         case TOK_STRINGCON:
-            fprintf(out, "%s %s ",
-                    (*child1->lexinfo).c_str(),
-                    (*node->lexinfo).c_str());
-            break;
+        case TOK_NULL:
+            return mangled(node);
+        case TOK_CALL: {
+            oil_instr call = generate_call(fn, node, depth);
+            call.type = return_types[call.op];
+            if (call.type.empty() || call.type == "void") {
+                return generate_unknown(fn, node, depth);
+            }
+            call.dest = oil_reg(register_family(call.type),
+                                register_counter++);
+            fn->append(call);
+            return call.dest;
+        }
+        case TOK_NEW:
+        case TOK_NEWSTRING:
+        case TOK_NEWARRAY:
+            return generate_new(fn, node, depth);
+        case TOK_POS:
+        case TOK_NEG:
+        case '!':
+            return generate_unary(fn, node, depth);
         case '+':
         case '-':
-            if (child1->children.size() == 1) {
-                fprintf(out, "%s%s",
-                        (*child1->lexinfo).c_str(),
-                        (*child1->children[0]->lexinfo).c_str());
-                break;
-            }
-        case '/':
         case '*':
-            generate_expression(out, child1, depth);
-            fprintf(out, "%s ",
-                    (*child1->lexinfo).c_str());
-            break;
+        case '/':
+        case '%':
+            return generate_binary(fn, node, depth, false);
+        case TOK_EQ:
+        case TOK_NE:
+        case TOK_LT:
+        case TOK_LE:
+        case TOK_GT:
+        case TOK_GE:
+            return generate_binary(fn, node, depth, true);
         default:
-            break;
+            return generate_unknown(fn, node, depth);
     }
+}
 
-    astree *child2 = node->children[1];
-    switch (child2->symbol) {
-        case TOK_CALL:
-            generate_call(out, child2, depth);
-            fprintf(out, " ");
-            break;
-        case TOK_IDENT:
-            fprintf(out, "%s",
-                    mangle(child2, *child2->lexinfo).c_str());
-            break;
-        case TOK_INTCON:
-        case TOK_CHARCON:
-        case TOK_STRINGCON:
-            fprintf(out, "%s ",
-                    (*child2->lexinfo).c_str());
-            break;
-        default:
-            break;
+void generate_return(oil_function *fn, astree *node, int depth) {
+    oil_instr ret(OIL_RETURN, depth);
+    if (node->symbol == TOK_RETURN) {
+        ret.srcs.push_back(generate_operand(fn, node->children[0], depth));
     }
+    fn->append(ret);
 }
 
-void generate_assignment(FILE *out, astree *node, int depth) {
+// A declaration names its DECLID, which comes after the element type
+// of an array.  Fields and elements are not lowered yet.
+void generate_assignment(oil_function *fn, astree *node, int depth) {
     astree *left = node->children[0];
-    astree *right = node->children[1];
-    if (left->symbol != TOK_IDENT) {
-        switch (right->symbol) {
-            case TOK_NEWSTRING:
-            case TOK_NEW:
-                generate_new(out, right);
-                fprintf(out, "%s %s = p%zu;\n",
-                        update_type(left, left->lexinfo).c_str(),
-                        (*left->children[0]->lexinfo).c_str(),
-                        register_counter - 1);
-                break;
-            case TOK_NEWARRAY:
-                generate_new(out, right);
-                fprintf(out, "%s* %s = p%zu;\n",
-                        update_type(left->children[0],
-                                    left->children[0]->lexinfo).c_str(),
-                        (*left->children[1]->lexinfo).c_str(),
-                        register_counter - 1);
-                break;
-
-            case TOK_IDENT:
-                fprintf(out, "%s%s %s = %s;\n",
-                        string(depth * 3, ' ').c_str(),
-                        update_type(left, left->lexinfo).c_str(),
-                        mangle(left->children[0],
-                               *left->children[0]->lexinfo).c_str(),
-                        mangle(right, *right->lexinfo).c_str());
-                break;
-            case TOK_CHR:
-                fprintf(out, "%s%s %s = %s (%s);\n",
-                        string(depth * 3, ' ').c_str(),
-                        update_type(left, left->lexinfo).c_str(),
-                        mangle(left->children[0],
-                               *left->children[0]->lexinfo).c_str(),
-                        mangle(right, *right->lexinfo).c_str(),
-                        mangle(right->children[0],
-                               *right->children[0]->lexinfo).c_str());
-                break;
-            case TOK_INTCON:
-            case TOK_CHARCON:
-            case TOK_STRINGCON:
-            case TOK_NULL:
-                fprintf(out, "%s%s %s = %s;\n",
-                        string(depth * 3, ' ').c_str(),
-                        update_type(left, left->lexinfo).c_str(),
-                        mangle(left->children[0],
-                               *left->children[0]->lexinfo).c_str(),
-                        (*right->lexinfo).c_str());
-                break;
-            case '+':
-            case '-':
-                if (right->children.size() == 1) {
-                    fprintf(out, "%s%s %s = %s%s;\n",
-                            string(depth * 3, ' ').c_str(),
-                            update_type(left, left->lexinfo).c_str(),
-                            mangle(left, *left->lexinfo).c_str(),
-                            (*right->lexinfo).c_str(),
-                            mangle(right->children[0],
-                                   *right->children[0]->
-                                           lexinfo).c_str());
-                    break;
-                }
-            case '/':
-            case '*':
-                fprintf(out, "%s%s %s%zu =",
-                        string(depth * 3, ' ').c_str(),
-                        update_type(left, left->lexinfo).c_str(),
-                        get_register_prefix(*left->lexinfo).c_str(),
-                        register_counter++);
-                generate_expression(out, right, depth);
-                fprintf(out, ";\n");
-
-                fprintf(out, "%s%s %s = %s%zu;\n",
-                        string(depth * 3, ' ').c_str(),
-                        update_type(left, left->lexinfo).c_str(),
-                        mangle(left->children[0],
-                               *left->children[0]->lexinfo).c_str(),
-                        get_register_prefix(*left->lexinfo).c_str(),
-                        register_counter - 1);
-                break;
-            case '!':
-                fprintf(out, "%s%s %s = !%s;\n",
-                        string(depth * 3, ' ').c_str(),
-                        update_type(left, left->lexinfo).c_str(),
-                        mangle(left->children[0],
-                               *left->children[0]->lexinfo).c_str(),
-                        mangle(right->children[0],
-                               *right->children[0]->lexinfo).c_str());
-                break;
-            default:
-                fprintf(out, "%s%s %s%zu = ",
-                        string(depth * 3, ' ').c_str(),
-                        update_type(left, left->lexinfo).c_str(),
-                        get_register_prefix(*left->lexinfo).c_str(),
-                        register_counter++);
-
-                generate_call(out, right, depth);
-                fprintf(out, ";\n");
-
-                fprintf(out, "%s%s %s = %s%zu;\n",
-                        string(depth * 3, ' ').c_str(),
-                        update_type(left, left->lexinfo).c_str(),
-                        mangle(left->children[0],
-                               *left->children[0]->lexinfo).c_str(),
-                        get_register_prefix(*left->lexinfo).c_str(),
-                        register_counter - 1);
-                break;
+    oil_instr assign(OIL_MOVE, depth);
+    if (node->symbol == TOK_VARDECL) {
+        astree *declid = left->children.back();
+        assign.dest = mangled(declid);
+        // lower_oil() declares globals; __ocmain only assigns them.
+        if (declid->declaration == nullptr
+            || declid->declaration->blocknr != 0) {
+            assign.type = update_type(left, left->lexinfo);
         }
+    } else if (left->symbol == TOK_IDENT) {
+        assign.dest = mangled(left);
     } else {
-        switch (right->symbol) {
-            case TOK_NEWSTRING:
-            case TOK_NEW:
-                generate_new(out, right);
-                fprintf(out, "%s = p%zu;\n",
-                        (*left->lexinfo).c_str(),
-                        register_counter - 1);
-                break;
-            case TOK_NEWARRAY:
-                generate_new(out, right);
-                fprintf(out, "%s = p%zu;\n",
-                        (*left->lexinfo).c_str(),
-                        register_counter - 1);
-                break;
-            case TOK_IDENT:
-                fprintf(out, "%s%s = %s;\n",
-                        string(depth * 3, ' ').c_str(),
-                        mangle(left, *left->lexinfo).c_str(),
-                        mangle(right, *right->lexinfo).c_str());
-                break;
-            case TOK_CHR:
-                fprintf(out, "%s%s = %s (%s);\n",
-                        string(depth * 3, ' ').c_str(),
-                        mangle(left, *left->lexinfo).c_str(),
-                        mangle(right, *right->lexinfo).c_str(),
-                        mangle(right->children[0],
-                               *right->children[0]->lexinfo).c_str());
-                break;
-            case TOK_INTCON:
-            case TOK_CHARCON:
-            case TOK_STRINGCON:
-            case TOK_NULL:
-                fprintf(out, "%s%s = %s;\n",
-                        string(depth * 3, ' ').c_str(),
-                        mangle(left, *left->lexinfo).c_str(),
-                        (*right->lexinfo).c_str());
-                break;
-            case '+':
-            case '-':
-                if (right->children.size() == 1) {
-
-                    fprintf(out, "%s%s = %s%s;\n",
-                            string(depth * 3, ' ').c_str(),
-                            mangle(left, *left->lexinfo).c_str(),
-                            (*right->lexinfo).c_str(),
-                            mangle(right->children[0],
-                                   *right->children[0]
-                                           ->lexinfo).c_str());
-                    break;
-                }
-            case '/':
-            case '*':
-                fprintf(out, "%sint %s%zu = ",
-                        string(depth * 3, ' ').c_str(),
-                        get_register_prefix(*left->lexinfo).c_str(),
-                        register_counter-1);
-//                register_counter--;
-                generate_expression(out, right, depth);
-                fprintf(out, ";\n");
-                fprintf(out, "%s%s = %s%zu;\n",
-                        string(depth * 3, ' ').c_str(),
-                        mangle(left, *left->lexinfo).c_str(),
-                        get_register_prefix(*left->lexinfo).c_str(),
-                        register_counter - 1);
-                break;
-            case '!':
-                fprintf(out, "%s%s = %s%s;\n",
-                        string(depth * 3, ' ').c_str(),
-                        mangle(left, *left->lexinfo).c_str(),
-                        (*right->lexinfo).c_str(),
-                        mangle(right->children[0],
-                               *right->children[0]->lexinfo).c_str());
-                break;
-            default:
-                fprintf(out, "%s%s %s%zu = ",
-                        string(depth * 3, ' ').c_str(),
-                        (*left->lexinfo).c_str(),
-                        get_register_prefix(*left->lexinfo).c_str(),
-                        register_counter++);
-
-                generate_call(out, right, depth);
-                fprintf(out, ";\n");
-
-                fprintf(out, "%s%s = %s%zu;\n",
-                        string(depth * 3, ' ').c_str(),
-                        mangle(left, *left->lexinfo).c_str(),
-                        get_register_prefix(*left->lexinfo).c_str(),
-                        register_counter - 1);
-                break;
-        }
+        generate_unknown(fn, node, depth);
+        return;
     }
+    assign.srcs.push_back(generate_operand(fn, node->children[1], depth));
+    fn->append(assign);
 }
 
-void generate_conditional(FILE *out, astree *node, int depth) {
-    if (node->children.size() == 2) {
-        generate_binary_op(out, node, depth);
-    } else if (node->children.size() == 1) {
-        generate_unary_op(out, node, depth);
-    } else {
-        fprintf(out, "char b%zu = %s;\n",
-                register_counter++,
-                mangle(node, *node->lexinfo).c_str());
+void generate_if(oil_function *fn, astree *node, int depth) {
+    oil_operand cond = generate_operand(fn, node->children[0], depth);
+    bool has_else = node->symbol == TOK_IFELSE;
+    oil_instr skip(OIL_BRANCH, depth);
+    skip.op = label_name(has_else ? "else" : "fi", node);
+    skip.site = location_key(node->lloc);
+    skip.srcs.push_back(cond);
+    fn->append(skip);
+    generate_oil_rec(fn, node->children[1], depth + 1, nullptr);
+
+    oil_instr fi(OIL_LABEL);
+    fi.op = label_name("fi", node);
+    if (has_else) {
+        oil_instr over(OIL_GOTO, depth + 1);
+        over.op = fi.op;
+        fn->append(over);
+        oil_instr otherwise(OIL_LABEL);
+        otherwise.op = skip.op;
+        fn->append(otherwise);
+        generate_oil_rec(fn, node->children[2], depth + 1, nullptr);
     }
+    fn->append(fi);
 }
 
-void generate_while(FILE *out, astree *node, int depth) {
-    fprintf(out, "%s\n",
-            mangle(node, *node->lexinfo).c_str());
-    generate_conditional(out, node->children[0], depth);
-
-    fprintf(out, "%sif (!b%zu) goto break_%s_%s_%s;\n",
-            string((depth+1) * 3, ' ').c_str(),
-            register_counter - 1,
-            to_string(node->lloc.filenr).c_str(),
-            to_string(node->lloc.linenr).c_str(),
-            to_string(node->lloc.offset).c_str());
-
-    generate_oil_rec(out, node->children[1], depth, node);
-
-    fprintf(out, "%sgoto %s\n",
-            string((depth+1) * 3, ' ').c_str(),
-            mangle(node, *node->lexinfo).c_str());
-    fprintf(out, "break_%s_%s_%s:\n",
-            to_string(node->lloc.filenr).c_str(),
-            to_string(node->lloc.linenr).c_str(),
-            to_string(node->lloc.offset).c_str());
+void generate_while(oil_function *fn, astree *node, int depth) {
+    oil_instr head(OIL_LABEL);
+    head.op = label_name(*node->lexinfo, node);
+    fn->append(head);
+    oil_operand cond = generate_operand(fn, node->children[0], depth);
+
+    oil_instr exit(OIL_BRANCH, depth);
+    exit.op = label_name("break", node);
+    exit.site = location_key(node->lloc);
+    exit.srcs.push_back(cond);
+    fn->append(exit);
+
+    generate_oil_rec(fn, node->children[1], depth + 1, node);
+
+    oil_instr loop(OIL_GOTO, depth + 1);
+    loop.op = head.op;
+    fn->append(loop);
+
+    oil_instr done(OIL_LABEL);
+    done.op = exit.op;
+    fn->append(done);
 }
 
 // Utility
+void append_number(string &text, size_t value) {
+    char digits[24];
+    size_t length = 0;
+    do {
+        digits[length++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    while (length > 0) {
+        text += digits[--length];
+    }
+}
+
 string mangle(astree *node, const string &original) {
     string mangled;
+    mangled.reserve(original.size() + 16);
     int sym = node->symbol;
 
     if (node->blocknr != 0) {
         switch (sym) {
             case TOK_FUNCTION:
-                mangled = "__" + original;
-                break;
-            case TOK_INTCON:
-                mangled = original;
-                break;
-            case TOK_WHILE:
-            case TOK_IF:
-            case TOK_IFELSE:
-                mangled = original + "_"
-                          + to_string(node->lloc.filenr) + "_"
-                          + to_string(node->lloc.linenr) + "_"
-                          + to_string(node->lloc.offset) + ":;";
+                mangled += "__";
+                mangled += original;
                 break;
             default:
-                mangled = "_" +
-                          to_string(node->blocknr)
-                          + "_" + *node->lexinfo;
+                mangled += '_';
+                append_number(mangled, node->blocknr);
+                mangled += '_';
+                mangled += *node->lexinfo;
         }
     } else {
         switch (sym) {
             case TOK_DECLID:
-                mangled = "_"
-                          + to_string(node->blocknr)
-                          + "_" + *node->lexinfo;
+                mangled += '_';
+                append_number(mangled, node->blocknr);
+                mangled += '_';
+                mangled += *node->lexinfo;
                 break;
             case TOK_TYPEID:
-                mangled = "f_" + *node->lexinfo
-                          + "_" + original;
+                mangled += "f_";
+                mangled += *node->lexinfo;
+                mangled += '_';
+                mangled += original;
                 break;
             case TOK_STRUCT:
-                mangled = "s_" + original;
-                break;
-            case TOK_WHILE:
-            case TOK_IF:
-            case TOK_IFELSE:
-                mangled = original + "_"
-                          + to_string(node->lloc.filenr) + "_"
-                          + to_string(node->lloc.linenr) + "_"
-                          + to_string(node->lloc.offset) + ":;";
+                mangled += "s_";
+                mangled += original;
                 break;
             default:
-                mangled = "__" + original;
+                mangled += "__";
+                mangled += original;
                 break;
         }
     }
     return mangled;
 }
 
+// Name of what sym declares, built the first time the writer needs
+// it and shared by the declaration and every use: "__name" for
+// globals and functions, "_block_name" for locals.
+const string &declared_name(symbol *sym, const string &name) {
+    if (sym->oil_name.empty()) {
+        if (sym->blocknr == 0 || sym->attributes[ATTR_function]) {
+            sym->oil_name = "__" + name;
+        } else {
+            sym->oil_name = "_";
+            append_number(sym->oil_name, sym->blocknr);
+            sym->oil_name += '_';
+            sym->oil_name += name;
+        }
+    }
+    return sym->oil_name;
+}
+
+bool is_constant(astree *node) ;
+const string &constant_text(astree *node) ;
+
+// A constant's own text, or the name of the node's declaration.
+// Nodes the type checker left unresolved fall back to mangle().
+string mangled_name(astree *node) {
+    if (is_constant(node)) return constant_text(node);
+    if (node->declaration != nullptr) {
+        return declared_name(node->declaration, *node->lexinfo);
+    }
+    return mangle(node, *node->lexinfo);
+}
+
 string update_type(astree *node, const string *structure) {
+    if (node->symbol == TOK_ARRAY) {
+        astree *element = node->children[0];
+        return update_type(element, element->lexinfo) + "*";
+    }
     string original = *node->lexinfo;
     string updated = "";
-    if (original == "int") {
+    if (original == "void") {
+        updated = "void";
+    } else if (original == "int") {
         updated = "int";
     } else if (original == "char") {
         updated = "char";
@@ -526,108 +397,149 @@ string update_type(astree *node, const string *structure) {
         if (structure == nullptr) {
             return "Error" + original;
         } else {
-            astree *temp = new astree(
-                    TOK_STRUCT, {0, 0, 0}, structure->c_str());
-            updated = "struct " + mangle(temp, original) + "*";
+            updated = "struct s_" + original + "*";
         }
     }
     return updated;
 }
 
-string get_register_prefix(const string &type) {
-    if (type == "char") {
-        return "c";
-    } else if (type == "int") {
-        return "i";
-    } else if (type == "string") {
-        return "type";
-    } else {
-        return "i";
+bool is_constant(astree *node) {
+    switch (node->symbol) {
+        case TOK_INTCON:
+        case TOK_CHARCON:
+        case TOK_STRINGCON:
+        case TOK_NULL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// C text of a constant; null is a null pointer.
+const string &constant_text(astree *node) {
+    static const string null_pointer = "0";
+    if (node->symbol == TOK_NULL) return null_pointer;
+    return *node->lexinfo;
+}
+
+// Operand naming the node as mangled_name() does.
+oil_operand mangled(astree *node) {
+    if (is_constant(node)) return oil_const(constant_text(node));
+    return oil_var(mangled_name(node));
+}
+
+// Operand printed as the node's own text.
+oil_operand literal(astree *node) {
+    if (is_constant(node)) {
+        return oil_const(constant_text(node));
     }
+    return oil_var(*node->lexinfo);
+}
+
+// Statements are numbered as they are lowered.
+string label_name(const string &prefix, astree *node) {
+    if (node->label == 0) {
+        node->label = ++label_counter;
+    }
+    string label;
+    label.reserve(prefix.size() + 8);
+    label += prefix;
+    label += '_';
+    append_number(label, node->label);
+    return label;
 }
 
 // Main Recursive Function
-void generate_oil_rec(FILE *out, astree *node,
+void generate_oil_rec(oil_function *fn, astree *node,
                       int depth, astree *extra) {
     switch (node->symbol) {
         case TOK_IF:
-            generate_conditional(out, node->children[0], depth);
-            fprintf(out, "%sif (!b%zu) %s%s_%s_%s;\n",
-                    string((depth+1) * 3, ' ').c_str(),
-                    register_counter - 1, "goto fi_",
-                    to_string(node->lloc.filenr).c_str(),
-                    to_string(node->lloc.linenr).c_str(),
-                    to_string(node->lloc.offset).c_str());
-            generate_oil_rec(out, node->children[1], depth, extra);
-            fprintf(out, "fi_%s_%s_%s:;\n",
-                    to_string(node->lloc.filenr).c_str(),
-                    to_string(node->lloc.linenr).c_str(),
-                    to_string(node->lloc.offset).c_str());
+        case TOK_IFELSE:
+            generate_if(fn, node, depth);
             break;
         case TOK_BLOCK:
             for (astree *child: node->children) {
-                generate_oil_rec(out, child, depth + 1, extra);
+                generate_oil_rec(fn, child, depth, extra);
             }
             break;
-        case TOK_CALL:
-            generate_call(out, node, depth);
-            fprintf(out, ";\n");
+        case TOK_CALL: {
+            oil_instr call = generate_call(fn, node, depth);
+            fn->append(call);
             break;
+        }
         case TOK_WHILE:
-            generate_while(out, node, 0);
+            generate_while(fn, node, depth);
             break;
         case TOK_RETURN:
-            generate_return(out, node, depth);
+        case TOK_RETURNVOID:
+            generate_return(fn, node, depth);
             break;
         case TOK_PROTOTYPE:
+        case ';':
             break;
         case '=':
         case TOK_VARDECL:
-            generate_assignment(out, node, depth);
+            generate_assignment(fn, node, depth);
             break;
         default:
-            fprintf(out, "%s%s\n",
-                    string(depth * 3, ' ').c_str(),
-                    parser::get_tname(node->symbol));
+            generate_operand(fn, node, depth);
             break;
     }
 }
 
-// Main Function
-void generate_oil(astree *root, FILE *out, int depth) {
+// Lowering
+void lower_oil(oil_module *module, astree *root, int depth) {
     for (astree *child: root->children) {
         if (child->symbol == TOK_STRUCT)
-            generate_structure(out, child, depth);
+            generate_structure(module, child, depth);
     }
 
     for (astree *child: root->children) {
-        generate_string(out, child, depth);
+        generate_string(module, child);
     }
 
     for (astree *child: root->children) {
         if (child->symbol == TOK_VARDECL) {
             astree *type = child->children[0];
-            astree *declid = type->children[0];
-            if (declid->symbol == TOK_DECLID
-                && type->symbol != TOK_STRING) {
-                fprintf(out, "%s %s;\n",
-                        update_type(type, nullptr).c_str(),
-                        mangle(type, *declid->lexinfo).c_str());
+            astree *declid = type->children.back();
+            if (type->symbol != TOK_STRING
+                || child->children[1]->symbol != TOK_STRINGCON) {
+                module->globals.push_back({
+                        update_type(type, type->lexinfo),
+                        mangled_name(declid)});
             }
         }
     }
 
+    for (astree *child: root->children) {
+        if (child->symbol == TOK_FUNCTION
+            || child->symbol == TOK_PROTOTYPE) {
+            astree *type = child->children[0];
+            astree *name = type->children.back();
+            name->symbol = TOK_FUNCTION;
+            return_types[mangled_name(name)] =
+                    update_type(type, type->lexinfo);
+        }
+    }
+
     for (astree *child: root->children) {
         if (child->symbol == TOK_FUNCTION) {
-            generate_function(out, child, depth);
+            generate_function(module, child, depth);
         }
     }
 
-    fprintf(out, "void __ocmain (void)\n{\n");
+    module->main.type = "void";
+    module->main.name = "__ocmain";
     for (astree *child: root->children) {
         if (child->symbol != TOK_FUNCTION
             && child->symbol != TOK_STRUCT)
-            generate_oil_rec(out, child, 1, nullptr);
+            generate_oil_rec(&module->main, child, 1, nullptr);
     }
-    fprintf(out, "}\nend\n");
+}
+
+// Main Function
+void generate_oil(astree *root, FILE *out, int depth) {
+    oil_module module;
+    lower_oil(&module, root, depth);
+    emit_oil(out, module);
 }
@@ -8,9 +8,11 @@
 #include <vector>
 
 #include "lyutils.h"
+#include "oil_ir.h"
 
 using namespace std;
 
+void lower_oil(oil_module *module, astree *root, int depth);
 void generate_oil(astree *root, FILE *out, int depth);
 
 #endif
@@ -0,0 +1,54 @@
+// Typechecks one program over and over, releasing its symbols each
+// time as oc does at the end of a compilation, and fails if peak RSS
+// is still growing after the first tenth of the runs.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/resource.h>
+
+using namespace std;
+
+#include "lyutils.h"
+#include "symbol_table.h"
+
+const string CPP = "/usr/bin/cpp -nostdinc";
+extern FILE* yyin;
+extern FILE* yyout;
+
+long peak_rss() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s program.oc count\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    long count = atol(argv[2]);
+    string command = CPP + " " + argv[1];
+    yyin = popen(command.c_str(), "r");
+    yyout = fopen("/dev/null", "w");
+    if (yyin == nullptr || yyout == nullptr) {
+        syserrprintf(argv[1]);
+        return EXIT_FAILURE;
+    }
+    while (yyparse() != YYEOF) {
+    }
+    if (pclose(yyin) != 0 || exec::exit_status != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    long warm = 0;
+    for (long i = 1; i <= count; i++) {
+        typecheck(yyout, parser::root);
+        typecheck_release();
+        if (i == count / 10) warm = peak_rss();
+    }
+    long peak = peak_rss();
+    printf("%s: peak RSS %ld KB after %ld runs, %ld KB after %ld\n",
+           argv[1], warm, count / 10, peak, count);
+    return peak > warm + warm / 20 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
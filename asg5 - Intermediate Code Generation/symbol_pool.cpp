@@ -0,0 +1,26 @@
+#include "symbol_pool.h"
+
+symbol_pool sym_pool;
+
+symbol *symbol_pool::make_symbol() {
+    return symbols.make();
+}
+
+string *symbol_pool::make_string() {
+    return strings.make();
+}
+
+vector<symbol *> *symbol_pool::make_parameters() {
+    return parameters.make();
+}
+
+symbol_table *symbol_pool::make_table() {
+    return tables.make();
+}
+
+void symbol_pool::release() {
+    tables.release();
+    parameters.release();
+    strings.release();
+    symbols.release();
+}
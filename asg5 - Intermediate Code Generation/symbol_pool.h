@@ -0,0 +1,78 @@
+#ifndef __SYMBOL_POOL_H__
+#define __SYMBOL_POOL_H__
+
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include "symbol_table.h"
+
+// Fixed-size chunks of objects handed out in order.  release()
+// destroys everything made since the last release but keeps the
+// chunks, so a process that checks many files in turn stays at the
+// footprint of the largest one.
+template <typename T>
+class object_pool {
+public:
+    object_pool() : used(0) {
+    }
+
+    ~object_pool() {
+        release();
+        for (T *chunk : chunks) {
+            ::operator delete(chunk);
+        }
+    }
+
+    object_pool(const object_pool &) = delete;
+    object_pool &operator=(const object_pool &) = delete;
+
+    T *make() {
+        if (used == chunks.size() * chunk_size) {
+            chunks.push_back(static_cast<T *>(
+                    ::operator new(chunk_size * sizeof(T))));
+        }
+        T *slot = chunks[used / chunk_size] + used % chunk_size;
+        new (slot) T();
+        used++;
+        return slot;
+    }
+
+    void release() {
+        while (used > 0) {
+            used--;
+            chunks[used / chunk_size][used % chunk_size].~T();
+        }
+    }
+
+    size_t size() const {
+        return used;
+    }
+
+private:
+    static constexpr size_t chunk_size = 256;
+    vector<T *> chunks;
+    size_t used;
+};
+
+// Owner of every object the type checker allocates for one
+// compilation unit.
+struct symbol_pool {
+    symbol *make_symbol();
+    string *make_string();
+    vector<symbol *> *make_parameters();
+    symbol_table *make_table();
+    void release();
+
+private:
+    object_pool<symbol> symbols;
+    object_pool<string> strings;
+    object_pool<vector<symbol *>> parameters;
+    object_pool<symbol_table> tables;
+};
+
+extern symbol_pool sym_pool;
+
+#endif
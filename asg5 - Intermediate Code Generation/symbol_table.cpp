@@ -1,14 +1,17 @@
 #include <unordered_map>
 #include <vector>
 #include <bitset>
-#include <cstring>
 #include <stack>
+#include <ctime>
 
 using namespace std;
 
 #include "symbol_table.h"
+#include "buffered_writer.h"
+#include "typecheck_cache.h"
+#include "symbol_pool.h"
 
-FILE* sym_file;
+buffered_writer sym_out;
 
 int block_count = 0;
 int blocknr = 0;
@@ -18,73 +21,60 @@ symbol_table global_table;
 vector<symbol_table*> symbol_stack;
 stack<int> scope_stack;
 vector<astree *> *string_stack;
+unordered_map<astree *, size_t> block_roots;
 
 void typecheck_rec(astree *node);
 void typecheck_var_children(astree *node) ;
 void typecheck_var(astree *node) ;
+void typecheck_assignment(astree *node) ;
+void typecheck_unary_operation(astree *node) ;
+void typecheck_binary_operation(astree *node) ;
 //void notify_error(const char* message,
 //                  const string* printout, location lloc) ;
 
-string get_attributes(symbol* sym) {
-    string attributes;
-    if(sym->attributes[ATTR_void]){
-        attributes += "void ";
-    }
-    if(sym->attributes[ATTR_int]){
-        attributes += "int ";
-    }
-    if(sym->attributes[ATTR_string]){
-        attributes += "string ";
-    }
-    if(sym->attributes[ATTR_struct]){
-        attributes += "struct \"";
-        attributes += *sym->parent_struct;
-        attributes += "\" ";
-    }
-    if(sym->attributes[ATTR_typeid]){
-        attributes += "typeid ";
-    }
-    if(sym->attributes[ATTR_null]){
-        attributes += "null ";
-    }
-    if(sym->attributes[ATTR_array]){
-        attributes += "[] ";
-    }
-    if(sym->attributes[ATTR_field]){
-        attributes += "field ";
-    }
-    if(sym->attributes[ATTR_variable]){
-        attributes += "variable ";
-    }
-    if(sym->attributes[ATTR_function]){
-        attributes += "function ";
-    }
-    if(sym->attributes[ATTR_lval]){
-        attributes += "lval ";
-    }
-    if(sym->attributes[ATTR_param]){
-        attributes += "param ";
-    }
-    if(sym->attributes[ATTR_const]){
-        attributes += "const ";
-    }
-    if(sym->attributes[ATTR_vreg]){
-        attributes += "vreg ";
+// Attribute names in the order they appear in a .sym entry.
+static const struct {
+    size_t attr;
+    const char *name;
+} attr_names[] = {
+    {ATTR_void, "void"},         {ATTR_int, "int"},
+    {ATTR_string, "string"},     {ATTR_struct, "struct"},
+    {ATTR_typeid, "typeid"},     {ATTR_null, "null"},
+    {ATTR_array, "[]"},          {ATTR_field, "field"},
+    {ATTR_variable, "variable"}, {ATTR_function, "function"},
+    {ATTR_lval, "lval"},         {ATTR_param, "param"},
+    {ATTR_const, "const"},       {ATTR_vreg, "vreg"},
+    {ATTR_vaddr, "vaddr"},
+};
+constexpr size_t attr_name_count = sizeof attr_names / sizeof *attr_names;
+
+size_t collect_attributes(symbol *sym, size_t *found) {
+    size_t count = 0;
+    for (size_t i = 0; i < attr_name_count; i++) {
+        if (sym->attributes[attr_names[i].attr]) {
+            found[count++] = i;
+        }
     }
-    if(sym->attributes[ATTR_vaddr]){
-        attributes += "vaddr ";
+    return count;
+}
+
+void put_attribute(symbol *sym, size_t index) {
+    sym_out.put(attr_names[index].name);
+    if (attr_names[index].attr == ATTR_struct) {
+        sym_out.put(" \"");
+        sym_out.put(*sym->parent_struct);
+        sym_out.put('"');
     }
-    return attributes;
 }
 
 symbol* new_sym(astree *node){
-    auto* sym = new symbol();
+    auto* sym = sym_pool.make_symbol();
 
     sym->filenr = node->lloc.filenr;
     sym->linenr = node->lloc.linenr;
     sym->offset = node->lloc.offset;
 
-    sym->parent_struct = new string();
+    sym->parent_struct = sym_pool.make_string();
     sym->blocknr = static_cast<size_t>(blocknr);
     sym->fields = nullptr;
     sym->parameters = nullptr;
@@ -92,12 +82,19 @@ symbol* new_sym(astree *node){
 }
 
 void push_stack(){
-    auto* table = new symbol_table();
+    auto* table = sym_pool.make_table();
     symbol_stack.push_back(table);
+    if (active_cache) active_cache->record_push();
+}
+
+void push_string(astree *node) {
+    string_stack->push_back(node);
+    if (active_cache) active_cache->record_string(node);
 }
 
 void pop_stack(){
     symbol_stack.pop_back();
+    if (active_cache) active_cache->record_pop();
 }
 
 void push_scope() {
@@ -148,7 +145,7 @@ void set_type(astree *node, symbol *sym,
             set_attribute(sym, node, ATTR_int);
             break;
         case TOK_STRING:
-//            string_stack->push_back(node);
+//            push_string(node);
             set_attribute(sym, node, ATTR_string);
             break;
         case TOK_TYPEID:
@@ -161,30 +158,54 @@ void set_type(astree *node, symbol *sym,
 
 void add_global_table(string *lex, symbol *sym) {
     global_table.insert({lex, sym});
+    if (active_cache) active_cache->record_insert(0, lex, sym);
 }
 
 void add_struct_table(string *lex, symbol *sym) {
     symbol_stack.back()->insert({lex, sym});
+    if (active_cache) {
+        active_cache->record_insert(symbol_stack.size() - 1, lex, sym);
+    }
 }
 
 // Semantic Utility Functions
+// A scope only records where it starts; assign_blocknrs() later gives
+// every node the number of the innermost scope around it in one walk
+// instead of restamping the whole subtree at each nesting level.
 void set_blocknr(astree *node) {
-    for(auto child : node->children) {
-        set_blocknr(child);
+    block_roots[node] = static_cast<size_t>(blocknr);
+}
+
+// Returns how many nodes it visited, which is the size of the tree.
+size_t stamp_blocknr(astree *node, bool scoped, size_t number) {
+    auto root = block_roots.find(node);
+    if (root != block_roots.end()) {
+        scoped = true;
+        number = root->second;
+    }
+    if (scoped) {
+        node->blocknr = number;
+    }
+    size_t visited = 1;
+    for (auto child : node->children) {
+        visited += stamp_blocknr(child, scoped, number);
+    }
+    return visited;
+}
+
+void assign_blocknrs(astree *node) {
+    if (!block_roots.empty()) {
+        clock_t start = clock();
+        size_t visited = stamp_blocknr(node, false, 0);
+        DEBUGF('b', "block numbers: %zu scopes, %zu nodes, %.3f ms\n",
+               block_roots.size(), visited,
+               1000.0 * (clock() - start) / CLOCKS_PER_SEC);
+        block_roots.clear();
     }
-    node->blocknr = static_cast<size_t>(blocknr);
 }
 
-void set_parent_lloc(astree *node, symbol *sym) {
-    auto * lloc = new string();
-    *lloc += "(";
-    *lloc += std::to_string(sym->filenr);
-    *lloc += ".";
-    *lloc += std::to_string(sym->linenr);
-    *lloc += ".";
-    *lloc += std::to_string(sym->offset);
-    *lloc += ")";
-    node->parent_lloc = lloc;
+void set_declaration(astree *node, symbol *sym) {
+    node->declaration = sym;
 }
 
 symbol* table_lookup(symbol_table *table, astree *node) {
@@ -206,10 +227,12 @@ void notify_error(const char* message,
     exit(1);
 }
 
+// Innermost scope first, so that locals hide globals.
 symbol* stack_lookup(astree* node) {
-    for(auto table : symbol_stack) {
-        if(table && !(table->empty())) {
-            symbol *found = table_lookup(table, node);
+    for(auto table = symbol_stack.rbegin(); table != symbol_stack.rend();
+        ++table) {
+        if(*table && !((*table)->empty())) {
+            symbol *found = table_lookup(*table, node);
             if(found) {
                 return found;
             }
@@ -263,53 +286,86 @@ void bubbleup_type(astree *parent, astree *child) {
 }
 
 // Print
-void print_field(string *lex, symbol *sym, char *type,
-                 string* parent_struct, char* attributes) {
-    fprintf(sym_file, "  %s (%ld.%ld.%ld) %s {%s} %s\n",
-            lex->c_str(), sym->filenr,
-            sym->linenr, sym->offset,
-            type, parent_struct->c_str(), attributes);
+void put_location(symbol *sym) {
+    sym_out.put(" (");
+    sym_out.put_size(sym->filenr);
+    sym_out.put('.');
+    sym_out.put_size(sym->linenr);
+    sym_out.put('.');
+    sym_out.put_size(sym->offset);
+    sym_out.put(')');
+}
+
+// A field line names its last attribute first and the rest after the
+// parent struct; a lone attribute appears in both places.
+void print_field(const string *lex, symbol *sym,
+                 const string *parent_struct) {
+    if (active_cache) active_cache->record_field(lex, sym, parent_struct);
+    size_t found[attr_name_count];
+    size_t count = collect_attributes(sym, found);
+    sym_out.put("  ");
+    sym_out.put(*lex);
+    put_location(sym);
+    sym_out.put(' ');
+    if (count > 0) {
+        put_attribute(sym, found[count - 1]);
+    }
+    sym_out.put(" {");
+    sym_out.put(*parent_struct);
+    sym_out.put("} ");
+    if (count == 1) {
+        put_attribute(sym, found[0]);
+    }
+    for (size_t i = 0; i + 1 < count; i++) {
+        if (i > 0) sym_out.put(' ');
+        put_attribute(sym, found[i]);
+    }
+    sym_out.put('\n');
+}
+
+// Fields are listed in reverse table order.
+void print_fields(const string *parent_struct,
+                  symbol_table::const_iterator field,
+                  symbol_table::const_iterator end) {
+    if (field == end) return;
+    auto next = field;
+    print_fields(parent_struct, ++next, end);
+    print_field(field->first, field->second, parent_struct);
+}
+
+void print_table_entry(symbol* sym, string* lex) {
+    size_t found[attr_name_count];
+    size_t count = collect_attributes(sym, found);
+    sym_out.put(*lex);
+    put_location(sym);
+    sym_out.put(" {");
+    sym_out.put_size(sym->blocknr);
+    sym_out.put("} ");
+    for (size_t i = 0; i < count; i++) {
+        put_attribute(sym, found[i]);
+        sym_out.put(' ');
+    }
+    sym_out.put('\n');
+}
+
+void print_symbol_at(string *lex, symbol *sym, int depth) {
+    if (active_cache) active_cache->record_print(lex, sym, depth);
+    sym_out.put_repeat("  ", depth);
+    print_table_entry(sym, lex);
 }
 
-void print_fields(string *parent_struct, symbol *sym) {
-    vector<string*> lexs;
-    vector<symbol*> syms;
-
-    for (auto field : *sym->fields) {
-        lexs.push_back(field.first);
-        syms.push_back(field.second);
-    }
-
-    for (auto i = static_cast<int>(lexs.size() - 1); i >= 0; i--) {
-        string attr_str = get_attributes(syms[i]);
-        attr_str = attr_str.substr(0, attr_str.length() - 1);
-        auto last_space = attr_str.find_last_of(' ');
-        char *type = strdup(attr_str.substr(last_space + 1).c_str());
-        char *attribs = strdup(attr_str.substr(0, last_space).c_str());
-        print_field(lexs[i], syms[i], type, parent_struct, attribs);
-    }
-
-}
-
-void print_table_entry(symbol* sym, string* lex, char* attributes) {
-    fprintf(sym_file, "%s (%ld.%ld.%ld) {%ld} %s\n",
-            lex->c_str(), sym->filenr,
-            sym->linenr, sym->offset,
-            sym->blocknr, attributes);
+void print_symbol(string *lex, symbol* sym){
+    print_symbol_at(lex, sym, scope_depth);
 }
 
-void print_symbol(string *lex, symbol* sym){
-    for(int i = 0; i < scope_depth; i++){
-        fprintf(sym_file,"  ");
-    }
-    char *attributes = strdup(get_attributes(sym).c_str());
-    print_table_entry(sym, lex, attributes);
+void print_newline() {
+    if (active_cache) active_cache->record_newline();
+    sym_out.put('\n');
 }
 
 void print_struct(string* lex, symbol* sym){
-    char* attributes = strdup(get_attributes(sym).c_str());
-    print_table_entry(sym, lex, attributes);
-    print_fields(lex, sym);
+    print_symbol_at(lex, sym, 0);
+    print_fields(lex, sym->fields->cbegin(), sym->fields->cend());
 }
 
 // Struct
@@ -327,7 +383,7 @@ void set_field_type(astree *node, symbol *symbol,
             set_attribute(symbol, node, ATTR_int);
             break;
         case TOK_STRING:
-            string_stack->push_back(node);
+            push_string(node);
             set_attribute(symbol, node, ATTR_string);
             break;
         case TOK_TYPEID:
@@ -344,7 +400,6 @@ void add_fields(astree *node, symbol_table &fields) {
         for (size_t q = 0; q < child->children.size(); q++) {
             if (child->children[q]->symbol == TOK_FIELD) {
                 symbol *sym = new_sym(child->children[q]);
-                sym->parent_struct = new string();
                 lex = (string *) child->children[q]->lexinfo;
                 set_field_type(child, sym, child->lexinfo);
                 bubbleup_attribs(child->children[0], child);
@@ -368,11 +423,11 @@ string *add_struct(astree *node, symbol *symbol) {
 }
 
 void typecheck_struct(astree *node) {
-    auto *sym = new symbol();
-    sym->parent_struct = new string;
+    auto *sym = sym_pool.make_symbol();
+    sym->parent_struct = sym_pool.make_string();
     set_attribute(sym, node, ATTR_struct, node->children[0]->lexinfo);
     bubbleup_type(node->children[0], node);
-    sym->fields = new symbol_table();
+    sym->fields = sym_pool.make_table();
     add_fields(node, *sym->fields);
     string *lex = add_struct(node, sym);
     if (lex == nullptr) {
@@ -380,6 +435,7 @@ void typecheck_struct(astree *node) {
     } else {
         print_struct(lex, sym);
         struct_table.insert({lex, sym});
+        if (active_cache) active_cache->record_struct(lex, sym);
     }
 }
 
@@ -391,11 +447,14 @@ void populate_param(astree *node, symbol *symbo) {
         if (child1->symbol == TOK_PARAMLIST) {
             string *lex = nullptr;
             for (auto &child2 : child1->children) {
-                lex = (string *) child2->children[0]->lexinfo;
-                symbol *sym = new_sym(child2->children[0]);
+                // An array parameter has its element type first.
+                astree *declid = child2->children.back();
+                lex = (string *) declid->lexinfo;
+                symbol *sym = new_sym(declid);
+                set_declaration(declid, sym);
                 set_attribute(sym, node, ATTR_param);
                 set_type(child2, sym, child2->lexinfo);
-                bubbleup_attribs(child2->children[0], child2);
+                bubbleup_attribs(declid, child2);
                 print_symbol(lex, sym);
                 symbo->parameters->push_back(sym);
                 add_struct_table(lex, sym);
@@ -410,12 +469,12 @@ void populate_param(astree *node, symbol *symbo) {
         scope_stack.pop();
         block_count--;
     }
-    fprintf(sym_file, "\n");
+    print_newline();
 }
 
 string* populate_function_sym(symbol* sym, astree* node){
     string* lex = nullptr;
-    sym->parameters = new vector<symbol*>;
+    sym->parameters = sym_pool.make_parameters();
     for (auto &child : node->children){
         if(child->symbol == TOK_DECLID){
             lex = (string*) child->lexinfo;
@@ -435,9 +494,11 @@ void add_new_function(astree* node, symbol **sym,
     *lex = populate_function_sym(*sym, node->children[i]);
 }
 
+// Parameters get a table of their own, below the body's.
 void typecheck_function(astree *node) {
     symbol *sym = nullptr;
     string *lex = nullptr;
+    push_stack();
     for (size_t i = 0; i < node->children.size(); i++) {
         switch (node->children[i]->symbol) {
             case TOK_VOID:
@@ -450,7 +511,7 @@ void typecheck_function(astree *node) {
                 add_new_function(node, &sym, &lex, ATTR_int, i);
                 break;
             case TOK_STRING:
-                string_stack->push_back(node);
+                push_string(node);
                 add_new_function(node, &sym, &lex, ATTR_string, i);
                 break;
             case TOK_TYPEID:
@@ -472,6 +533,7 @@ void typecheck_function(astree *node) {
                 break;
         }
     }
+    pop_stack();
     add_global_table(lex, sym);
 }
 
@@ -500,8 +562,8 @@ void typecheck_call(astree *node) {
     if(func) {
         auto child = node->children[0];
         child->attributes = func->attributes;
-        child->parent_struct = func->parent_struct;
-        set_parent_lloc(child, func);
+        *child->parent_struct = *func->parent_struct;
+        set_declaration(child, func);
         bubbleup_type(node, child);
     } else {
 //        notify_error("Error: function not found",
@@ -520,7 +582,7 @@ void typecheck_new(astree *node) {
             set_attribute(node, ATTR_vreg);
             break;
         case TOK_NEWSTRING:
-            string_stack->push_back(node);
+            push_string(node);
             set_attribute(node, ATTR_string);
             set_attribute(node, ATTR_vreg);
             break;
@@ -540,7 +602,7 @@ void typecheck_var(astree *node) {
             auto decl = stack_lookup(node);
             set_attribute(node, get_type(decl), decl->parent_struct);
             set_attribute(node, ATTR_variable);
-            set_parent_lloc(node, decl);
+            set_declaration(node, decl);
             break;
         }
         case TOK_INTCON:
@@ -552,7 +614,7 @@ void typecheck_var(astree *node) {
             set_attribute(node, ATTR_const);
             break;
         case TOK_STRINGCON:
-//            string_stack->push_back(node);
+//            push_string(node);
             set_attribute(node, ATTR_string);
             set_attribute(node, ATTR_const);
             break;
@@ -566,6 +628,38 @@ void typecheck_var(astree *node) {
         case TOK_NEW:
             typecheck_new(node);
             break;
+        case TOK_NEWSTRING:
+            typecheck_var(node->children[0]);
+            break;
+        case TOK_NEWARRAY:
+            typecheck_var(node->children[1]);
+            break;
+        case '=':
+            typecheck_assignment(node);
+            break;
+        case TOK_EQ:
+        case TOK_NE:
+        case TOK_LT:
+        case TOK_LE:
+        case TOK_GT:
+        case TOK_GE:
+        case '+':
+        case '-':
+        case '*':
+        case '/':
+        case '%':
+            typecheck_binary_operation(node);
+            typecheck_var_children(node);
+            break;
+        case TOK_POS:
+        case TOK_NEG:
+        case '!':
+            typecheck_unary_operation(node);
+            typecheck_var_children(node);
+            break;
+        case TOK_INDEX:
+            typecheck_var_children(node);
+            break;
         case '.': {
             set_attribute(node, ATTR_lval);
             set_attribute(node, ATTR_vaddr);
@@ -577,7 +671,7 @@ void typecheck_var(astree *node) {
 //            auto structure = struct_lookup(node->children[0]);
 //            auto field = table_lookup(structure->fields, child2);
 //            if(field) {
-//                set_parent_lloc(child2, field);
+//                set_declaration(child2, field);
 //                set_attribute(child2, get_type(field),
 //                              field->parent_struct);
 //            } else {
@@ -610,6 +704,7 @@ void typecheck_vardecl(astree *node) {
             case TOK_DECLID:
                 lex = const_cast<string *>(child->lexinfo);
                 sym = new_sym(child);
+                set_declaration(child, sym);
                 break;
             default:
                 break;
@@ -629,50 +724,16 @@ void typecheck_vardecl(astree *node) {
     }
 }
 
-// While
+// While, If and If-Else: the condition, then each statement.
 void typecheck_while(astree *node) {
-    for (auto &child : node->children) {
-        switch (child->symbol) {
-            case TOK_EQ:
-            case TOK_NE:
-            case TOK_LT:
-            case TOK_LE:
-            case TOK_GT:
-            case TOK_GE:
-                set_attribute(child, ATTR_int);
-                set_attribute(child, ATTR_vreg);
-                typecheck_var_children(child);
-                break;
-            case TOK_BLOCK:
-                typecheck_rec(child);
-                break;
-            default:
-                break;
-        }
+    typecheck_var(node->children[0]);
+    for (size_t i = 1; i < node->children.size(); i++) {
+        typecheck_rec(node->children[i]);
     }
 }
 
-// If-Else
 void typecheck_ifelse(astree *node) {
-    for (auto &child : node->children) {
-        switch (child->symbol) {
-            case TOK_EQ:
-            case TOK_NE:
-            case TOK_LT:
-            case TOK_LE:
-            case TOK_GT:
-            case TOK_GE:
-                set_attribute(child, ATTR_int);
-                set_attribute(child, ATTR_vreg);
-                typecheck_var_children(child);
-                break;
-            case TOK_BLOCK:
-                typecheck_rec(child);
-                break;
-            default:
-                break;
-        }
-    }
+    typecheck_while(node);
 }
 
 void typecheck_assignment(astree *node) {
@@ -697,6 +758,7 @@ void typecheck_return(astree *node) {
         case TOK_RETURNVOID:
             break;
         case TOK_RETURN:
+            typecheck_var(node->children[0]);
             break;
         default:
             break;
@@ -708,12 +770,12 @@ void typecheck_rec(astree *node) {
     switch (node->symbol) {
         case TOK_STRUCT:
             typecheck_struct(node);
-            fprintf(sym_file, "\n");
+            print_newline();
             break;
         case TOK_PROTOTYPE:
         case TOK_FUNCTION:
             typecheck_function(node);
-            fprintf(sym_file, "\n");
+            print_newline();
             break;
         case TOK_VARDECL:
             typecheck_vardecl(node);
@@ -732,25 +794,28 @@ void typecheck_rec(astree *node) {
             for (auto &child : node->children) {
                 typecheck_rec(child);
             }
+            pop_stack();
             pop_scope();
             break;
         case '=':
-            typecheck_assignment(node);
-            break;
+        case TOK_EQ:
+        case TOK_NE:
+        case TOK_LT:
+        case TOK_LE:
+        case TOK_GT:
+        case TOK_GE:
         case '+':
         case '-':
         case '*':
         case '/':
         case '%':
-            typecheck_binary_operation(node);
-            break;
         case TOK_POS:
         case TOK_NEG:
         case '!':
-            typecheck_unary_operation(node);
-            break;
+        case TOK_INDEX:
+        case '.':
         case TOK_CALL:
-            typecheck_call(node);
+            typecheck_var(node);
             break;
         case TOK_RETURNVOID:
         case TOK_RETURN:
@@ -768,9 +833,42 @@ void typecheck_rec(astree *node) {
     }
 }
 
-void typecheck(FILE *out, astree *node){
-    string_stack = new vector<astree *>();
-    sym_file = out;
+void typecheck(FILE *out, astree *node, const char *cache_name){
+    if (string_stack == nullptr) {
+        string_stack = new vector<astree *>();
+    }
+    sym_out.open(out);
     symbol_stack.push_back(&global_table);
-    typecheck_rec(node);
+    if (cache_name == nullptr) {
+        typecheck_rec(node);
+        assign_blocknrs(node);
+    } else {
+        typecheck_cache cache;
+        cache.load(cache_name);
+        for (auto &child : node->children) {
+            cache.check(child);
+        }
+        cache.save(cache_name);
+        DEBUGF('c', "typecheck cache: %zu reused, %zu checked\n",
+               cache.hits, cache.misses);
+    }
+    sym_out.flush();
+}
+
+// Drops every symbol and scope of the last compilation unit in one
+// step.  Nodes still point at their declarations, so this must wait
+// until the .ast and .oil files have been written.
+void typecheck_release() {
+    symbol_stack.clear();
+    global_table.clear();
+    struct_table.clear();
+    string_stack->clear();
+    block_roots.clear();
+    while (!scope_stack.empty()) {
+        scope_stack.pop();
+    }
+    block_count = 0;
+    blocknr = 0;
+    scope_depth = 0;
+    sym_pool.release();
 }
@@ -8,7 +8,10 @@ using namespace std;
 
 using symbol_entry = pair<string *, symbol *>;
 extern symbol_table struct_table;
+extern symbol_table global_table;
+extern vector<symbol_table *> symbol_stack;
 extern vector<astree *> *string_stack;
+extern int block_count;
 
 struct symbol {
     attr_bitset attributes;
@@ -17,9 +20,20 @@ struct symbol {
     size_t blocknr;
     string *parent_struct;
     vector<symbol *> *parameters;
+    string oil_name;
 };
 
-void typecheck(FILE *out, astree *node);
+void typecheck(FILE *out, astree *node, const char *cache_name = nullptr);
+void typecheck_rec(astree *node);
+void typecheck_release();
+void assign_blocknrs(astree *node);
+void push_stack();
+void pop_stack();
+void push_string(astree *node);
+void print_symbol_at(string *lex, symbol *sym, int depth);
+void print_field(const string *lex, symbol *sym,
+                 const string *parent_struct);
+void print_newline();
 
 
 #endif //ASG4_NEW_SYMBOL_TABLE_H
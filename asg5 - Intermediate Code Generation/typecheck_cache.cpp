@@ -0,0 +1,623 @@
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <unordered_set>
+
+#include "typecheck_cache.h"
+#include "string_set.h"
+#include "symbol_pool.h"
+
+typecheck_cache *active_cache = nullptr;
+
+static const char cache_magic[] = "oc-typecheck-cache 3\n";
+static const uint64_t hash_seed = 0xcbf29ce484222325;
+
+enum { TC_PUSH, TC_INSERT, TC_STRUCT, TC_STRING,
+       TC_PRINT, TC_FIELD, TC_NEWLINE, TC_POP };
+
+// A node's declaration is a symbol of its own entry, by id, or the
+// global named by the node.
+enum { TC_DECL_NONE = -1, TC_DECL_OWN, TC_DECL_GLOBAL };
+
+// FNV-1a over a run of bytes.
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t len) {
+    auto bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+static uint64_t hash_value(uint64_t hash, uint64_t value) {
+    return hash_bytes(hash, &value, sizeof value);
+}
+
+// Entries are stored as space-separated numbers and length-prefixed
+// strings, which survive lexemes containing blanks or newlines.
+static void put_number(string &out, long value) {
+    out += to_string(value);
+    out += ' ';
+}
+
+static void put_text(string &out, const string &text) {
+    out += to_string(text.size());
+    out += ':';
+    out += text;
+    out += ' ';
+}
+
+struct cache_reader {
+    const char *pos;
+    const char *end;
+    bool good;
+
+    cache_reader(const string &text)
+            : pos(text.data()), end(text.data() + text.size()),
+              good(true) {
+    }
+
+    long number() {
+        char *stop = nullptr;
+        long value = strtol(pos, &stop, 10);
+        if (stop == pos || stop >= end || *stop != ' ') {
+            good = false;
+            return 0;
+        }
+        pos = stop + 1;
+        return value;
+    }
+
+    string text() {
+        char *stop = nullptr;
+        unsigned long len = strtoul(pos, &stop, 10);
+        if (stop == pos || stop >= end || *stop != ':'
+            || len > static_cast<size_t>(end - stop - 1)) {
+            good = false;
+            return string();
+        }
+        string value(stop + 1, len);
+        pos = stop + 1 + len;
+        if (pos >= end || *pos != ' ') {
+            good = false;
+        } else {
+            pos++;
+        }
+        return value;
+    }
+};
+
+struct tc_symbol_data {
+    long attributes, filenr, line, offset, block;
+    string parent_struct;
+    long field_count, param_count;
+    vector<pair<string, long>> fields;
+    vector<long> params;
+};
+
+struct tc_op_data {
+    long kind, arg, id;
+    string name, parent;
+};
+
+struct tc_node_data {
+    long attributes, block;
+    string parent_struct;
+    long decl_kind, decl_id;
+};
+
+// Lines are kept relative to the first line of the entry; zero stays
+// zero so that synthesized nodes keep their empty location.
+long typecheck_cache::encode_line(size_t linenr) {
+    if (linenr == 0) return 0;
+    if (linenr < base_line) cacheable = false;
+    return static_cast<long>(linenr - base_line) + 1;
+}
+
+size_t typecheck_cache::decode_line(long encoded) {
+    if (encoded == 0) return 0;
+    return base_line + static_cast<size_t>(encoded) - 1;
+}
+
+// Blocks opened inside the entry are numbered from the block count
+// at its start; enclosing blocks are stored as negated absolutes.
+long typecheck_cache::encode_block(size_t blocknr) {
+    if (blocknr > base_block) {
+        return static_cast<long>(blocknr - base_block);
+    }
+    return -static_cast<long>(blocknr);
+}
+
+size_t typecheck_cache::decode_block(long encoded) {
+    if (encoded > 0) return base_block + static_cast<size_t>(encoded);
+    return static_cast<size_t>(-encoded);
+}
+
+void typecheck_cache::collect(astree *node) {
+    node_index[node] = nodes.size();
+    nodes.push_back(node);
+    if (node->lloc.linenr != 0
+        && (base_line == 0 || node->lloc.linenr < base_line)) {
+        base_line = node->lloc.linenr;
+    }
+    for (astree *child : node->children) {
+        collect(child);
+    }
+}
+
+uint64_t typecheck_cache::subtree_hash() {
+    uint64_t hash = hash_seed;
+    for (astree *node : nodes) {
+        hash = hash_value(hash, static_cast<uint64_t>(node->symbol));
+        hash = hash_bytes(hash, node->lexinfo->data(),
+                          node->lexinfo->size());
+        hash = hash_value(hash, node->lloc.filenr);
+        hash = hash_value(hash, static_cast<uint64_t>(
+                encode_line(node->lloc.linenr)));
+        hash = hash_value(hash, node->lloc.offset);
+        hash = hash_value(hash, node->children.size());
+    }
+    return hash;
+}
+
+// What another entry sees of a symbol: its type, and the types of
+// its fields and parameters, but not where or in which block it was
+// declared.  Fields are summed since their table order is not fixed.
+static uint64_t signature_hash(uint64_t hash, const symbol *sym) {
+    hash = hash_value(hash, sym->attributes.to_ulong());
+    hash = hash_bytes(hash, sym->parent_struct->data(),
+                      sym->parent_struct->size());
+    if (sym->fields != nullptr) {
+        uint64_t fields = 0;
+        for (auto &field : *sym->fields) {
+            uint64_t one = hash_bytes(hash_seed, field.first->data(),
+                                      field.first->size());
+            fields += signature_hash(one, field.second);
+        }
+        hash = hash_value(hash, fields);
+    }
+    if (sym->parameters != nullptr) {
+        hash = hash_value(hash, sym->parameters->size());
+        for (const symbol *param : *sym->parameters) {
+            hash = signature_hash(hash, param);
+        }
+    }
+    return hash;
+}
+
+// Identifiers may name globals and type names may name structs, so
+// the key covers whatever each name is bound to before the entry is
+// checked, or that it is not bound yet.
+uint64_t typecheck_cache::reference_hash(uint64_t hash) {
+    unordered_set<const string *> seen;
+    for (astree *node : nodes) {
+        symbol_table *table = node->symbol == TOK_IDENT ? &global_table
+                            : node->symbol == TOK_TYPEID ? &struct_table
+                            : nullptr;
+        if (table == nullptr || !seen.insert(node->lexinfo).second) {
+            continue;
+        }
+        hash = hash_value(hash, static_cast<uint64_t>(node->symbol));
+        hash = hash_bytes(hash, node->lexinfo->data(),
+                          node->lexinfo->size());
+        auto found = table->find(const_cast<string *>(node->lexinfo));
+        hash = found == table->end() ? hash_value(hash, 0)
+                                     : signature_hash(hash, found->second);
+    }
+    return hash;
+}
+
+void typecheck_cache::load(const char *filename) {
+    FILE *in = fopen(filename, "r");
+    if (in == nullptr) return;
+    string text;
+    char buffer[0x1000];
+    size_t len;
+    while ((len = fread(buffer, 1, sizeof buffer, in)) > 0) {
+        text.append(buffer, len);
+    }
+    fclose(in);
+
+    if (text.compare(0, sizeof cache_magic - 1, cache_magic) != 0) {
+        return;
+    }
+    cache_reader reader(text);
+    reader.pos += sizeof cache_magic - 1;
+    while (reader.good && reader.pos < reader.end) {
+        tc_entry entry;
+        string key = reader.text();
+        entry.effects = reader.text();
+        entry.nodes = reader.text();
+        entry.keep = true;
+        if (!reader.good) break;
+        entry.key = strtoull(key.c_str(), nullptr, 16);
+        stored[entry.key] = entry;
+    }
+}
+
+void typecheck_cache::save(const char *filename) {
+    FILE *out = fopen(filename, "w");
+    if (out == nullptr) {
+        syserrprintf(filename);
+        return;
+    }
+    fputs(cache_magic, out);
+    for (const tc_entry &entry : entries) {
+        if (!entry.keep) continue;
+        char hex[20];
+        string line;
+        snprintf(hex, sizeof hex, "%016" PRIx64, entry.key);
+        put_text(line, hex);
+        put_text(line, entry.effects);
+        put_text(line, entry.nodes);
+        fwrite(line.data(), 1, line.size(), out);
+    }
+    fclose(out);
+}
+
+void typecheck_cache::check(astree *node) {
+    nodes.clear();
+    node_index.clear();
+    base_line = 0;
+    collect(node);
+    base_block = static_cast<size_t>(block_count);
+    base_stack = symbol_stack.size();
+    cacheable = true;
+
+    uint64_t key = reference_hash(subtree_hash());
+    bool keep = cacheable && (node->symbol == TOK_STRUCT
+                              || node->symbol == TOK_FUNCTION
+                              || node->symbol == TOK_PROTOTYPE
+                              || node->symbol == TOK_VARDECL);
+    auto found = keep ? stored.find(key) : stored.end();
+    if (found != stored.end() && replay(found->second)) {
+        entries.push_back(found->second);
+        hits++;
+    } else {
+        tc_entry entry;
+        entry.key = key;
+        entry.keep = keep;
+        record(node, entry);
+        entries.push_back(entry);
+        misses++;
+    }
+}
+
+size_t typecheck_cache::symbol_id(symbol *sym) {
+    size_t entry = entries.size();
+    auto found = registry.find(sym);
+    if (found != registry.end()) {
+        if (found->second.entry != entry) cacheable = false;
+        return found->second.id;
+    }
+    size_t id = entry_symbols[entry].size();
+    registry[sym] = {entry, id};
+    entry_symbols[entry].push_back(sym);
+    return id;
+}
+
+void typecheck_cache::put_op(int kind, long arg, size_t id,
+                             const string &name, const string &parent) {
+    put_number(ops, kind);
+    put_number(ops, arg);
+    put_number(ops, static_cast<long>(id));
+    put_text(ops, name);
+    put_text(ops, parent);
+    op_count++;
+}
+
+void typecheck_cache::record_push() {
+    put_op(TC_PUSH, 0, 0, string(), string());
+}
+
+void typecheck_cache::record_pop() {
+    put_op(TC_POP, 0, 0, string(), string());
+}
+
+void typecheck_cache::record_insert(size_t table, string *lex,
+                                    symbol *sym) {
+    if (lex == nullptr || lex->empty()) {
+        cacheable = false;
+        return;
+    }
+    long encoded = table >= base_stack
+                   ? static_cast<long>(table - base_stack) + 1
+                   : -static_cast<long>(table);
+    put_op(TC_INSERT, encoded, symbol_id(sym), *lex, string());
+}
+
+void typecheck_cache::record_struct(string *lex, symbol *sym) {
+    if (lex == nullptr || lex->empty()) {
+        cacheable = false;
+        return;
+    }
+    put_op(TC_STRUCT, 0, symbol_id(sym), *lex, string());
+}
+
+void typecheck_cache::record_string(astree *node) {
+    auto found = node_index.find(node);
+    if (found == node_index.end()) {
+        cacheable = false;
+        return;
+    }
+    put_op(TC_STRING, static_cast<long>(found->second), 0,
+           string(), string());
+}
+
+void typecheck_cache::record_print(string *lex, symbol *sym,
+                                   int depth) {
+    if (lex == nullptr) {
+        cacheable = false;
+        return;
+    }
+    put_op(TC_PRINT, depth, symbol_id(sym), *lex, string());
+}
+
+void typecheck_cache::record_field(const string *lex, symbol *sym,
+                                   const string *parent_struct) {
+    put_op(TC_FIELD, 0, symbol_id(sym), *lex, *parent_struct);
+}
+
+void typecheck_cache::record_newline() {
+    put_op(TC_NEWLINE, 0, 0, string(), string());
+}
+
+void typecheck_cache::record(astree *node, tc_entry &entry) {
+    entry_symbols.emplace_back();
+    ops.clear();
+    op_count = 0;
+    active_cache = this;
+    typecheck_rec(node);
+    assign_blocknrs(node);
+    active_cache = nullptr;
+
+    // Symbols are written in id order; fields and parameters may hand
+    // out further ids while the list is being walked.
+    vector<symbol *> &symbols = entry_symbols.back();
+    string syms;
+    for (size_t id = 0; id < symbols.size(); id++) {
+        symbol *sym = symbols[id];
+        put_number(syms, static_cast<long>(sym->attributes.to_ulong()));
+        put_number(syms, static_cast<long>(sym->filenr));
+        put_number(syms, encode_line(sym->linenr));
+        put_number(syms, static_cast<long>(sym->offset));
+        put_number(syms, encode_block(sym->blocknr));
+        put_text(syms, sym->parent_struct ? *sym->parent_struct
+                                          : string());
+        if (sym->fields == nullptr) {
+            put_number(syms, -1);
+        } else {
+            put_number(syms, static_cast<long>(sym->fields->size()));
+            for (auto &field : *sym->fields) {
+                put_text(syms, *field.first);
+                put_number(syms,
+                           static_cast<long>(symbol_id(field.second)));
+            }
+        }
+        if (sym->parameters == nullptr) {
+            put_number(syms, -1);
+        } else {
+            put_number(syms, static_cast<long>(sym->parameters->size()));
+            for (symbol *param : *sym->parameters) {
+                put_number(syms, static_cast<long>(symbol_id(param)));
+            }
+        }
+    }
+
+    entry.effects.clear();
+    put_number(entry.effects,
+               static_cast<long>(block_count) - static_cast<long>(base_block));
+    put_number(entry.effects, static_cast<long>(symbols.size()));
+    entry.effects += syms;
+    put_number(entry.effects, static_cast<long>(op_count));
+    entry.effects += ops;
+
+    entry.nodes.clear();
+    put_number(entry.nodes, static_cast<long>(nodes.size()));
+    for (astree *child : nodes) {
+        put_number(entry.nodes,
+                   static_cast<long>(child->attributes.to_ulong()));
+        put_number(entry.nodes, encode_block(child->blocknr));
+        put_text(entry.nodes, *child->parent_struct);
+        auto found = registry.find(child->declaration);
+        if (child->declaration == nullptr) {
+            put_number(entry.nodes, TC_DECL_NONE);
+            put_number(entry.nodes, 0);
+        } else if (found != registry.end()
+                   && found->second.entry == entries.size()) {
+            put_number(entry.nodes, TC_DECL_OWN);
+            put_number(entry.nodes, static_cast<long>(found->second.id));
+        } else {
+            auto global = global_table.find(
+                    const_cast<string *>(child->lexinfo));
+            if (global == global_table.end()
+                || global->second != child->declaration) {
+                cacheable = false;
+            }
+            put_number(entry.nodes, TC_DECL_GLOBAL);
+            put_number(entry.nodes, 0);
+        }
+    }
+
+    // An entry whose effects could not be written down faithfully is
+    // checked again every time.
+    if (!cacheable) entry.keep = false;
+}
+
+bool typecheck_cache::replay(const tc_entry &entry) {
+    // Decode everything before touching the tables so that a damaged
+    // entry can still fall back to a full check.
+    cache_reader effects(entry.effects);
+    long block_delta = effects.number();
+    long sym_count = effects.number();
+    vector<tc_symbol_data> syms;
+    for (long i = 0; effects.good && i < sym_count; i++) {
+        tc_symbol_data data;
+        data.attributes = effects.number();
+        data.filenr = effects.number();
+        data.line = effects.number();
+        data.offset = effects.number();
+        data.block = effects.number();
+        data.parent_struct = effects.text();
+        data.field_count = effects.number();
+        for (long f = 0; effects.good && f < data.field_count; f++) {
+            string lex = effects.text();
+            data.fields.push_back({lex, effects.number()});
+        }
+        data.param_count = effects.number();
+        for (long p = 0; effects.good && p < data.param_count; p++) {
+            data.params.push_back(effects.number());
+        }
+        syms.push_back(data);
+    }
+    long op_total = effects.number();
+    vector<tc_op_data> op_list;
+    for (long i = 0; effects.good && i < op_total; i++) {
+        tc_op_data op;
+        op.kind = effects.number();
+        op.arg = effects.number();
+        op.id = effects.number();
+        op.name = effects.text();
+        op.parent = effects.text();
+        op_list.push_back(op);
+    }
+
+    cache_reader node_reader(entry.nodes);
+    long node_count = node_reader.number();
+    vector<tc_node_data> node_list;
+    for (long i = 0; node_reader.good && i < node_count; i++) {
+        tc_node_data data;
+        data.attributes = node_reader.number();
+        data.block = node_reader.number();
+        data.parent_struct = node_reader.text();
+        data.decl_kind = node_reader.number();
+        data.decl_id = node_reader.number();
+        node_list.push_back(data);
+    }
+
+    if (!effects.good || !node_reader.good
+        || node_list.size() != nodes.size()) {
+        return false;
+    }
+    long sym_total = static_cast<long>(syms.size());
+    for (auto &data : syms) {
+        for (auto &field : data.fields) {
+            if (field.second < 0 || field.second >= sym_total) return false;
+        }
+        for (long param : data.params) {
+            if (param < 0 || param >= sym_total) return false;
+        }
+    }
+    for (auto &op : op_list) {
+        if ((op.kind == TC_INSERT || op.kind == TC_STRUCT
+             || op.kind == TC_PRINT || op.kind == TC_FIELD)
+            && (op.id < 0 || op.id >= sym_total)) {
+            return false;
+        }
+        if (op.kind == TC_STRING
+            && (op.arg < 0 || op.arg >= node_count)) {
+            return false;
+        }
+    }
+    vector<symbol *> globals(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++) {
+        tc_node_data &data = node_list[i];
+        if (data.decl_kind == TC_DECL_GLOBAL) {
+            auto global = global_table.find(
+                    const_cast<string *>(nodes[i]->lexinfo));
+            if (global == global_table.end()) return false;
+            globals[i] = global->second;
+        } else if (data.decl_kind == TC_DECL_OWN) {
+            if (data.decl_id < 0 || data.decl_id >= sym_total) {
+                return false;
+            }
+        } else if (data.decl_kind != TC_DECL_NONE) {
+            return false;
+        }
+    }
+
+    size_t index = entries.size();
+    entry_symbols.emplace_back();
+    vector<symbol *> &symbols = entry_symbols.back();
+    for (auto &data : syms) {
+        auto *sym = sym_pool.make_symbol();
+        sym->attributes = attr_bitset(
+                static_cast<unsigned long>(data.attributes));
+        sym->filenr = static_cast<size_t>(data.filenr);
+        sym->linenr = decode_line(data.line);
+        sym->offset = static_cast<size_t>(data.offset);
+        sym->blocknr = decode_block(data.block);
+        sym->parent_struct = sym_pool.make_string();
+        *sym->parent_struct = data.parent_struct;
+        sym->fields = data.field_count < 0 ? nullptr
+                                           : sym_pool.make_table();
+        sym->parameters = data.param_count < 0
+                          ? nullptr : sym_pool.make_parameters();
+        registry[sym] = {index, symbols.size()};
+        symbols.push_back(sym);
+    }
+    for (size_t i = 0; i < syms.size(); i++) {
+        for (auto &field : syms[i].fields) {
+            auto lex = const_cast<string *>(
+                    string_set::intern(field.first.c_str()));
+            symbols[i]->fields->insert({lex, symbols[field.second]});
+        }
+        for (long param : syms[i].params) {
+            symbols[i]->parameters->push_back(symbols[param]);
+        }
+    }
+
+    for (auto &op : op_list) {
+        switch (op.kind) {
+            case TC_PUSH:
+                push_stack();
+                break;
+            case TC_POP:
+                pop_stack();
+                break;
+            case TC_INSERT: {
+                size_t table = op.arg > 0
+                        ? base_stack + static_cast<size_t>(op.arg) - 1
+                        : static_cast<size_t>(-op.arg);
+                auto lex = const_cast<string *>(
+                        string_set::intern(op.name.c_str()));
+                symbol_stack.at(table)->insert({lex, symbols[op.id]});
+                break;
+            }
+            case TC_STRUCT: {
+                auto lex = const_cast<string *>(
+                        string_set::intern(op.name.c_str()));
+                struct_table.insert({lex, symbols[op.id]});
+                break;
+            }
+            case TC_STRING:
+                push_string(nodes[op.arg]);
+                break;
+            case TC_PRINT:
+                print_symbol_at(&op.name, symbols[op.id],
+                                static_cast<int>(op.arg));
+                break;
+            case TC_FIELD:
+                print_field(&op.name, symbols[op.id], &op.parent);
+                break;
+            case TC_NEWLINE:
+                print_newline();
+                break;
+            default:
+                break;
+        }
+    }
+    block_count = static_cast<int>(base_block) + static_cast<int>(block_delta);
+
+    for (size_t i = 0; i < nodes.size(); i++) {
+        astree *node = nodes[i];
+        tc_node_data &data = node_list[i];
+        node->attributes = attr_bitset(
+                static_cast<unsigned long>(data.attributes));
+        node->blocknr = decode_block(data.block);
+        *node->parent_struct = data.parent_struct;
+        node->declaration = data.decl_kind == TC_DECL_OWN
+                            ? symbols[data.decl_id] : globals[i];
+    }
+    return true;
+}
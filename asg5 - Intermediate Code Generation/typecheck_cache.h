@@ -0,0 +1,85 @@
+#ifndef __TYPECHECK_CACHE_H__
+#define __TYPECHECK_CACHE_H__
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+#include "symbol_table.h"
+
+// Incremental typechecking.
+//
+// Every top-level subtree is keyed by a hash of its tokens and of the
+// signatures of the globals and structs it names, as they stand when
+// it is reached.  An entry records its symbol table effects (symbols,
+// table inserts, .sym lines) and the attributes left on the subtree,
+// with line and block numbers stored relative to the entry, so it can
+// be replayed after code above it grows or shrinks or changes inside
+// a function body.  Only structs, functions, prototypes and variable
+// declarations are kept on disk; other top-level statements are
+// always checked again.
+
+struct tc_entry {
+    uint64_t key;
+    string effects;
+    string nodes;
+    bool keep;
+};
+
+struct tc_ref {
+    size_t entry;
+    size_t id;
+};
+
+struct typecheck_cache {
+    void load(const char *filename);
+    void save(const char *filename);
+    void check(astree *node);
+
+    void record_push();
+    void record_pop();
+    void record_insert(size_t table, string *lex, symbol *sym);
+    void record_struct(string *lex, symbol *sym);
+    void record_string(astree *node);
+    void record_print(string *lex, symbol *sym, int depth);
+    void record_field(const string *lex, symbol *sym,
+                      const string *parent_struct);
+    void record_newline();
+
+    size_t hits = 0;
+    size_t misses = 0;
+
+private:
+    unordered_map<uint64_t, tc_entry> stored;
+    vector<tc_entry> entries;
+    vector<vector<symbol *>> entry_symbols;
+    unordered_map<symbol *, tc_ref> registry;
+
+    // State of the entry being checked.
+    vector<astree *> nodes;
+    unordered_map<astree *, size_t> node_index;
+    string ops;
+    size_t op_count;
+    size_t base_line, base_block, base_stack;
+    bool cacheable;
+
+    void collect(astree *node);
+    uint64_t subtree_hash();
+    uint64_t reference_hash(uint64_t hash);
+    size_t symbol_id(symbol *sym);
+    void put_op(int kind, long arg, size_t id,
+                const string &name, const string &parent);
+    void record(astree *node, tc_entry &entry);
+    bool replay(const tc_entry &entry);
+    long encode_line(size_t linenr);
+    size_t decode_line(long encoded);
+    long encode_block(size_t blocknr);
+    size_t decode_block(long encoded);
+};
+
+extern typecheck_cache *active_cache;
+
+#endif
@@ -0,0 +1,614 @@
+#include <algorithm>
+
+#include "auxlib.h"
+#include "buffered_writer.h"
+#include "vm_asm.h"
+
+constexpr size_t NO_REGISTER = static_cast<size_t>(-1);
+
+const char *const ARG_REGS[] = {
+    "%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9",
+};
+constexpr size_t ARG_COUNT = 6;
+
+const char *const SAVED_REGS[] = {
+    "%rbx", "%r12", "%r13", "%r14", "%r15",
+};
+constexpr size_t SAVED_COUNT = 5;
+
+// The oclib.c entry point for each vm_builtin, how many arguments it
+// takes and whether it gives back a value.
+const struct {
+    const char *name;
+    size_t params;
+    bool result;
+} ASM_BUILTINS[] = {
+    {"__putb", 1, false},
+    {"__putc", 1, false},
+    {"__puti", 1, false},
+    {"__puts", 1, false},
+    {"__endl", 0, false},
+    {"__getc", 0, true},
+    {"__getw", 0, true},
+    {"__getln", 0, true},
+    {"__getargv", 0, true},
+    {"__exit", 1, false},
+    {"____assert_fail", 3, false},
+};
+static_assert(sizeof ASM_BUILTINS / sizeof *ASM_BUILTINS == VM_BUILTINS,
+              "one entry point per builtin");
+
+// Instructions that set a byte from the flags, VM_EQ through VM_GE.
+const char *const SETCC[] = {
+    "sete", "setne", "setl", "setle", "setg", "setge",
+};
+
+string asm_symbol(const vm_program &program, size_t index) {
+    if (index == 0) return program.functions[0].name;
+    return "__" + program.functions[index].name;
+}
+
+// Registers an instruction reads, and the one it writes if any.
+struct asm_uses {
+    vector<size_t> reads;
+    size_t write = NO_REGISTER;
+};
+
+asm_uses uses_of(const vm_program &program, const vm_instr &instr) {
+    asm_uses uses;
+    switch (instr.opcode) {
+        case VM_LOADI:
+        case VM_LOADS:
+        case VM_GETG:
+        case VM_NEWSTRUCT:
+            uses.write = instr.a;
+            break;
+        case VM_MOVE:
+        case VM_ADDI:
+        case VM_NEG:
+        case VM_NOT:
+        case VM_NEWARRAY:
+        case VM_NEWSTRING:
+        case VM_GETF:
+            uses.reads = {instr.b};
+            uses.write = instr.a;
+            break;
+        case VM_ADD:
+        case VM_SUB:
+        case VM_MUL:
+        case VM_DIV:
+        case VM_REM:
+        case VM_EQ:
+        case VM_NE:
+        case VM_LT:
+        case VM_LE:
+        case VM_GT:
+        case VM_GE:
+        case VM_GETX:
+        case VM_GETC:
+            uses.reads = {instr.b, instr.c};
+            uses.write = instr.a;
+            break;
+        case VM_SETG:
+        case VM_JUMPF:
+        case VM_RETURN:
+            uses.reads = {instr.a};
+            break;
+        case VM_SETF:
+            uses.reads = {instr.a, instr.b};
+            break;
+        case VM_SETX:
+        case VM_SETC:
+            uses.reads = {instr.a, instr.b, instr.c};
+            break;
+        case VM_CALL:
+            for (size_t i = 0; i < program.functions[instr.b].params; i++) {
+                uses.reads.push_back(instr.c + i);
+            }
+            uses.write = instr.a;
+            break;
+        case VM_BUILTIN:
+            for (size_t i = 0; i < ASM_BUILTINS[instr.b].params; i++) {
+                uses.reads.push_back(instr.c + i);
+            }
+            if (ASM_BUILTINS[instr.b].result) uses.write = instr.a;
+            break;
+        default:
+            break;
+    }
+    return uses;
+}
+
+// The first and last instruction where a register is written or live.
+struct asm_range {
+    size_t reg;
+    size_t start;
+    size_t end;
+};
+
+struct asm_function {
+    const vm_program &program;
+    size_t index;
+    const vm_function &function;
+    const char *allocator;
+    buffered_writer &out;
+    vector<asm_uses> uses;
+    vector<bool> entry;             // registers live on entry
+    vector<bool> targets;           // instructions something jumps to
+    vector<string> where;           // operand text of each register
+    vector<const char *> saved;     // callee-saved registers used
+    size_t slots = 0;
+    size_t labels = 0;
+    bool ok = true;
+
+    asm_function(const vm_program &program_, size_t index_,
+                 const char *allocator_, buffered_writer &out_);
+
+    vector<asm_range> live_ranges();
+    void allocate();
+    string label(size_t at) const;
+    string new_label();
+    void put_label(const string &name);
+    void line(const string &text);
+    string value(size_t reg, const char *scratch);
+    void load(size_t reg, const char *to);
+    void store(const char *from, size_t reg);
+    void call(const string &callee, size_t first, size_t count);
+    void arithmetic(const vm_instr &instr);
+    void instruction(const vm_instr &instr);
+    void emit();
+};
+
+asm_function::asm_function(const vm_program &program_, size_t index_,
+                           const char *allocator_, buffered_writer &out_)
+        : program(program_), index(index_),
+          function(program_.functions[index_]), allocator(allocator_),
+          out(out_), entry(function.registers),
+          targets(function.code.size() + 1), where(function.registers) {
+    for (const vm_instr &instr: function.code) {
+        uses.push_back(uses_of(program, instr));
+        if (instr.opcode == VM_JUMP || instr.opcode == VM_JUMPF) {
+            targets[instr.wide()] = true;
+        }
+    }
+    allocate();
+}
+
+// Liveness over single instructions, then the span of each register.
+vector<asm_range> asm_function::live_ranges() {
+    size_t count = function.code.size();
+    size_t width = function.registers;
+    vector<vector<bool>> live(count + 1, vector<bool>(width));
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t at = count; at-- > 0;) {
+            const vm_instr &instr = function.code[at];
+            vector<bool> now(width);
+            if (instr.opcode != VM_JUMP && instr.opcode != VM_RETURN
+                && instr.opcode != VM_RETURNV) {
+                now = live[at + 1];
+            }
+            if (instr.opcode == VM_JUMP || instr.opcode == VM_JUMPF) {
+                const vector<bool> &there = live[instr.wide()];
+                for (size_t reg = 0; reg < width; reg++) {
+                    if (there[reg]) now[reg] = true;
+                }
+            }
+            if (uses[at].write < width) now[uses[at].write] = false;
+            for (size_t reg: uses[at].reads) now[reg] = true;
+            if (now != live[at]) {
+                live[at] = move(now);
+                changed = true;
+            }
+        }
+    }
+    if (count > 0) entry = live[0];
+
+    vector<asm_range> ranges;
+    vector<size_t> found(width, NO_REGISTER);
+    for (size_t at = 0; at < count; at++) {
+        for (size_t reg = 0; reg < width; reg++) {
+            if (!live[at][reg] && uses[at].write != reg) continue;
+            if (found[reg] == NO_REGISTER) {
+                found[reg] = ranges.size();
+                ranges.push_back({reg, at, at});
+            }
+            ranges[found[reg]].end = at;
+        }
+    }
+    return ranges;
+}
+
+// Linear scan: ranges in order of their start take a free callee-saved
+// register, or the one of the range that ends last, which then goes to
+// the frame instead.
+void asm_function::allocate() {
+    vector<asm_range> ranges = live_ranges();
+    vector<size_t> machine(function.registers, NO_REGISTER);
+    vector<asm_range> active;
+    vector<bool> taken(SAVED_COUNT);
+    for (const asm_range &range: ranges) {
+        for (size_t i = 0; i < active.size();) {
+            if (active[i].end < range.start) {
+                taken[machine[active[i].reg]] = false;
+                active.erase(active.begin() + i);
+            } else {
+                i++;
+            }
+        }
+        size_t free = find(taken.begin(), taken.end(), false)
+                      - taken.begin();
+        if (free < SAVED_COUNT) {
+            machine[range.reg] = free;
+            taken[free] = true;
+            active.push_back(range);
+            continue;
+        }
+        auto last = max_element(active.begin(), active.end(),
+                                [](const asm_range &x, const asm_range &y) {
+                                    return x.end < y.end;
+                                });
+        if (last->end > range.end) {
+            machine[range.reg] = machine[last->reg];
+            machine[last->reg] = NO_REGISTER;
+            *last = range;
+        }
+    }
+
+    vector<bool> used(SAVED_COUNT);
+    for (size_t reg: machine) {
+        if (reg != NO_REGISTER) used[reg] = true;
+    }
+    for (size_t i = 0; i < SAVED_COUNT; i++) {
+        if (used[i]) saved.push_back(SAVED_REGS[i]);
+    }
+    for (const asm_range &range: ranges) {
+        size_t reg = range.reg;
+        if (machine[reg] != NO_REGISTER) {
+            where[reg] = SAVED_REGS[machine[reg]];
+        } else if (reg < function.params && reg >= ARG_COUNT) {
+            where[reg] = to_string(16 + 8 * (reg - ARG_COUNT)) + "(%rbp)";
+        } else {
+            slots++;
+            where[reg] = "-" + to_string(8 * (saved.size() + slots))
+                         + "(%rbp)";
+        }
+    }
+}
+
+string asm_function::label(size_t at) const {
+    return ".L" + to_string(index) + "." + to_string(at);
+}
+
+string asm_function::new_label() {
+    return ".L" + to_string(index) + ".x" + to_string(labels++);
+}
+
+void asm_function::put_label(const string &name) {
+    out.put(name);
+    out.put(":\n");
+}
+
+void asm_function::line(const string &text) {
+    out.put('\t');
+    out.put(text);
+    out.put('\n');
+}
+
+// The register as an operand that must itself be a machine register,
+// loaded into scratch if it lives in the frame.
+string asm_function::value(size_t reg, const char *scratch) {
+    if (where[reg][0] == '%') return where[reg];
+    load(reg, scratch);
+    return scratch;
+}
+
+void asm_function::load(size_t reg, const char *to) {
+    if (where[reg] != to) line("movq " + where[reg] + ", " + to);
+}
+
+void asm_function::store(const char *from, size_t reg) {
+    if (where[reg] != from) line(string("movq ") + from + ", " + where[reg]);
+}
+
+void asm_function::call(const string &callee, size_t first,
+                        size_t count) {
+    size_t stacked = count > ARG_COUNT ? count - ARG_COUNT : 0;
+    size_t pad = stacked % 2 * 8;
+    if (pad > 0) line("subq $8, %rsp");
+    for (size_t i = count; i-- > ARG_COUNT;) {
+        line("pushq " + where[first + i]);
+    }
+    for (size_t i = 0; i < count && i < ARG_COUNT; i++) {
+        load(first + i, ARG_REGS[i]);
+    }
+    line("call " + callee);
+    if (stacked > 0) {
+        line("addq $" + to_string(8 * stacked + pad) + ", %rsp");
+    }
+}
+
+void asm_function::arithmetic(const vm_instr &instr) {
+    switch (instr.opcode) {
+        case VM_ADD:
+        case VM_SUB:
+        case VM_MUL:
+            load(instr.b, "%rax");
+            load(instr.c, "%rcx");
+            line(instr.opcode == VM_ADD ? "addl %ecx, %eax"
+                 : instr.opcode == VM_SUB ? "subl %ecx, %eax"
+                 : "imull %ecx, %eax");
+            line("movslq %eax, %rax");
+            break;
+        case VM_ADDI:
+            load(instr.b, "%rax");
+            line("addl $" + to_string(static_cast<int16_t>(instr.c))
+                 + ", %eax");
+            line("movslq %eax, %rax");
+            break;
+        case VM_NEG:
+            load(instr.b, "%rax");
+            line("negl %eax");
+            line("movslq %eax, %rax");
+            break;
+        case VM_DIV:
+        case VM_REM: {
+            // Dividing by -1 is negating, which wraps at 32 bits.
+            string divide = new_label();
+            string done = new_label();
+            load(instr.b, "%rax");
+            load(instr.c, "%rcx");
+            line("cmpq $-1, %rcx");
+            line("jne " + divide);
+            if (instr.opcode == VM_DIV) {
+                line("negl %eax");
+                line("movslq %eax, %rax");
+            } else {
+                line("xorl %eax, %eax");
+            }
+            line("jmp " + done);
+            put_label(divide);
+            line("cqto");
+            line("idivq %rcx");
+            if (instr.opcode == VM_REM) line("movq %rdx, %rax");
+            put_label(done);
+            break;
+        }
+        case VM_NOT:
+            line("cmpq $0, " + where[instr.b]);
+            line("sete %al");
+            line("movzbl %al, %eax");
+            break;
+        default:
+            load(instr.b, "%rax");
+            line("cmpq " + where[instr.c] + ", %rax");
+            line(string(SETCC[instr.opcode - VM_EQ]) + " %al");
+            line("movzbl %al, %eax");
+            break;
+    }
+    store("%rax", instr.a);
+}
+
+void asm_function::instruction(const vm_instr &instr) {
+    string wide = to_string(instr.wide());
+    switch (instr.opcode) {
+        case VM_LOADI:
+            line("movq $" + wide + ", " + where[instr.a]);
+            break;
+        case VM_LOADS:
+            line("leaq .LS" + wide + "(%rip), %rax");
+            store("%rax", instr.a);
+            break;
+        case VM_MOVE:
+            store(value(instr.b, "%rax").c_str(), instr.a);
+            break;
+        case VM_GETG:
+            line("movq _0_" + program.globals[instr.wide()]
+                 + "(%rip), %rax");
+            store("%rax", instr.a);
+            break;
+        case VM_SETG:
+            line("movq " + value(instr.a, "%rax") + ", _0_"
+                 + program.globals[instr.wide()] + "(%rip)");
+            break;
+        case VM_ADD:
+        case VM_ADDI:
+        case VM_SUB:
+        case VM_MUL:
+        case VM_DIV:
+        case VM_REM:
+        case VM_NEG:
+        case VM_NOT:
+        case VM_EQ:
+        case VM_NE:
+        case VM_LT:
+        case VM_LE:
+        case VM_GT:
+        case VM_GE:
+            arithmetic(instr);
+            break;
+        case VM_JUMP:
+            line("jmp " + label(instr.wide()));
+            break;
+        case VM_JUMPF:
+            line("cmpq $0, " + where[instr.a]);
+            line("je " + label(instr.wide()));
+            break;
+        case VM_CALL:
+            call(asm_symbol(program, instr.b), instr.c,
+                 program.functions[instr.b].params);
+            if (instr.a < where.size() && !where[instr.a].empty()) {
+                store("%rax", instr.a);
+            }
+            break;
+        case VM_BUILTIN: {
+            const auto &builtin = ASM_BUILTINS[instr.b];
+            call(builtin.name, instr.c, builtin.params);
+            if (instr.b == VM_GETCHAR) line("movslq %eax, %rax");
+            if (builtin.result) store("%rax", instr.a);
+            break;
+        }
+        case VM_RETURN:
+            load(instr.a, "%rax");
+            line("jmp .L" + to_string(index) + ".return");
+            break;
+        case VM_RETURNV:
+            line("xorl %eax, %eax");
+            line("jmp .L" + to_string(index) + ".return");
+            break;
+        case VM_NEWSTRUCT:
+            line("movl $1, %edi");
+            line("movl $" + to_string(8 * max<size_t>(instr.b, 1))
+                 + ", %esi");
+            line(string("call ") + allocator);
+            store("%rax", instr.a);
+            break;
+        case VM_NEWARRAY:
+            load(instr.b, "%rdi");
+            line("movl $8, %esi");
+            line(string("call ") + allocator);
+            store("%rax", instr.a);
+            break;
+        case VM_NEWSTRING:
+            load(instr.b, "%rdi");
+            line("addl $1, %edi");
+            line("movl $1, %esi");
+            line(string("call ") + allocator);
+            store("%rax", instr.a);
+            break;
+        case VM_GETF: {
+            string base = value(instr.b, "%rax");
+            line("movq " + to_string(8 * instr.c) + "(" + base
+                 + "), %rax");
+            store("%rax", instr.a);
+            break;
+        }
+        case VM_SETF: {
+            string base = value(instr.b, "%rax");
+            string from = value(instr.a, "%rcx");
+            line("movq " + from + ", " + to_string(8 * instr.c) + "("
+                 + base + ")");
+            break;
+        }
+        case VM_GETX:
+        case VM_GETC: {
+            string base = value(instr.b, "%rax");
+            string at = value(instr.c, "%rcx");
+            if (instr.opcode == VM_GETX) {
+                line("movq (" + base + ", " + at + ", 8), %rax");
+            } else {
+                line("movsbq (" + base + ", " + at + "), %rax");
+            }
+            store("%rax", instr.a);
+            break;
+        }
+        case VM_SETX: {
+            string base = value(instr.b, "%rax");
+            string at = value(instr.c, "%rcx");
+            string from = value(instr.a, "%rdx");
+            line("movq " + from + ", (" + base + ", " + at + ", 8)");
+            break;
+        }
+        case VM_SETC: {
+            string base = value(instr.b, "%rax");
+            string at = value(instr.c, "%rcx");
+            load(instr.a, "%rdx");
+            line("movb %dl, (" + base + ", " + at + ")");
+            break;
+        }
+        default:
+            errprintf("Error: -S has no translation for %s in %s\n",
+                      vm_opcode_name(instr.opcode),
+                      function.name.c_str());
+            ok = false;
+            break;
+    }
+}
+
+void asm_function::emit() {
+    string name = asm_symbol(program, index);
+    out.put("\t.text\n");
+    if (index == 0) line(".globl " + name);
+    line(".type " + name + ", @function");
+    put_label(name);
+    line("pushq %rbp");
+    line("movq %rsp, %rbp");
+    for (const char *reg: saved) line(string("pushq ") + reg);
+    size_t frame = 8 * (slots + (saved.size() + slots) % 2);
+    if (frame > 0) line("subq $" + to_string(frame) + ", %rsp");
+    for (size_t i = 0; i < function.params; i++) {
+        if (!entry[i]) continue;
+        if (i < ARG_COUNT) {
+            store(ARG_REGS[i], i);
+        } else if (where[i][0] == '%') {
+            line("movq " + to_string(16 + 8 * (i - ARG_COUNT))
+                 + "(%rbp), " + where[i]);
+        }
+    }
+
+    for (size_t at = 0; at < function.code.size(); at++) {
+        if (targets[at]) put_label(label(at));
+        instruction(function.code[at]);
+    }
+    if (targets[function.code.size()]) {
+        put_label(label(function.code.size()));
+    }
+
+    put_label(".L" + to_string(index) + ".return");
+    line("leaq -" + to_string(8 * saved.size()) + "(%rbp), %rsp");
+    for (size_t i = saved.size(); i-- > 0;) {
+        line(string("popq ") + saved[i]);
+    }
+    line("popq %rbp");
+    line("ret");
+    line(".size " + name + ", .-" + name);
+}
+
+void put_string(buffered_writer &out, const string &text) {
+    out.put('"');
+    for (char c: text) {
+        unsigned char byte = static_cast<unsigned char>(c);
+        if (c == '"' || c == '\\') {
+            out.put('\\');
+            out.put(c);
+        } else if (byte < ' ' || byte >= 0x7F) {
+            char octal[8];
+            snprintf(octal, sizeof octal, "\\%03o", byte);
+            out.put(octal);
+        } else {
+            out.put(c);
+        }
+    }
+    out.put('"');
+}
+
+bool emit_asm(FILE *file, const vm_program &program,
+              const char *allocator) {
+    buffered_writer out(file);
+
+    if (!program.globals.empty()) out.put("\t.bss\n");
+    for (const string &global: program.globals) {
+        out.put("\t.align 8\n_0_");
+        out.put(global);
+        out.put(":\n\t.zero 8\n");
+    }
+
+    // Writable, like the arrays --build makes of them.
+    if (!program.strings.empty()) out.put("\t.data\n");
+    for (size_t i = 0; i < program.strings.size(); i++) {
+        out.put(".LS");
+        out.put_size(i);
+        out.put(":\n\t.string ");
+        put_string(out, program.strings[i]);
+        out.put('\n');
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < program.functions.size(); i++) {
+        asm_function function(program, i, allocator, out);
+        function.emit();
+        ok = ok && function.ok;
+    }
+    out.put("\t.section .note.GNU-stack,\"\",@progbits\n");
+    return ok;
+}
@@ -0,0 +1,20 @@
+#ifndef __VM_ASM_H__
+#define __VM_ASM_H__
+
+#include <cstdio>
+
+#include "vm_code.h"
+
+// x86-64 assembly in GNU as syntax for the System V ABI, translated
+// from the same bytecode --run and --build use.  Each function's
+// registers are given the callee-saved machine registers by a linear
+// scan over their live ranges, and those left over live in its stack
+// frame.  Ints are computed in 32 bits and kept sign-extended, as in
+// the C from --build, and there are no runtime checks.  The result
+// links against oclib.c, which supplies main, the builtins and the
+// allocator, xcalloc or arena_calloc.  Bytecode it has no translation
+// for is reported with errprintf(); returns false if there was any.
+bool emit_asm(FILE *out, const vm_program &program,
+              const char *allocator);
+
+#endif
@@ -0,0 +1,103 @@
+#include "vm_code.h"
+
+const char *const OPCODE_NAMES[] = {
+    "loadi", "loads", "move", "getg", "setg", "add", "addi", "sub",
+    "mul", "div", "rem", "neg", "not", "eq", "ne", "lt", "le", "gt",
+    "ge", "jump", "jumpf", "call", "builtin", "return", "returnv",
+    "newstruct", "newarray", "newstring", "getf", "setf", "getx",
+    "setx", "getc", "setc",
+};
+static_assert(sizeof OPCODE_NAMES / sizeof *OPCODE_NAMES == VM_OPCODES,
+              "one name per opcode");
+
+const char *const BUILTIN_NAMES[] = {
+    "putb", "putc", "puti", "puts", "endl", "getc", "getw", "getln",
+    "getargv", "exit", "__assert_fail",
+};
+static_assert(sizeof BUILTIN_NAMES / sizeof *BUILTIN_NAMES
+              == VM_BUILTINS, "one name per builtin");
+
+const char *vm_opcode_name(vm_opcode opcode) {
+    return OPCODE_NAMES[opcode];
+}
+
+const char *vm_builtin_name(vm_builtin builtin) {
+    return BUILTIN_NAMES[builtin];
+}
+
+void dump_instr(FILE *out, const vm_program &program,
+                const vm_instr &instr) {
+    fprintf(out, "%-10s", vm_opcode_name(instr.opcode));
+    switch (instr.opcode) {
+        case VM_LOADI:
+            fprintf(out, "r%u, %d", instr.a, instr.wide());
+            break;
+        case VM_LOADS:
+            fprintf(out, "r%u, \"%s\"", instr.a,
+                    program.strings[instr.wide()].c_str());
+            break;
+        case VM_GETG:
+        case VM_SETG:
+            fprintf(out, "r%u, %s", instr.a,
+                    program.globals[instr.wide()].c_str());
+            break;
+        case VM_JUMP:
+            fprintf(out, "%d", instr.wide());
+            break;
+        case VM_JUMPF:
+            fprintf(out, "r%u, %d", instr.a, instr.wide());
+            break;
+        case VM_CALL:
+            fprintf(out, "r%u, %s, r%u", instr.a,
+                    program.functions[instr.b].name.c_str(), instr.c);
+            break;
+        case VM_BUILTIN:
+            fprintf(out, "r%u, %s, r%u", instr.a,
+                    vm_builtin_name(static_cast<vm_builtin>(instr.b)),
+                    instr.c);
+            break;
+        case VM_RETURN:
+            fprintf(out, "r%u", instr.a);
+            break;
+        case VM_RETURNV:
+            break;
+        case VM_MOVE:
+        case VM_NEG:
+        case VM_NOT:
+        case VM_NEWSTRING:
+            fprintf(out, "r%u, r%u", instr.a, instr.b);
+            break;
+        case VM_NEWARRAY:
+            fprintf(out, "r%u, r%u%s", instr.a, instr.b,
+                    instr.c ? ", pointers" : "");
+            break;
+        case VM_NEWSTRUCT:
+            fprintf(out, "r%u, %s", instr.a,
+                    program.structs[instr.c].name.c_str());
+            break;
+        case VM_ADDI:
+            fprintf(out, "r%u, r%u, %d", instr.a, instr.b,
+                    static_cast<int16_t>(instr.c));
+            break;
+        case VM_GETF:
+        case VM_SETF:
+            fprintf(out, "r%u, r%u, %u", instr.a, instr.b, instr.c);
+            break;
+        default:
+            fprintf(out, "r%u, r%u, r%u", instr.a, instr.b, instr.c);
+            break;
+    }
+}
+
+void dump_vm(FILE *out, const vm_program &program) {
+    for (const vm_function &function: program.functions) {
+        fprintf(out, "%s: %zu params, %zu registers\n",
+                function.name.c_str(), function.params,
+                function.registers);
+        for (size_t i = 0; i < function.code.size(); i++) {
+            fprintf(out, "%6zu  ", i);
+            dump_instr(out, program, function.code[i]);
+            fprintf(out, "\n");
+        }
+    }
+}
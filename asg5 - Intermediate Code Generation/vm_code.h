@@ -0,0 +1,117 @@
+#ifndef __VM_CODE_H__
+#define __VM_CODE_H__
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// Bytecode for the oc virtual machine.  Each function works on a
+// window of registers: its parameters come first, then its locals,
+// then temporaries.  A call names the register where the callee's
+// window starts, with the arguments already in place there, so
+// nothing is copied.  Every value is one vm_word: an int, or the
+// address of a string, struct or array.
+
+using vm_word = intptr_t;
+
+enum vm_opcode : uint16_t {
+    VM_LOADI,       // a = wide
+    VM_LOADS,       // a = string literal wide
+    VM_MOVE,        // a = b
+    VM_GETG,        // a = global wide
+    VM_SETG,        // global wide = a
+    VM_ADD,         // a = b + c
+    VM_ADDI,        // a = b + (int16_t) c
+    VM_SUB,         // a = b - c
+    VM_MUL,         // a = b * c
+    VM_DIV,         // a = b / c
+    VM_REM,         // a = b % c
+    VM_NEG,         // a = -b
+    VM_NOT,         // a = !b
+    VM_EQ,          // a = b == c
+    VM_NE,          // a = b != c
+    VM_LT,          // a = b < c
+    VM_LE,          // a = b <= c
+    VM_GT,          // a = b > c
+    VM_GE,          // a = b >= c
+    VM_JUMP,        // goto wide
+    VM_JUMPF,       // if (!a) goto wide
+    VM_CALL,        // a = function b (window at c)
+    VM_BUILTIN,     // a = builtin b (window at c)
+    VM_RETURN,      // return a
+    VM_RETURNV,     // return
+    VM_NEWSTRUCT,   // a = struct c, of b fields
+    VM_NEWARRAY,    // a = array of b elements, pointers if c
+    VM_NEWSTRING,   // a = string of b chars
+    VM_GETF,        // a = b->field c
+    VM_SETF,        // b->field c = a
+    VM_GETX,        // a = b[c]
+    VM_SETX,        // b[c] = a
+    VM_GETC,        // a = char b[c]
+    VM_SETC,        // char b[c] = a
+    VM_OPCODES
+};
+
+enum vm_builtin : uint16_t {
+    VM_PUTB, VM_PUTC, VM_PUTI, VM_PUTS, VM_ENDL, VM_GETCHAR,
+    VM_GETW, VM_GETLN, VM_GETARGV, VM_EXIT, VM_ASSERT_FAIL,
+    VM_BUILTINS
+};
+
+// Operands are register numbers, or small numbers the opcode names.
+// Jump targets, immediates and table indices that may need more than
+// 16 bits are split across b and c.
+struct vm_instr {
+    vm_opcode opcode;
+    uint16_t a = 0;
+    uint16_t b = 0;
+    uint16_t c = 0;
+
+    int32_t wide() const {
+        return static_cast<int32_t>(b | static_cast<uint32_t>(c) << 16);
+    }
+    void set_wide(int32_t value) {
+        b = static_cast<uint16_t>(value);
+        c = static_cast<uint16_t>(static_cast<uint32_t>(value) >> 16);
+    }
+};
+
+struct vm_function {
+    string name;
+    size_t params = 0;
+    size_t registers = 0;       // size of the window
+    vector<vm_instr> code;
+    vector<size_t> lines;       // source line of each instruction
+    vector<bool> pointers;      // registers ever given a pointer
+    unordered_map<size_t, size_t> selects;  // struct of each GETF, SETF
+    unordered_map<size_t, string> sites;    // if or while of each JUMPF
+};
+
+// The fields of a struct, and which of them hold pointers.
+struct vm_struct_map {
+    string name;
+    vector<bool> pointers;
+    vector<string> fields;
+};
+
+// Function 0 runs the top-level statements.  What is known of which
+// values are pointers is there for a collector, and the names of
+// fields and functions for a profile; the interpreter has no use for
+// either.
+struct vm_program {
+    vector<vm_function> functions;
+    vector<string> strings;
+    vector<string> globals;
+    vector<bool> global_pointers;
+    vector<vm_struct_map> structs;
+};
+
+const char *vm_opcode_name(vm_opcode opcode);
+const char *vm_builtin_name(vm_builtin builtin);
+void dump_vm(FILE *out, const vm_program &program);
+
+#endif
@@ -0,0 +1,775 @@
+#include <cstdlib>
+#include <unordered_map>
+
+#include "lyutils.h"
+#include "vm_compile.h"
+
+constexpr size_t NO_FUNCTION = static_cast<size_t>(-1);
+constexpr size_t NO_STRUCT = static_cast<size_t>(-1);
+constexpr size_t MAX_REGISTERS = UINT16_MAX;
+
+// Type of an expression, as far as the compiler needs it: "int",
+// "string", "null", "void" or the name of a struct, possibly as the
+// element type of an array.
+struct vm_type {
+    string base;
+    bool array = false;
+};
+
+struct vm_struct {
+    size_t index = NO_STRUCT;       // in program.structs
+    unordered_map<string, size_t> fields;
+    vector<vm_type> types;
+};
+
+// A function of the program, or a builtin if index is NO_FUNCTION.
+struct vm_signature {
+    size_t index = NO_FUNCTION;
+    vm_builtin builtin = VM_BUILTINS;
+    size_t params = 0;
+    vm_type result;
+};
+
+struct vm_variable {
+    uint16_t reg;
+    vm_type type;
+};
+
+using vm_scope = unordered_map<string, vm_variable>;
+
+struct vm_global {
+    size_t index;
+    vm_type type;
+};
+
+const struct {
+    const char *name;
+    size_t params;
+    const char *result;
+    bool array;
+} BUILTINS[] = {
+    {"putb", 1, "void", false},
+    {"putc", 1, "void", false},
+    {"puti", 1, "void", false},
+    {"puts", 1, "void", false},
+    {"endl", 0, "void", false},
+    {"getc", 0, "int", false},
+    {"getw", 0, "string", false},
+    {"getln", 0, "string", false},
+    {"getargv", 0, "string", true},
+    {"exit", 1, "void", false},
+    {"__assert_fail", 3, "void", false},
+};
+
+bool pointer_type(const vm_type &type) {
+    return type.array || (type.base != "int" && type.base != "void");
+}
+
+vm_type base_type(astree *node) {
+    switch (node->symbol) {
+        case TOK_INT:
+        case TOK_CHAR:
+            return {"int"};
+        case TOK_STRING:
+            return {"string"};
+        case TOK_VOID:
+            return {"void"};
+        default:
+            return {*node->lexinfo};
+    }
+}
+
+// An identdecl is a base type over its name, or an array over both.
+vm_type declared_type(astree *decl) {
+    if (decl->symbol == TOK_ARRAY) {
+        return {base_type(decl->children[0]).base, true};
+    }
+    return base_type(decl);
+}
+
+const string &declared_name(astree *decl) {
+    astree *name = decl->symbol == TOK_ARRAY ? decl->children[1]
+                                             : decl->children[0];
+    return *name->lexinfo;
+}
+
+string unescape(const string &text) {
+    string value;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] != '\\' || i + 1 == text.size()) {
+            value += text[i];
+            continue;
+        }
+        switch (text[++i]) {
+            case 'n': value += '\n'; break;
+            case 't': value += '\t'; break;
+            case '0': value += '\0'; break;
+            default:  value += text[i]; break;
+        }
+    }
+    return value;
+}
+
+int32_t constant_value(astree *node) {
+    const string &text = *node->lexinfo;
+    if (node->symbol == TOK_CHARCON) {
+        string value = unescape(text.substr(1, text.size() - 2));
+        return value.empty() ? 0 : static_cast<signed char>(value[0]);
+    }
+    long long value = strtoll(text.c_str(), nullptr, 10);
+    return static_cast<int32_t>(static_cast<uint32_t>(value));
+}
+
+vm_opcode binary_opcode(int symbol) {
+    switch (symbol) {
+        case '+':    return VM_ADD;
+        case '-':    return VM_SUB;
+        case '*':    return VM_MUL;
+        case '/':    return VM_DIV;
+        case '%':    return VM_REM;
+        case TOK_EQ: return VM_EQ;
+        case TOK_NE: return VM_NE;
+        case TOK_LT: return VM_LT;
+        case TOK_LE: return VM_LE;
+        case TOK_GT: return VM_GT;
+        default:     return VM_GE;
+    }
+}
+
+struct vm_compiler {
+    vm_program &program;
+    unordered_map<string, vm_struct> structs;
+    unordered_map<string, vm_signature> functions;
+    unordered_map<string, vm_global> globals;
+    unordered_map<string, size_t> literals;
+    size_t errors = 0;
+
+    // The function being compiled.
+    vm_function *function = nullptr;
+    vector<vm_scope> scopes;        // empty at the top level of main
+    size_t top = 0;                 // first free register
+    size_t line = 0;
+
+    explicit vm_compiler(vm_program &program_): program(program_) {}
+
+    void error(astree *node, const char *message);
+    void declare(astree *root);
+    void compile_function(astree *node, size_t index);
+    void compile_main(astree *root);
+
+    size_t emit(vm_opcode opcode, size_t a = 0, size_t b = 0,
+                size_t c = 0);
+    size_t emit_wide(vm_opcode opcode, size_t a, int32_t wide);
+    void patch(size_t jump);
+    uint16_t reserve(size_t count);
+    uint16_t result(int dst);
+    void holds(uint16_t reg, const vm_type &type);
+    size_t global(const string &name, const vm_type &type);
+    size_t literal(astree *node);
+    uint16_t field(astree *node, const vm_type &type, vm_type &result);
+    void selected(size_t at, const vm_type &type);
+
+    void statement(astree *node);
+    void block(astree *node);
+    void vardecl(astree *node);
+    void loop(astree *node);
+    void branch(astree *node);
+
+    uint16_t value(astree *node, vm_type &type, int dst = -1);
+    uint16_t expression(astree *node, vm_type &type, int dst);
+    uint16_t variable(astree *node, vm_type &type, int dst);
+    uint16_t assign(astree *node, vm_type &type, int dst);
+    uint16_t binary(astree *node, int dst);
+    uint16_t call(astree *node, vm_type &type, int dst);
+    uint16_t allocate(astree *node, vm_type &type, int dst);
+    uint16_t select(astree *node, vm_type &type, int dst);
+};
+
+void vm_compiler::error(astree *node, const char *message) {
+    string format = string(message) + ": '%s'\n";
+    errllocprintf(node->lloc, format.c_str(), node->lexinfo->c_str());
+    errors++;
+}
+
+size_t vm_compiler::emit(vm_opcode opcode, size_t a, size_t b,
+                         size_t c) {
+    vm_instr instr;
+    instr.opcode = opcode;
+    instr.a = static_cast<uint16_t>(a);
+    instr.b = static_cast<uint16_t>(b);
+    instr.c = static_cast<uint16_t>(c);
+    function->code.push_back(instr);
+    function->lines.push_back(line);
+    return function->code.size() - 1;
+}
+
+size_t vm_compiler::emit_wide(vm_opcode opcode, size_t a,
+                              int32_t wide) {
+    size_t at = emit(opcode, a);
+    function->code[at].set_wide(wide);
+    return at;
+}
+
+// Points a forward jump at the next instruction.
+void vm_compiler::patch(size_t jump) {
+    function->code[jump].set_wide(
+            static_cast<int32_t>(function->code.size()));
+}
+
+uint16_t vm_compiler::reserve(size_t count) {
+    size_t first = top;
+    top += count;
+    if (top > MAX_REGISTERS) {
+        errprintf("Error: %s needs more than %zu registers\n",
+                  function->name.c_str(), MAX_REGISTERS);
+        errors++;
+        top = first;
+        return 0;
+    }
+    if (top > function->registers) function->registers = top;
+    return static_cast<uint16_t>(first);
+}
+
+uint16_t vm_compiler::result(int dst) {
+    return dst >= 0 ? static_cast<uint16_t>(dst) : reserve(1);
+}
+
+// Notes that reg is given a value of type, for the pointer map.
+void vm_compiler::holds(uint16_t reg, const vm_type &type) {
+    if (!pointer_type(type)) return;
+    if (reg >= function->pointers.size()) {
+        function->pointers.resize(reg + 1);
+    }
+    function->pointers[reg] = true;
+}
+
+size_t vm_compiler::global(const string &name, const vm_type &type) {
+    auto found = globals.find(name);
+    if (found != globals.end()) return found->second.index;
+    size_t index = program.globals.size();
+    program.globals.push_back(name);
+    program.global_pointers.push_back(pointer_type(type));
+    globals[name] = {index, type};
+    return index;
+}
+
+size_t vm_compiler::literal(astree *node) {
+    const string &text = *node->lexinfo;
+    auto found = literals.find(text);
+    if (found != literals.end()) return found->second;
+    size_t index = program.strings.size();
+    program.strings.push_back(unescape(text.substr(1, text.size() - 2)));
+    literals[text] = index;
+    return index;
+}
+
+uint16_t vm_compiler::field(astree *node, const vm_type &type,
+                            vm_type &result) {
+    result = {"int"};
+    auto found = structs.find(type.base);
+    if (type.array || found == structs.end()) {
+        error(node, "field of something that is not a struct");
+        return 0;
+    }
+    auto index = found->second.fields.find(*node->lexinfo);
+    if (index == found->second.fields.end()) {
+        error(node, "no such field");
+        return 0;
+    }
+    result = found->second.types[index->second];
+    return static_cast<uint16_t>(index->second);
+}
+
+// Notes which struct the GETF or SETF at offset at selects from.
+void vm_compiler::selected(size_t at, const vm_type &type) {
+    auto found = structs.find(type.base);
+    if (found != structs.end()) {
+        function->selects[at] = found->second.index;
+    }
+}
+
+// Collects structs, functions and globals, so that code may use them
+// before the point where they are declared.
+void vm_compiler::declare(astree *root) {
+    program.functions.emplace_back();
+    program.functions[0].name = "__ocmain";
+
+    for (size_t i = 0; i < sizeof BUILTINS / sizeof *BUILTINS; i++) {
+        vm_signature &builtin = functions[BUILTINS[i].name];
+        builtin.builtin = static_cast<vm_builtin>(i);
+        builtin.params = BUILTINS[i].params;
+        builtin.result = {BUILTINS[i].result, BUILTINS[i].array};
+    }
+
+    for (astree *child: root->children) {
+        switch (child->symbol) {
+            case TOK_STRUCT: {
+                const string &name = *child->children[0]->lexinfo;
+                vm_struct &def = structs[name];
+                if (def.index == NO_STRUCT) {
+                    def.index = program.structs.size();
+                    program.structs.push_back({name, {}, {}});
+                }
+                vm_struct_map &map = program.structs[def.index];
+                for (size_t i = 1; i < child->children.size(); i++) {
+                    astree *decl = child->children[i];
+                    def.fields[declared_name(decl)] = def.types.size();
+                    def.types.push_back(declared_type(decl));
+                    map.pointers.push_back(pointer_type(def.types.back()));
+                    map.fields.push_back(declared_name(decl));
+                }
+                break;
+            }
+            case TOK_FUNCTION: {
+                astree *decl = child->children[0];
+                vm_signature &signature = functions[declared_name(decl)];
+                if (signature.index != NO_FUNCTION) {
+                    error(child->children[0], "function defined twice");
+                    break;
+                }
+                signature.index = program.functions.size();
+                signature.params = child->children[1]->children.size();
+                signature.result = declared_type(decl);
+                program.functions.emplace_back();
+                program.functions.back().name = declared_name(decl);
+                program.functions.back().params = signature.params;
+                break;
+            }
+            case TOK_VARDECL: {
+                astree *decl = child->children[0];
+                global(declared_name(decl), declared_type(decl));
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    if (program.functions.size() > UINT16_MAX) {
+        errprintf("Error: more than %d functions\n", UINT16_MAX);
+        errors++;
+    }
+}
+
+void vm_compiler::compile_function(astree *node, size_t index) {
+    function = &program.functions[index];
+    scopes.assign(1, vm_scope());
+    top = 0;
+    line = node->lloc.linenr;
+    for (astree *param: node->children[1]->children) {
+        uint16_t reg = reserve(1);
+        scopes[0][declared_name(param)] = {reg, declared_type(param)};
+        holds(reg, declared_type(param));
+    }
+    block(node->children[2]);
+    emit(VM_RETURNV);
+}
+
+void vm_compiler::compile_main(astree *root) {
+    function = &program.functions[0];
+    scopes.clear();
+    top = 0;
+    for (astree *child: root->children) {
+        switch (child->symbol) {
+            case TOK_STRUCT:
+            case TOK_FUNCTION:
+            case TOK_PROTOTYPE:
+                break;
+            default:
+                statement(child);
+                break;
+        }
+    }
+    emit(VM_RETURNV);
+}
+
+void vm_compiler::statement(astree *node) {
+    if (node->lloc.linenr != 0) line = node->lloc.linenr;
+    switch (node->symbol) {
+        case TOK_BLOCK:
+            block(node);
+            break;
+        case TOK_VARDECL:
+            vardecl(node);
+            break;
+        case TOK_WHILE:
+            loop(node);
+            break;
+        case TOK_IF:
+        case TOK_IFELSE:
+            branch(node);
+            break;
+        case TOK_RETURN: {
+            size_t mark = top;
+            vm_type type;
+            emit(VM_RETURN, value(node->children[0], type));
+            top = mark;
+            break;
+        }
+        case TOK_RETURNVOID:
+            emit(VM_RETURNV);
+            break;
+        case ';':
+            break;
+        default: {
+            size_t mark = top;
+            vm_type type;
+            value(node, type);
+            top = mark;
+            break;
+        }
+    }
+}
+
+void vm_compiler::block(astree *node) {
+    size_t mark = top;
+    scopes.emplace_back();
+    for (astree *child: node->children) {
+        statement(child);
+    }
+    scopes.pop_back();
+    top = mark;
+}
+
+// A local keeps the register its value is computed into for the rest
+// of its block; it is bound only afterwards, so the initializer still
+// sees any outer variable of the same name.
+void vm_compiler::vardecl(astree *node) {
+    astree *decl = node->children[0];
+    vm_type type = declared_type(decl);
+    vm_type init;
+    if (scopes.empty()) {
+        size_t index = global(declared_name(decl), type);
+        size_t mark = top;
+        emit_wide(VM_SETG, value(node->children[1], init),
+                  static_cast<int32_t>(index));
+        top = mark;
+    } else {
+        uint16_t reg = reserve(1);
+        holds(reg, type);
+        value(node->children[1], init, reg);
+        scopes.back()[declared_name(decl)] = {reg, type};
+    }
+}
+
+void vm_compiler::loop(astree *node) {
+    size_t head = function->code.size();
+    size_t mark = top;
+    vm_type type;
+    uint16_t test = value(node->children[0], type);
+    line = node->lloc.linenr;
+    size_t exit = emit(VM_JUMPF, test);
+    function->sites[exit] = location_key(node->lloc);
+    top = mark;
+    statement(node->children[1]);
+    emit_wide(VM_JUMP, 0, static_cast<int32_t>(head));
+    patch(exit);
+}
+
+void vm_compiler::branch(astree *node) {
+    size_t mark = top;
+    vm_type type;
+    uint16_t test = value(node->children[0], type);
+    line = node->lloc.linenr;
+    size_t skip = emit(VM_JUMPF, test);
+    function->sites[skip] = location_key(node->lloc);
+    top = mark;
+    statement(node->children[1]);
+    if (node->symbol == TOK_IFELSE) {
+        size_t done = emit(VM_JUMP);
+        patch(skip);
+        statement(node->children[2]);
+        patch(done);
+    } else {
+        patch(skip);
+    }
+}
+
+// Computes the value of an expression into dst, or if dst is -1 into
+// whatever register is handiest: the variable itself for a local, a
+// new temporary otherwise.  Temporaries above top stay in use until
+// the statement ends.
+uint16_t vm_compiler::value(astree *node, vm_type &type, int dst) {
+    uint16_t reg = expression(node, type, dst);
+    holds(reg, type);
+    return reg;
+}
+
+uint16_t vm_compiler::expression(astree *node, vm_type &type,
+                                 int dst) {
+    if (node->lloc.linenr != 0) line = node->lloc.linenr;
+    switch (node->symbol) {
+        case TOK_INTCON:
+        case TOK_CHARCON: {
+            type = {"int"};
+            uint16_t reg = result(dst);
+            emit_wide(VM_LOADI, reg, constant_value(node));
+            return reg;
+        }
+        case TOK_STRINGCON: {
+            type = {"string"};
+            uint16_t reg = result(dst);
+            emit_wide(VM_LOADS, reg,
+                      static_cast<int32_t>(literal(node)));
+            return reg;
+        }
+        case TOK_NULL: {
+            type = {"null"};
+            uint16_t reg = result(dst);
+            emit_wide(VM_LOADI, reg, 0);
+            return reg;
+        }
+        case TOK_IDENT:
+            return variable(node, type, dst);
+        case '=':
+            return assign(node, type, dst);
+        case TOK_CALL:
+            return call(node, type, dst);
+        case TOK_POS: {
+            uint16_t reg = value(node->children[0], type, dst);
+            type = {"int"};
+            return reg;
+        }
+        case TOK_NEG:
+        case '!': {
+            type = {"int"};
+            uint16_t reg = result(dst);
+            size_t mark = top;
+            vm_type operand;
+            uint16_t src = value(node->children[0], operand);
+            emit(node->symbol == '!' ? VM_NOT : VM_NEG, reg, src);
+            top = mark;
+            return reg;
+        }
+        case '+':
+        case '-':
+        case '*':
+        case '/':
+        case '%':
+        case TOK_EQ:
+        case TOK_NE:
+        case TOK_LT:
+        case TOK_LE:
+        case TOK_GT:
+        case TOK_GE:
+            type = {"int"};
+            return binary(node, dst);
+        case TOK_NEW:
+        case TOK_NEWSTRING:
+        case TOK_NEWARRAY:
+            return allocate(node, type, dst);
+        case TOK_INDEX:
+        case '.':
+            return select(node, type, dst);
+        default:
+            error(node, "not an expression");
+            type = {"int"};
+            return result(dst);
+    }
+}
+
+uint16_t vm_compiler::variable(astree *node, vm_type &type, int dst) {
+    const string &name = *node->lexinfo;
+    for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+        auto found = scope->find(name);
+        if (found == scope->end()) continue;
+        type = found->second.type;
+        if (dst < 0) return found->second.reg;
+        emit(VM_MOVE, dst, found->second.reg);
+        return static_cast<uint16_t>(dst);
+    }
+    uint16_t reg = result(dst);
+    auto found = globals.find(name);
+    if (found == globals.end()) {
+        error(node, "undeclared identifier");
+        type = {"int"};
+        return reg;
+    }
+    type = found->second.type;
+    emit_wide(VM_GETG, reg, static_cast<int32_t>(found->second.index));
+    return reg;
+}
+
+uint16_t vm_compiler::assign(astree *node, vm_type &type, int dst) {
+    astree *left = node->children[0];
+    astree *right = node->children[1];
+    vm_type assigned;
+    if (left->symbol == TOK_IDENT) {
+        for (auto scope = scopes.rbegin(); scope != scopes.rend();
+             ++scope) {
+            auto found = scope->find(*left->lexinfo);
+            if (found == scope->end()) continue;
+            uint16_t reg = found->second.reg;
+            type = found->second.type;
+            value(right, assigned, reg);
+            if (dst < 0) return reg;
+            if (dst != reg) emit(VM_MOVE, dst, reg);
+            return static_cast<uint16_t>(dst);
+        }
+        uint16_t reg = result(dst);
+        auto found = globals.find(*left->lexinfo);
+        if (found == globals.end()) {
+            error(left, "undeclared identifier");
+            type = {"int"};
+            return reg;
+        }
+        type = found->second.type;
+        value(right, assigned, reg);
+        emit_wide(VM_SETG, reg,
+                  static_cast<int32_t>(found->second.index));
+        return reg;
+    }
+
+    uint16_t reg = result(dst);
+    size_t mark = top;
+    vm_type object;
+    uint16_t base = value(left->children[0], object);
+    if (left->symbol == TOK_INDEX) {
+        vm_type index;
+        uint16_t at = value(left->children[1], index);
+        value(right, assigned, reg);
+        if (object.array) {
+            type = {object.base};
+            emit(VM_SETX, reg, base, at);
+        } else if (object.base == "string") {
+            type = {"int"};
+            emit(VM_SETC, reg, base, at);
+        } else {
+            error(left, "index into something that is not an array");
+        }
+    } else if (left->symbol == '.') {
+        uint16_t slot = field(left->children[1], object, type);
+        value(right, assigned, reg);
+        selected(emit(VM_SETF, reg, base, slot), object);
+    } else {
+        error(left, "assignment to something that is not a variable");
+    }
+    top = mark;
+    return reg;
+}
+
+// Adding or subtracting a constant that fits in 16 bits, as counters
+// do, takes one instruction and no register for the constant.
+uint16_t vm_compiler::binary(astree *node, int dst) {
+    uint16_t reg = result(dst);
+    size_t mark = top;
+    vm_type type;
+    uint16_t left = value(node->children[0], type);
+    astree *right = node->children[1];
+    if ((node->symbol == '+' || node->symbol == '-')
+        && right->symbol == TOK_INTCON) {
+        long step = constant_value(right);
+        if (node->symbol == '-') step = -step;
+        if (step >= INT16_MIN && step <= INT16_MAX) {
+            emit(VM_ADDI, reg, left,
+                 static_cast<uint16_t>(static_cast<int16_t>(step)));
+            top = mark;
+            return reg;
+        }
+    }
+    emit(binary_opcode(node->symbol), reg, left, value(right, type));
+    top = mark;
+    return reg;
+}
+
+// Arguments go into consecutive registers above everything in use,
+// which become the first registers of the callee's window.
+uint16_t vm_compiler::call(astree *node, vm_type &type, int dst) {
+    astree *name = node->children[0];
+    size_t args = node->children.size() - 1;
+    uint16_t reg = result(dst);
+    type = {"int"};
+    auto found = functions.find(*name->lexinfo);
+    if (found == functions.end()) {
+        error(name, "undefined function");
+        return reg;
+    }
+    const vm_signature &signature = found->second;
+    if (signature.params != args) {
+        error(name, "wrong number of arguments");
+        return reg;
+    }
+
+    size_t mark = top;
+    uint16_t window = reserve(args);
+    for (size_t i = 0; i < args; i++) {
+        vm_type arg;
+        value(node->children[i + 1], arg, window + i);
+    }
+    if (signature.index != NO_FUNCTION) {
+        emit(VM_CALL, reg, signature.index, window);
+    } else {
+        emit(VM_BUILTIN, reg, signature.builtin, window);
+    }
+    top = mark;
+    type = signature.result;
+    return reg;
+}
+
+uint16_t vm_compiler::allocate(astree *node, vm_type &type, int dst) {
+    uint16_t reg = result(dst);
+    size_t mark = top;
+    vm_type size;
+    switch (node->symbol) {
+        case TOK_NEW: {
+            type = base_type(node->children[0]);
+            auto found = structs.find(type.base);
+            if (found == structs.end()) {
+                error(node->children[0], "undefined struct");
+                break;
+            }
+            emit(VM_NEWSTRUCT, reg, found->second.types.size(),
+                 found->second.index);
+            break;
+        }
+        case TOK_NEWSTRING:
+            type = {"string"};
+            emit(VM_NEWSTRING, reg, value(node->children[0], size));
+            break;
+        default:
+            type = {base_type(node->children[0]).base, true};
+            emit(VM_NEWARRAY, reg, value(node->children[1], size),
+                 pointer_type({type.base}));
+            break;
+    }
+    top = mark;
+    return reg;
+}
+
+uint16_t vm_compiler::select(astree *node, vm_type &type, int dst) {
+    uint16_t reg = result(dst);
+    size_t mark = top;
+    vm_type object;
+    uint16_t base = value(node->children[0], object);
+    if (node->symbol == '.') {
+        uint16_t slot = field(node->children[1], object, type);
+        selected(emit(VM_GETF, reg, base, slot), object);
+    } else {
+        vm_type index;
+        uint16_t at = value(node->children[1], index);
+        if (object.array) {
+            type = {object.base};
+            emit(VM_GETX, reg, base, at);
+        } else if (object.base == "string") {
+            type = {"int"};
+            emit(VM_GETC, reg, base, at);
+        } else {
+            type = {"int"};
+            error(node, "index into something that is not an array");
+        }
+    }
+    top = mark;
+    return reg;
+}
+
+bool compile_vm(vm_program &program, astree *root) {
+    vm_compiler compiler(program);
+    compiler.declare(root);
+    for (astree *child: root->children) {
+        if (child->symbol != TOK_FUNCTION) continue;
+        const string &name = declared_name(child->children[0]);
+        compiler.compile_function(child,
+                                  compiler.functions[name].index);
+    }
+    compiler.compile_main(root);
+    return compiler.errors == 0;
+}
@@ -0,0 +1,17 @@
+#ifndef __VM_COMPILE_H__
+#define __VM_COMPILE_H__
+
+#include "astree.h"
+#include "vm_code.h"
+
+// Compiles the parsed program into bytecode for run_vm().  The type
+// checker does not annotate every expression, so names are resolved
+// here against block scopes, parameters and globals, and each
+// expression's type is worked out as far as indexing and field access
+// need it.  Calls to a function the program declares but never
+// defines go to the builtin of the same name from oclib.oh.  Errors
+// are reported with errllocprintf(); returns false if there were any.
+// Must run before lower_oil(), which renames nodes as it goes.
+bool compile_vm(vm_program &program, astree *root);
+
+#endif
@@ -0,0 +1,453 @@
+#include <cstring>
+#include <initializer_list>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "vm_jit.h"
+#include "vm_run.h"
+
+#if defined(__x86_64__)
+
+constexpr size_t NATIVE_STACK = 64 << 20;
+constexpr size_t STACK_MARGIN = 256 << 10;  // left for the runtime
+
+// Machine registers, by their number in the instruction encoding.
+// Translated code keeps the window in rbx, the end of the window
+// stack in r12, the lowest safe native stack address in r13 and the
+// globals in r14.
+enum jit_reg : uint8_t { RAX = 0, RCX = 1, RDX = 2, RSI = 6, RDI = 7 };
+
+// Second byte of a conditional near jump.
+enum jit_cond : uint8_t {
+    JB = 0x82, JAE = 0x83, JZ = 0x84, JA = 0x87, JS = 0x88,
+};
+
+struct jit_patch {
+    size_t at;          // a rel32 to fill in
+    size_t target;      // function or instruction it goes to
+};
+
+struct jit_stub {
+    size_t at;
+    size_t instr;
+    const char *message;
+};
+
+struct jit_writer {
+    const vm_program &program;
+    const vm_memory &memory;
+    vector<uint8_t> code;
+    vector<size_t> entries;     // offset of each function
+    vector<jit_patch> calls;
+
+    // The function being translated.
+    const vm_function *function = nullptr;
+    vector<size_t> starts;      // offset of each instruction
+    vector<jit_patch> jumps;
+    vector<jit_stub> stubs;     // failed checks
+
+    jit_writer(const vm_program &program_, const vm_memory &memory_)
+            : program(program_), memory(memory_),
+              entries(program_.functions.size()) {
+    }
+
+    void put(initializer_list<uint8_t> bytes);
+    void put32(uint32_t value);
+    void put64(uint64_t value);
+    void patch(size_t at, size_t target);
+    void slot(uint8_t rex, initializer_list<uint8_t> opcode,
+              jit_reg reg, size_t number);
+    void load(size_t number);
+    void store(size_t number);
+    void runtime(uint64_t address);
+    void jump(initializer_list<uint8_t> opcode, size_t target);
+    void check(jit_cond cond, size_t instr, const char *message);
+
+    void enter();
+    void translate(size_t index);
+    void arithmetic(const vm_instr &instr, size_t at);
+    void memory_access(const vm_instr &instr, size_t at);
+    void instruction(const vm_instr &instr, size_t at);
+};
+
+template <typename pointer>
+uint64_t address(pointer value) {
+    return reinterpret_cast<uint64_t>(value);
+}
+
+void jit_writer::put(initializer_list<uint8_t> bytes) {
+    code.insert(code.end(), bytes.begin(), bytes.end());
+}
+
+void jit_writer::put32(uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        code.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+void jit_writer::put64(uint64_t value) {
+    put32(static_cast<uint32_t>(value));
+    put32(static_cast<uint32_t>(value >> 32));
+}
+
+void jit_writer::patch(size_t at, size_t target) {
+    uint32_t rel = static_cast<uint32_t>(target - (at + 4));
+    for (int i = 0; i < 4; i++) {
+        code[at + i] = static_cast<uint8_t>(rel >> (8 * i));
+    }
+}
+
+// An instruction whose memory operand is window register number,
+// at [rbx + 8 * number].
+void jit_writer::slot(uint8_t rex, initializer_list<uint8_t> opcode,
+                      jit_reg reg, size_t number) {
+    if (rex != 0) code.push_back(rex);
+    put(opcode);
+    code.push_back(static_cast<uint8_t>(0x83 | reg << 3));
+    put32(static_cast<uint32_t>(8 * number));
+}
+
+void jit_writer::load(size_t number) {
+    slot(0x48, {0x8B}, RAX, number);            // mov rax, [slot]
+}
+
+void jit_writer::store(size_t number) {
+    slot(0x48, {0x89}, RAX, number);            // mov [slot], rax
+}
+
+// Translated code never pushes, so the stack is aligned for a call.
+void jit_writer::runtime(uint64_t target) {
+    put({0x48, 0xB8});                          // mov rax, target
+    put64(target);
+    put({0xFF, 0xD0});                          // call rax
+}
+
+void jit_writer::jump(initializer_list<uint8_t> opcode, size_t target) {
+    put(opcode);
+    jumps.push_back({code.size(), target});
+    put32(0);
+}
+
+void jit_writer::check(jit_cond cond, size_t instr,
+                       const char *message) {
+    put({0x0F, cond});
+    stubs.push_back({code.size(), instr, message});
+    put32(0);
+}
+
+// Called from C as
+//     enter (window, stack_top, window_end, stack_floor, globals, fn)
+// it saves the callee-saved registers, switches to the new stack and
+// calls fn.
+void jit_writer::enter() {
+    put({0x55, 0x53, 0x41, 0x54, 0x41, 0x55,   // push rbp, rbx, r12,
+         0x41, 0x56, 0x41, 0x57});              // r13, r14, r15
+    put({0x48, 0x89, 0xE5});                    // mov rbp, rsp
+    put({0x48, 0x89, 0xF4});                    // mov rsp, rsi
+    put({0x49, 0x89, 0xD4});                    // mov r12, rdx
+    put({0x49, 0x89, 0xCD});                    // mov r13, rcx
+    put({0x4D, 0x89, 0xC6});                    // mov r14, r8
+    put({0x41, 0xFF, 0xD1});                    // call r9
+    put({0x48, 0x89, 0xEC});                    // mov rsp, rbp
+    put({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D,   // pop r15, r14, r13,
+         0x41, 0x5C, 0x5B, 0x5D});              // r12, rbx, rbp
+    put({0xC3});                                // ret
+}
+
+void jit_writer::translate(size_t index) {
+    function = &program.functions[index];
+    entries[index] = code.size();
+    starts.assign(function->code.size() + 1, 0);
+    jumps.clear();
+    stubs.clear();
+
+    put({0x53});                                // push rbx
+    put({0x48, 0x89, 0xFB});                    // mov rbx, rdi
+    put({0x4C, 0x39, 0xEC});                    // cmp rsp, r13
+    check(JB, 0, "stack overflow");
+    slot(0x48, {0x8D}, RAX, function->registers);
+    put({0x4C, 0x39, 0xE0});                    // cmp rax, r12
+    check(JA, 0, "stack overflow");
+
+    for (size_t at = 0; at < function->code.size(); at++) {
+        starts[at] = code.size();
+        instruction(function->code[at], at);
+    }
+    starts.back() = code.size();
+    for (const jit_patch &jump: jumps) {
+        patch(jump.at, starts[jump.target]);
+    }
+    for (const jit_stub &stub: stubs) {
+        patch(stub.at, code.size());
+        put({0x48, 0xBF});                      // mov rdi, function
+        put64(address(function));
+        put({0xBE});                            // mov esi, instr
+        put32(static_cast<uint32_t>(stub.instr));
+        put({0x48, 0xBA});                      // mov rdx, message
+        put64(address(stub.message));
+        runtime(address(&vm_fail));
+    }
+}
+
+// Ints are computed in 32 bits and sign-extended back into the slot.
+void jit_writer::arithmetic(const vm_instr &instr, size_t at) {
+    slot(0, {0x8B}, RAX, instr.b);              // mov eax, [b]
+    switch (instr.opcode) {
+        case VM_ADD:
+            slot(0, {0x03}, RAX, instr.c);      // add eax, [c]
+            break;
+        case VM_ADDI:
+            put({0x05});                        // add eax, c
+            put32(static_cast<uint32_t>(
+                    static_cast<int32_t>(static_cast<int16_t>(instr.c))));
+            break;
+        case VM_SUB:
+            slot(0, {0x2B}, RAX, instr.c);      // sub eax, [c]
+            break;
+        case VM_MUL:
+            slot(0, {0x0F, 0xAF}, RAX, instr.c);    // imul eax, [c]
+            break;
+        case VM_NEG:
+            put({0xF7, 0xD8});                  // neg eax
+            break;
+        default: {
+            bool rem = instr.opcode == VM_REM;
+            slot(0, {0x8B}, RCX, instr.c);      // mov ecx, [c]
+            put({0x85, 0xC9});                  // test ecx, ecx
+            check(JZ, at, "division by zero");
+            put({0x83, 0xF9, 0xFF});            // cmp ecx, -1
+            put({0x75, 0x04});                  // jne divide
+            if (rem) {
+                put({0x31, 0xC0});              // xor eax, eax
+            } else {
+                put({0xF7, 0xD8});              // neg eax
+            }
+            put({0xEB, static_cast<uint8_t>(rem ? 5 : 3)});  // jmp done
+            put({0x99, 0xF7, 0xF9});            // divide: cdq; idiv ecx
+            if (rem) put({0x89, 0xD0});         // mov eax, edx
+            break;
+        }
+    }
+    put({0x48, 0x63, 0xC0});                    // done: movsxd rax, eax
+    store(instr.a);
+}
+
+// Fields, array elements and chars of strings.  Array indices are
+// checked against the length before the data, and a string may be
+// read, but not written, at its terminating null.
+void jit_writer::memory_access(const vm_instr &instr, size_t at) {
+    switch (instr.opcode) {
+        case VM_GETF:
+            load(instr.b);
+            put({0x48, 0x85, 0xC0});            // test rax, rax
+            check(JZ, at, "null pointer");
+            put({0x48, 0x8B, 0x80});            // mov rax, [rax + 8c]
+            put32(8u * instr.c);
+            store(instr.a);
+            return;
+        case VM_SETF:
+            slot(0x48, {0x8B}, RCX, instr.b);   // mov rcx, [b]
+            put({0x48, 0x85, 0xC9});            // test rcx, rcx
+            check(JZ, at, "null pointer");
+            load(instr.a);
+            put({0x48, 0x89, 0x81});            // mov [rcx + 8c], rax
+            put32(8u * instr.c);
+            return;
+        default:
+            break;
+    }
+
+    slot(0x48, {0x8B}, RCX, instr.b);           // mov rcx, [b]
+    slot(0x48, {0x8B}, RDX, instr.c);           // mov rdx, [c]
+    put({0x48, 0x85, 0xC9});                    // test rcx, rcx
+    check(JZ, at, "null pointer");
+    put({0x48, 0x3B, 0x51, 0xF8});              // cmp rdx, [rcx - 8]
+    check(instr.opcode == VM_GETC ? JA : JAE, at, "index out of range");
+    switch (instr.opcode) {
+        case VM_GETX:
+            put({0x48, 0x8B, 0x04, 0xD1});      // mov rax, [rcx + 8rdx]
+            store(instr.a);
+            break;
+        case VM_SETX:
+            load(instr.a);
+            put({0x48, 0x89, 0x04, 0xD1});      // mov [rcx + 8rdx], rax
+            break;
+        case VM_GETC:
+            put({0x48, 0x0F, 0xBE, 0x04, 0x11});    // movsx rax, [rcx+rdx]
+            store(instr.a);
+            break;
+        default:
+            load(instr.a);
+            put({0x88, 0x04, 0x11});            // mov [rcx + rdx], al
+            break;
+    }
+}
+
+void jit_writer::instruction(const vm_instr &instr, size_t at) {
+    switch (instr.opcode) {
+        case VM_LOADI:
+            put({0x48, 0xC7, 0xC0});            // mov rax, wide
+            put32(static_cast<uint32_t>(instr.wide()));
+            store(instr.a);
+            break;
+        case VM_LOADS:
+            put({0x48, 0xB8});                  // mov rax, string
+            put64(static_cast<uint64_t>(memory.strings[instr.wide()]));
+            store(instr.a);
+            break;
+        case VM_MOVE:
+            load(instr.b);
+            store(instr.a);
+            break;
+        case VM_GETG:
+            put({0x49, 0x8B, 0x86});            // mov rax, [r14 + 8g]
+            put32(8u * static_cast<uint32_t>(instr.wide()));
+            store(instr.a);
+            break;
+        case VM_SETG:
+            load(instr.a);
+            put({0x49, 0x89, 0x86});            // mov [r14 + 8g], rax
+            put32(8u * static_cast<uint32_t>(instr.wide()));
+            break;
+        case VM_ADD:
+        case VM_ADDI:
+        case VM_SUB:
+        case VM_MUL:
+        case VM_DIV:
+        case VM_REM:
+        case VM_NEG:
+            arithmetic(instr, at);
+            break;
+        case VM_NOT:
+            load(instr.b);
+            put({0x48, 0x85, 0xC0});            // test rax, rax
+            put({0x0F, 0x94, 0xC0});            // sete al
+            put({0x0F, 0xB6, 0xC0});            // movzx eax, al
+            store(instr.a);
+            break;
+        case VM_EQ:
+        case VM_NE:
+        case VM_LT:
+        case VM_LE:
+        case VM_GT:
+        case VM_GE: {
+            static const uint8_t setcc[] = {
+                0x94, 0x95, 0x9C, 0x9E, 0x9F, 0x9D,
+            };
+            load(instr.b);
+            slot(0x48, {0x3B}, RAX, instr.c);   // cmp rax, [c]
+            put({0x0F, setcc[instr.opcode - VM_EQ], 0xC0});
+            put({0x0F, 0xB6, 0xC0});            // movzx eax, al
+            store(instr.a);
+            break;
+        }
+        case VM_JUMP:
+            jump({0xE9}, static_cast<size_t>(instr.wide()));
+            break;
+        case VM_JUMPF:
+            load(instr.a);
+            put({0x48, 0x85, 0xC0});            // test rax, rax
+            jump({0x0F, 0x84}, static_cast<size_t>(instr.wide()));
+            break;
+        case VM_CALL:
+            slot(0x48, {0x8D}, RDI, instr.c);   // lea rdi, [c]
+            put({0xE8});                        // call function b
+            calls.push_back({code.size(), instr.b});
+            put32(0);
+            store(instr.a);
+            break;
+        case VM_BUILTIN:
+            if (instr.b == VM_PUTS) {
+                load(instr.c);
+                put({0x48, 0x85, 0xC0});        // test rax, rax
+                check(JZ, at, "null pointer");
+            }
+            put({0xBF});                        // mov edi, b
+            put32(instr.b);
+            slot(0x48, {0x8D}, RSI, instr.c);   // lea rsi, [c]
+            put({0x48, 0xBA});                  // mov rdx, arguments
+            put64(static_cast<uint64_t>(memory.arguments));
+            runtime(address(&vm_call_builtin));
+            store(instr.a);
+            break;
+        case VM_RETURN:
+            load(instr.a);
+            put({0x5B, 0xC3});                  // pop rbx; ret
+            break;
+        case VM_RETURNV:
+            put({0x31, 0xC0, 0x5B, 0xC3});      // xor eax, eax; pop; ret
+            break;
+        case VM_NEWSTRUCT:
+            put({0xBF});                        // mov edi, b
+            put32(instr.b);
+            runtime(address(&vm_new_array));
+            store(instr.a);
+            break;
+        case VM_NEWARRAY:
+        case VM_NEWSTRING:
+            slot(0x48, {0x8B}, RDI, instr.b);   // mov rdi, [b]
+            put({0x48, 0x85, 0xFF});            // test rdi, rdi
+            if (instr.opcode == VM_NEWARRAY) {
+                check(JS, at, "negative array size");
+                runtime(address(&vm_new_array));
+            } else {
+                check(JS, at, "negative string size");
+                runtime(address(&vm_new_string));
+            }
+            store(instr.a);
+            break;
+        default:
+            memory_access(instr, at);
+            break;
+    }
+}
+
+using jit_entry = void (*)(vm_word *window, void *stack_top,
+                           vm_word *window_end, void *stack_floor,
+                           vm_word *globals, const void *function);
+
+int run_jit(const vm_program &program, int argc, char **argv) {
+    vm_memory memory(program, argc, argv);
+    jit_writer writer(program, memory);
+    writer.enter();
+    for (size_t i = 0; i < program.functions.size(); i++) {
+        writer.translate(i);
+    }
+    for (const jit_patch &call: writer.calls) {
+        writer.patch(call.at, writer.entries[call.target]);
+    }
+
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t size = (writer.code.size() + page - 1) / page * page;
+    void *text = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    void *stack = mmap(nullptr, NATIVE_STACK, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                       -1, 0);
+    if (text == MAP_FAILED || stack == MAP_FAILED) {
+        return run_vm(program, argc, argv);
+    }
+    memcpy(text, writer.code.data(), writer.code.size());
+    if (mprotect(text, size, PROT_READ | PROT_EXEC) != 0) {
+        return run_vm(program, argc, argv);
+    }
+
+    char *base = static_cast<char *>(text);
+    char *bottom = static_cast<char *>(stack);
+    jit_entry enter = reinterpret_cast<jit_entry>(text);
+    enter(memory.stack.data(), bottom + NATIVE_STACK,
+          memory.stack.data() + memory.stack.size(),
+          bottom + STACK_MARGIN, memory.globals.data(),
+          base + writer.entries[0]);
+    munmap(stack, NATIVE_STACK);
+    munmap(text, size);
+    return EXIT_SUCCESS;
+}
+
+#else
+
+int run_jit(const vm_program &program, int argc, char **argv) {
+    return run_vm(program, argc, argv);
+}
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef __VM_JIT_H__
+#define __VM_JIT_H__
+
+#include "vm_code.h"
+
+// Runs a compiled program as x86-64 machine code generated in memory:
+// each bytecode function becomes a native function taking its
+// register window in rdi, written into mmap'd pages that are then
+// made executable, and __ocmain is called directly.  Window registers
+// stay in memory; each instruction loads what it reads and stores
+// what it writes.  The builtins, allocation and error reports are the
+// interpreter's, called at their addresses in this process, and the
+// same runtime checks apply.  The code runs on a stack of its own so
+// that deep recursion is caught rather than crashing.  Returns the
+// exit status, or runs the interpreter instead if executable memory
+// cannot be had or the host is not x86-64.
+int run_jit(const vm_program &program, int argc, char **argv);
+
+#endif
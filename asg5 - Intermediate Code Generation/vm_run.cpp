@@ -0,0 +1,339 @@
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <libgen.h>
+
+#include "vm_run.h"
+
+struct vm_frame {
+    const vm_function *function;
+    const vm_instr *resume;
+    vm_word *window;
+    uint16_t dest;
+};
+
+const char *script = "oc";
+
+void vm_fail(const vm_function *function, size_t at,
+             const char *message) {
+    fflush(NULL);
+    fprintf(stderr, "%s:%zu: %s in %s\n", script, function->lines[at],
+            message, function->name.c_str());
+    exit(EXIT_FAILURE);
+}
+
+[[noreturn]] void out_of_memory() {
+    fflush(NULL);
+    fprintf(stderr, "%s: out of memory\n", script);
+    exit(EXIT_FAILURE);
+}
+
+// Arrays and strings are preceded by a word with their length.  A
+// string has room for its terminating null after that many chars.
+vm_word *vm_new_array(vm_word length) {
+    void *block = calloc(static_cast<size_t>(length) + 1,
+                         sizeof(vm_word));
+    if (block == nullptr) out_of_memory();
+    vm_word *words = static_cast<vm_word *>(block);
+    words[0] = length;
+    return words + 1;
+}
+
+char *vm_new_string(vm_word length) {
+    void *block = calloc(sizeof(vm_word) + static_cast<size_t>(length)
+                         + 1, 1);
+    if (block == nullptr) out_of_memory();
+    *static_cast<vm_word *>(block) = length;
+    return static_cast<char *>(block) + sizeof(vm_word);
+}
+
+char *copy_string(const char *text, size_t length) {
+    char *copy = vm_new_string(static_cast<vm_word>(length));
+    memcpy(copy, text, length);
+    return copy;
+}
+
+vm_word length_of(const void *data) {
+    return *(reinterpret_cast<const vm_word *>(data) - 1);
+}
+
+vm_word to_word(const void *pointer) {
+    return reinterpret_cast<vm_word>(pointer);
+}
+
+// Arithmetic wraps around at 32 bits, as int does in the C that
+// oclib.c is compiled with.
+uint32_t bits(vm_word value) {
+    return static_cast<uint32_t>(value);
+}
+
+vm_word wrap(uint32_t value) {
+    return static_cast<int32_t>(value);
+}
+
+// Reads like scan() in oclib.c: getw skips leading space and stops at
+// the next, getln takes the first char whatever it is and stops at a
+// newline.  Neither keeps the char it stops at.
+vm_word scan(bool word) {
+    int byte;
+    do {
+        byte = getchar();
+        if (byte == EOF) return 0;
+    } while (word && isspace(byte));
+    string text;
+    do {
+        text += static_cast<char>(byte);
+        byte = getchar();
+    } while (byte != EOF && !(word ? isspace(byte) : byte == '\n'));
+    return to_word(copy_string(text.data(), text.size()));
+}
+
+vm_word vm_call_builtin(vm_builtin builtin, const vm_word *args,
+                        vm_word argv) {
+    switch (builtin) {
+        case VM_PUTB:
+            printf("%s", static_cast<char>(args[0]) ? "true" : "false");
+            return 0;
+        case VM_PUTC:
+            printf("%c", static_cast<char>(args[0]));
+            return 0;
+        case VM_PUTI:
+            printf("%d", static_cast<int>(args[0]));
+            return 0;
+        case VM_PUTS:
+            printf("%s", reinterpret_cast<const char *>(args[0]));
+            return 0;
+        case VM_ENDL:
+            putchar('\n');
+            return 0;
+        case VM_GETCHAR:
+            return getchar();
+        case VM_GETW:
+            return scan(true);
+        case VM_GETLN:
+            return scan(false);
+        case VM_GETARGV:
+            return argv;
+        case VM_EXIT:
+            exit(static_cast<int>(args[0]));
+        case VM_ASSERT_FAIL: {
+            string name = script;
+            fflush(NULL);
+            fprintf(stderr, "%s: %s:%d: assert (%s) failed.\n",
+                    basename(&name[0]),
+                    reinterpret_cast<const char *>(args[1]),
+                    static_cast<int>(args[2]),
+                    reinterpret_cast<const char *>(args[0]));
+            fflush(NULL);
+            abort();
+        }
+        default:
+            return 0;
+    }
+}
+
+vm_memory::vm_memory(const vm_program &program, int argc, char **argv)
+        : stack(VM_STACK_WORDS), globals(program.globals.size()) {
+    if (argc > 0) script = argv[0];
+    for (const string &text: program.strings) {
+        strings.push_back(to_word(copy_string(text.data(), text.size())));
+    }
+    vm_word *words = vm_new_array(argc + 1);
+    for (int i = 0; i < argc; i++) {
+        words[i] = to_word(copy_string(argv[i], strlen(argv[i])));
+    }
+    arguments = to_word(words);
+}
+
+int run_vm(const vm_program &program, int argc, char **argv) {
+    vm_memory memory(program, argc, argv);
+    vector<vm_word> &globals = memory.globals;
+    vector<vm_word> &strings = memory.strings;
+    vector<vm_frame> frames;
+
+    static void *const dispatch[] = {
+        &&op_loadi, &&op_loads, &&op_move, &&op_getg, &&op_setg,
+        &&op_add, &&op_addi, &&op_sub, &&op_mul, &&op_div, &&op_rem,
+        &&op_neg, &&op_not, &&op_eq, &&op_ne, &&op_lt, &&op_le,
+        &&op_gt, &&op_ge, &&op_jump, &&op_jumpf, &&op_call,
+        &&op_builtin, &&op_return, &&op_returnv, &&op_newstruct,
+        &&op_newarray, &&op_newstring, &&op_getf, &&op_setf,
+        &&op_getx, &&op_setx, &&op_getc, &&op_setc,
+    };
+    static_assert(sizeof dispatch / sizeof *dispatch == VM_OPCODES,
+                  "one handler per opcode");
+
+    const vm_function *function = &program.functions[0];
+    const vm_instr *code = function->code.data();
+    const vm_instr *pc = code;
+    vm_word *r = memory.stack.data();
+    vm_word *limit = r + memory.stack.size();
+    vm_word result;
+
+#define NEXT()      goto *dispatch[(++pc)->opcode]
+#define JUMP(to)    do { pc = code + (to); \
+                         goto *dispatch[pc->opcode]; } while (0)
+#define CHECK(ok, message) \
+                    if (!(ok)) vm_fail(function, \
+                                       static_cast<size_t>(pc - code), \
+                                       message)
+
+    goto *dispatch[pc->opcode];
+
+op_loadi:
+    r[pc->a] = pc->wide();
+    NEXT();
+op_loads:
+    r[pc->a] = strings[pc->wide()];
+    NEXT();
+op_move:
+    r[pc->a] = r[pc->b];
+    NEXT();
+op_getg:
+    r[pc->a] = globals[pc->wide()];
+    NEXT();
+op_setg:
+    globals[pc->wide()] = r[pc->a];
+    NEXT();
+op_add:
+    r[pc->a] = wrap(bits(r[pc->b]) + bits(r[pc->c]));
+    NEXT();
+op_addi:
+    r[pc->a] = wrap(bits(r[pc->b])
+                    + bits(static_cast<int16_t>(pc->c)));
+    NEXT();
+op_sub:
+    r[pc->a] = wrap(bits(r[pc->b]) - bits(r[pc->c]));
+    NEXT();
+op_mul:
+    r[pc->a] = wrap(bits(r[pc->b]) * bits(r[pc->c]));
+    NEXT();
+op_div:
+    CHECK(r[pc->c] != 0, "division by zero");
+    r[pc->a] = r[pc->c] == -1 ? wrap(0u - bits(r[pc->b]))
+                              : r[pc->b] / r[pc->c];
+    NEXT();
+op_rem:
+    CHECK(r[pc->c] != 0, "division by zero");
+    r[pc->a] = r[pc->c] == -1 ? 0 : r[pc->b] % r[pc->c];
+    NEXT();
+op_neg:
+    r[pc->a] = wrap(0u - bits(r[pc->b]));
+    NEXT();
+op_not:
+    r[pc->a] = !r[pc->b];
+    NEXT();
+op_eq:
+    r[pc->a] = r[pc->b] == r[pc->c];
+    NEXT();
+op_ne:
+    r[pc->a] = r[pc->b] != r[pc->c];
+    NEXT();
+op_lt:
+    r[pc->a] = r[pc->b] < r[pc->c];
+    NEXT();
+op_le:
+    r[pc->a] = r[pc->b] <= r[pc->c];
+    NEXT();
+op_gt:
+    r[pc->a] = r[pc->b] > r[pc->c];
+    NEXT();
+op_ge:
+    r[pc->a] = r[pc->b] >= r[pc->c];
+    NEXT();
+op_jump:
+    JUMP(pc->wide());
+op_jumpf:
+    if (r[pc->a] == 0) JUMP(pc->wide());
+    NEXT();
+op_call: {
+    const vm_function *callee = &program.functions[pc->b];
+    vm_word *window = r + pc->c;
+    CHECK(window + callee->registers <= limit, "stack overflow");
+    frames.push_back({function, pc + 1, r, pc->a});
+    function = callee;
+    code = callee->code.data();
+    r = window;
+    JUMP(0);
+}
+op_builtin:
+    CHECK(pc->b != VM_PUTS || r[pc->c] != 0, "null pointer");
+    r[pc->a] = vm_call_builtin(static_cast<vm_builtin>(pc->b),
+                               r + pc->c, memory.arguments);
+    NEXT();
+op_return:
+    result = r[pc->a];
+    goto leave;
+op_returnv:
+    result = 0;
+leave: {
+    if (frames.empty()) return EXIT_SUCCESS;
+    const vm_frame &frame = frames.back();
+    function = frame.function;
+    code = function->code.data();
+    pc = frame.resume;
+    r = frame.window;
+    r[frame.dest] = result;
+    frames.pop_back();
+    goto *dispatch[pc->opcode];
+}
+op_newstruct:
+    r[pc->a] = to_word(vm_new_array(pc->b));
+    NEXT();
+op_newarray:
+    CHECK(r[pc->b] >= 0, "negative array size");
+    r[pc->a] = to_word(vm_new_array(r[pc->b]));
+    NEXT();
+op_newstring:
+    CHECK(r[pc->b] >= 0, "negative string size");
+    r[pc->a] = to_word(vm_new_string(r[pc->b]));
+    NEXT();
+op_getf: {
+    vm_word *object = reinterpret_cast<vm_word *>(r[pc->b]);
+    CHECK(object != nullptr, "null pointer");
+    r[pc->a] = object[pc->c];
+    NEXT();
+}
+op_setf: {
+    vm_word *object = reinterpret_cast<vm_word *>(r[pc->b]);
+    CHECK(object != nullptr, "null pointer");
+    object[pc->c] = r[pc->a];
+    NEXT();
+}
+op_getx: {
+    vm_word *array = reinterpret_cast<vm_word *>(r[pc->b]);
+    vm_word index = r[pc->c];
+    CHECK(array != nullptr, "null pointer");
+    CHECK(index >= 0 && index < length_of(array), "index out of range");
+    r[pc->a] = array[index];
+    NEXT();
+}
+op_setx: {
+    vm_word *array = reinterpret_cast<vm_word *>(r[pc->b]);
+    vm_word index = r[pc->c];
+    CHECK(array != nullptr, "null pointer");
+    CHECK(index >= 0 && index < length_of(array), "index out of range");
+    array[index] = r[pc->a];
+    NEXT();
+}
+op_getc: {
+    char *text = reinterpret_cast<char *>(r[pc->b]);
+    vm_word index = r[pc->c];
+    CHECK(text != nullptr, "null pointer");
+    CHECK(index >= 0 && index <= length_of(text), "index out of range");
+    r[pc->a] = static_cast<signed char>(text[index]);
+    NEXT();
+}
+op_setc: {
+    char *text = reinterpret_cast<char *>(r[pc->b]);
+    vm_word index = r[pc->c];
+    CHECK(text != nullptr, "null pointer");
+    CHECK(index >= 0 && index < length_of(text), "index out of range");
+    text[index] = static_cast<char>(r[pc->a]);
+    NEXT();
+}
+
+#undef NEXT
+#undef JUMP
+#undef CHECK
+}
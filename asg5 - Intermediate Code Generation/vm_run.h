@@ -0,0 +1,40 @@
+#ifndef __VM_RUN_H__
+#define __VM_RUN_H__
+
+#include "vm_code.h"
+
+constexpr size_t VM_STACK_WORDS = 1 << 20;
+
+// Memory a program starts with: the stack of register windows,
+// zeroed globals, its string literals copied to where it may write
+// them, and the array getargv() returns.
+struct vm_memory {
+    vm_memory(const vm_program &program, int argc, char **argv);
+
+    vector<vm_word> stack;
+    vector<vm_word> globals;
+    vector<vm_word> strings;
+    vm_word arguments;
+};
+
+// Runtime shared by the interpreter and the JIT.  Arrays and strings
+// are preceded by a word with their length.  vm_fail() reports the
+// source line of instruction at and exits.
+vm_word vm_call_builtin(vm_builtin builtin, const vm_word *args,
+                        vm_word argv);
+vm_word *vm_new_array(vm_word length);
+char *vm_new_string(vm_word length);
+[[noreturn]] void vm_fail(const vm_function *function, size_t at,
+                          const char *message);
+
+// Interprets a compiled program, passing it argv as the arguments
+// getargv() returns, and gives back its exit status.  Instructions
+// are dispatched by computed goto, each handler jumping straight to
+// the next one's.  The builtins of oclib.oh run natively with the
+// same output as oclib.c.  Since arrays and strings carry their
+// length, indexing out of range stops the program with an error, as
+// do null pointers, division by zero and recursion too deep for the
+// stack.
+int run_vm(const vm_program &program, int argc, char **argv);
+
+#endif